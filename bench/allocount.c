@@ -0,0 +1,79 @@
+/*
+ * Allocation counter for stream_bench, loaded into streamget with
+ * LD_PRELOAD. Counts the calls to malloc(), calloc() and realloc() of
+ * the whole process (libcurl included) and the bytes requested. When
+ * the process exits the counts are written to the file named by
+ * ALLOCOUNT_FILE, together with the read and write system calls of the
+ * process from /proc/self/io:
+ *
+ *   allocs N
+ *   bytes N
+ *   syscr N
+ *   syscw N
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "atomics.h"
+
+/* glibc's allocator, underneath the wrappers */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static atomic_ulong g_allocs;
+static atomic_ulong g_bytes;
+
+void *malloc(size_t size)
+{
+  atomic_fetch_add_explicit(&g_allocs, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&g_bytes, size, memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+  atomic_fetch_add_explicit(&g_allocs, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&g_bytes, nmemb * size, memory_order_relaxed);
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  atomic_fetch_add_explicit(&g_allocs, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&g_bytes, size, memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+
+__attribute__((destructor)) static void allocount_report(void)
+{
+  const char *name = getenv("ALLOCOUNT_FILE");
+  unsigned long syscr = 0, syscw = 0;
+  char line[128];
+  FILE *f;
+
+  if (!name)
+    return;
+
+  f = fopen("/proc/self/io", "r");
+  if (f)
+  {
+    while (fgets(line, sizeof(line), f))
+    {
+      sscanf(line, "syscr: %lu", &syscr);
+      sscanf(line, "syscw: %lu", &syscw);
+    }
+    fclose(f);
+  }
+
+  f = fopen(name, "w");
+  if (!f)
+    return;
+  fprintf(f, "allocs %lu\nbytes %lu\nsyscr %lu\nsyscw %lu\n",
+          atomic_load(&g_allocs), atomic_load(&g_bytes), syscr, syscw);
+  fclose(f);
+}
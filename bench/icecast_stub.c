@@ -0,0 +1,538 @@
+/*
+ * Local stand-in for an Icecast server, for benchmarks and tests.
+ *
+ * Serves one live MP3 stream (MPEG-1 Layer III, 44.1 kHz) at a given
+ * bitrate to any number of clients, on any path. Like a live station
+ * all clients get the same audio: a client joins at the live position,
+ * minus a burst of buffered audio sent right away (burst-on-connect),
+ * and from then on receives the stream in real time (or SPEED times
+ * faster). The reply carries the usual icy-* headers and, when the
+ * client sends "Icy-MetaData: 1", in-band metadata every METAINT bytes
+ * with a title that changes every 10 seconds of audio.
+ *
+ * The audio is a cycle of CYCLE_FRAMES valid frames, padded to keep the
+ * exact bitrate. Every frame carries its sequence number in the first
+ * bytes after the header and the data never contains a 0xFF byte, so
+ * no false sync word is found inside a frame.
+ *
+ * A single thread serves all clients with epoll and non-blocking sends.
+ * The port is printed on stdout ("port N") once the server listens, so
+ * with -p 0 a free port is picked.
+ *
+ * Faults can be injected, to see what a client loses at a reconnect
+ * (see reconnect_bench.c). A fault hits all clients AT seconds after
+ * the start and again every PERIOD seconds:
+ *
+ *   drop          close every connection, mid-frame
+ *   stall:SECS    send nothing for SECS, without closing
+ *   trickle:SECS:BPS  send only BPS bytes/sec for SECS
+ *   error:SECS    close every connection and answer 503 for SECS
+ *
+ * Connections opened while a stall or trickle lasts get it as well.
+ * After a stall or trickle a connection carries on where it was, behind
+ * the live position. -r sends every new request through a chain of N
+ * redirects first.
+ *
+ * usage: icecast_stub [-p PORT] [-b KBPS] [-x SPEED] [-B BURST-SECS]
+ *                     [-m METAINT] [-d SECS] [-f FAULT [-T AT] [-P PERIOD]]
+ *                     [-r N]
+ *   -d closes every connection after SECS seconds of audio (a server
+ *      dropping its listeners), 0 never does
+ */
+
+#define _GNU_SOURCE /* strcasestr() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#define DEFAULT_PORT (8000)
+#define DEFAULT_KBPS (128)
+#define DEFAULT_BURST (2.0)    /* (sec) Icecast's default burst-size is about this */
+#define DEFAULT_METAINT (16000)
+#define CYCLE_FRAMES (8192)    /* frames before the audio repeats, ~3.5 minutes */
+#define TICK (10)              /* (msec) between sends to the clients */
+#define REQUEST_MAX (4096)
+#define PENDING_MAX (1 + 255 * 16) /* a metadata block, or the reply header */
+#define TITLE_SECONDS (10)
+#define DEFAULT_FAULT_AT (5.0)
+
+/* kinds of faults */
+enum
+{
+  FAULT_NONE,
+  FAULT_DROP,
+  FAULT_STALL,
+  FAULT_TRICKLE,
+  FAULT_ERROR
+};
+
+typedef struct client
+{
+  int fd;
+  int streaming;        /* the request was read */
+  char request[REQUEST_MAX];
+  size_t requestlen;
+  double start;         /* time the client joined */
+  size_t pos;           /* offset of the next byte in the audio cycle */
+  unsigned long long sent; /* audio bytes sent */
+  double due;           /* audio bytes that may have been sent by now */
+  int metaint;          /* bytes of audio between metadata blocks, 0 is none */
+  int metaleft;         /* bytes of audio until the next metadata block */
+  long title;           /* last title sent, -1 none */
+  char pending[PENDING_MAX]; /* header or metadata block being sent */
+  size_t pendinglen;
+  size_t pendingoff;
+  struct client *prev;
+  struct client *next;
+} Client;
+
+static const int g_bitrates[] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320};
+
+static unsigned char *g_cycle;
+static size_t g_cyclelen;
+static double g_rate;  /* (bytes/sec) of audio sent to each client */
+static int g_kbps = DEFAULT_KBPS;
+static double g_burst = DEFAULT_BURST;
+static int g_metaint = DEFAULT_METAINT;
+static double g_duration = 0;
+static double g_epoch;
+static Client *g_clients = NULL;
+static int g_epoll;
+static int g_port;
+
+/* fault injection */
+static int g_fault = FAULT_NONE;
+static double g_fault_secs = 0;   /* how long a stall, trickle or error lasts */
+static double g_fault_rate = 0;   /* (bytes/sec) of a trickle */
+static double g_fault_at = DEFAULT_FAULT_AT;
+static double g_fault_period = 0;
+static double g_fault_until = 0;  /* end of the fault going on, 0 if none */
+static int g_redirects = 0;
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* build the audio cycle, returns 0 on success, -1 on a bad bitrate */
+static int make_cycle(int kbps)
+{
+  size_t base = 144000 * kbps / 44100;
+  size_t rest = 144000 * kbps % 44100;
+  size_t acc = 0;
+  unsigned char *p;
+  int index;
+  int pad;
+  int seq;
+  size_t i;
+
+  for (index = 1; index < 15 && g_bitrates[index] != kbps; ++index)
+    ;
+  if (15 == index)
+    return -1;
+
+  g_cycle = malloc((base + 1) * CYCLE_FRAMES);
+  if (!g_cycle)
+    return -1;
+
+  p = g_cycle;
+  for (seq = 0; seq < CYCLE_FRAMES; ++seq)
+  {
+    /* pad one frame in so many, so the bitrate comes out exact */
+    acc += rest;
+    pad = acc >= 44100;
+    if (pad)
+      acc -= 44100;
+
+    p[0] = 0xFF;
+    p[1] = 0xFB; /* MPEG-1 Layer III, no CRC */
+    p[2] = (index << 4) | (pad << 1); /* 44.1 kHz */
+    p[3] = 0x64; /* joint stereo */
+    p[4] = (seq >> 21) & 0x7F;
+    p[5] = (seq >> 14) & 0x7F;
+    p[6] = (seq >> 7) & 0x7F;
+    p[7] = seq & 0x7F;
+    for (i = 8; i < base + pad; ++i)
+      p[i] = (seq * 7 + i) % 0xF0;
+    p += base + pad;
+  }
+  g_cyclelen = p - g_cycle;
+
+  return 0;
+}
+
+static void drop_client(Client *c)
+{
+  if (c->prev)
+    c->prev->next = c->next;
+  else
+    g_clients = c->next;
+  if (c->next)
+    c->next->prev = c->prev;
+  close(c->fd);
+  free(c);
+}
+
+static void accept_clients(int listener)
+{
+  struct epoll_event ev;
+  Client *c;
+  int one = 1;
+  int fd;
+
+  while ((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+  {
+    c = calloc(1, sizeof(Client));
+    if (!c)
+    {
+      close(fd);
+      continue;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c->fd = fd;
+    c->title = -1;
+    c->next = g_clients;
+    if (g_clients)
+      g_clients->prev = c;
+    g_clients = c;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(g_epoll, EPOLL_CTL_ADD, fd, &ev);
+  }
+}
+
+/* send a reply that is all there is to the request, then close */
+static int reply(Client *c, int len)
+{
+  ssize_t n = send(c->fd, c->pending, len, MSG_NOSIGNAL);
+
+  (void)n; /* it fits in the socket buffer, and the client is gone otherwise */
+  return -1;
+}
+
+/* read (the rest of) the request, start streaming once it is complete */
+static int read_request(Client *c, double now)
+{
+  struct epoll_event ev;
+  unsigned long long live;
+  unsigned long long burst;
+  ssize_t n;
+  int hop;
+  int len;
+
+  n = recv(c->fd, c->request + c->requestlen, REQUEST_MAX - 1 - c->requestlen, 0);
+  if (n < 0 && (EAGAIN == errno || EINTR == errno))
+    return 0;
+  if (n <= 0)
+    return -1;
+  c->requestlen += n;
+  c->request[c->requestlen] = '\0';
+
+  if (!strstr(c->request, "\r\n\r\n"))
+    return c->requestlen < REQUEST_MAX - 1 ? 0 : -1;
+
+  if (now < g_fault_until && FAULT_ERROR == g_fault)
+  {
+    len = snprintf(c->pending, sizeof(c->pending),
+                   "HTTP/1.0 503 Service Unavailable\r\n"
+                   "Content-Type: text/plain\r\n\r\n"
+                   "Source temporarily unavailable\n");
+    return reply(c, len);
+  }
+
+  hop = 0;
+  sscanf(c->request, "GET /hop%d", &hop);
+  if (hop < g_redirects)
+  {
+    len = snprintf(c->pending, sizeof(c->pending),
+                   "HTTP/1.0 302 Found\r\n"
+                   "Location: http://127.0.0.1:%d/hop%d\r\n\r\n",
+                   g_port, hop + 1);
+    return reply(c, len);
+  }
+
+  if (g_metaint && strcasestr(c->request, "icy-metadata: 1"))
+    c->metaint = c->metaleft = g_metaint;
+
+  len = snprintf(c->pending, sizeof(c->pending),
+                 "HTTP/1.0 200 OK\r\n"
+                 "Server: Icecast 2.4.4 (streamget bench stub)\r\n"
+                 "Content-Type: audio/mpeg\r\n"
+                 "Cache-Control: no-cache\r\n"
+                 "icy-name: streamget bench\r\n"
+                 "icy-genre: Test\r\n"
+                 "icy-pub: 0\r\n"
+                 "icy-br: %d\r\n",
+                 g_kbps);
+  if (c->metaint)
+    len += snprintf(c->pending + len, sizeof(c->pending) - len, "icy-metaint: %d\r\n", c->metaint);
+  len += snprintf(c->pending + len, sizeof(c->pending) - len, "\r\n");
+  c->pendinglen = len;
+  c->pendingoff = 0;
+
+  /* join at the live position, a burst behind */
+  live = (unsigned long long)((now - g_epoch) * g_rate);
+  burst = (unsigned long long)(g_burst * g_kbps * 125);
+  if (burst > live)
+    burst = live;
+  c->pos = (live - burst) % g_cyclelen;
+  c->due = burst;
+  c->start = now;
+  c->streaming = 1;
+
+  /* from now on only written to */
+  ev.events = 0;
+  ev.data.ptr = c;
+  epoll_ctl(g_epoll, EPOLL_CTL_MOD, c->fd, &ev);
+
+  return 0;
+}
+
+/* queue the metadata block that is due */
+static void make_meta(Client *c)
+{
+  long title = (long)(c->sent / (g_kbps * 125 * TITLE_SECONDS));
+  char *text = c->pending + 1;
+  int len;
+
+  c->pendingoff = 0;
+  if (title == c->title)
+  {
+    /* unchanged, an empty block */
+    c->pending[0] = 0;
+    c->pendinglen = 1;
+    return;
+  }
+
+  c->title = title;
+  len = snprintf(text, sizeof(c->pending) - 1, "StreamTitle='Bench Artist - Title %ld';", title);
+  memset(text + len, 0, 16 - len % 16);
+  c->pending[0] = len / 16 + 1;
+  c->pendinglen = 1 + (len / 16 + 1) * 16;
+}
+
+/* send what is due to a client, returns -1 when it has to go */
+static int serve(Client *c, unsigned long long due)
+{
+  size_t chunk;
+  ssize_t n;
+
+  if (g_duration && c->sent >= g_duration * g_kbps * 125)
+    return -1;
+
+  for (;;)
+  {
+    if (c->pendingoff < c->pendinglen)
+    {
+      n = send(c->fd, c->pending + c->pendingoff, c->pendinglen - c->pendingoff, MSG_NOSIGNAL);
+      if (n < 0)
+        return (EAGAIN == errno || EINTR == errno) ? 0 : -1;
+      c->pendingoff += n;
+      continue;
+    }
+
+    if (c->sent >= due)
+      return 0;
+
+    if (c->metaint && 0 == c->metaleft)
+    {
+      make_meta(c);
+      c->metaleft = c->metaint;
+      continue;
+    }
+
+    chunk = due - c->sent;
+    if (chunk > g_cyclelen - c->pos)
+      chunk = g_cyclelen - c->pos;
+    if (c->metaint && chunk > (size_t)c->metaleft)
+      chunk = c->metaleft;
+
+    n = send(c->fd, g_cycle + c->pos, chunk, MSG_NOSIGNAL);
+    if (n < 0)
+      return (EAGAIN == errno || EINTR == errno) ? 0 : -1;
+
+    c->sent += n;
+    c->pos = (c->pos + n) % g_cyclelen;
+    if (c->metaint)
+      c->metaleft -= n;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  struct epoll_event events[64];
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  struct epoll_event ev;
+  double speed = 1.0;
+  double next_fault;
+  double last, rate;
+  char *arg;
+  int port = DEFAULT_PORT;
+  int listener;
+  int one = 1;
+  Client *c, *next;
+  double now;
+  int opt;
+  int n, i;
+
+  while ((opt = getopt(argc, argv, "p:b:x:B:m:d:f:T:P:r:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'b':
+      g_kbps = atoi(optarg);
+      break;
+    case 'x':
+      speed = atof(optarg);
+      break;
+    case 'B':
+      g_burst = atof(optarg);
+      break;
+    case 'm':
+      g_metaint = atoi(optarg);
+      break;
+    case 'd':
+      g_duration = atof(optarg);
+      break;
+    case 'f':
+      arg = strchr(optarg, ':');
+      if (0 == strncmp(optarg, "drop", 4))
+        g_fault = FAULT_DROP;
+      else if (0 == strncmp(optarg, "stall", 5))
+        g_fault = FAULT_STALL;
+      else if (0 == strncmp(optarg, "trickle", 7))
+        g_fault = FAULT_TRICKLE;
+      else if (0 == strncmp(optarg, "error", 5))
+        g_fault = FAULT_ERROR;
+      if (arg)
+        g_fault_secs = atof(arg + 1);
+      if (arg && (arg = strchr(arg + 1, ':')))
+        g_fault_rate = atof(arg + 1);
+      break;
+    case 'T':
+      g_fault_at = atof(optarg);
+      break;
+    case 'P':
+      g_fault_period = atof(optarg);
+      break;
+    case 'r':
+      g_redirects = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-p PORT] [-b KBPS] [-x SPEED] [-B BURST-SECS] [-m METAINT] [-d SECS]\n"
+                      "       [-f drop|stall:SECS|trickle:SECS:BPS|error:SECS [-T AT] [-P PERIOD]] [-r N]\n",
+              argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (speed <= 0 || g_burst < 0 || g_metaint < 0 || g_duration < 0 || make_cycle(g_kbps) < 0)
+  {
+    fprintf(stderr, "%s: bad bitrate (32..320 kbps) or negative value\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  if ((FAULT_NONE != g_fault && FAULT_DROP != g_fault && g_fault_secs <= 0) ||
+      (FAULT_TRICKLE == g_fault && g_fault_rate <= 0) || g_fault_period < 0 || g_redirects < 0)
+  {
+    fprintf(stderr, "%s: bad fault\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  g_rate = g_kbps * 125.0 * speed;
+
+  signal(SIGPIPE, SIG_IGN);
+
+  listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listener, 1024) < 0 ||
+      getsockname(listener, (struct sockaddr *)&addr, &addrlen) < 0)
+  {
+    fprintf(stderr, "%s: can't listen on port %d: %s\n", argv[0], port, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  g_epoll = epoll_create1(EPOLL_CLOEXEC);
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(g_epoll, EPOLL_CTL_ADD, listener, &ev);
+
+  g_port = ntohs(addr.sin_port);
+  printf("port %d\n", g_port);
+  fflush(stdout);
+
+  /* the station has been on the air for the burst already */
+  last = now_sec();
+  g_epoch = last - g_burst * g_kbps * 125 / g_rate;
+  next_fault = g_fault ? last + g_fault_at : 0;
+
+  for (;;)
+  {
+    n = epoll_wait(g_epoll, events, 64, TICK);
+    now = now_sec();
+
+    for (i = 0; i < n; ++i)
+    {
+      c = events[i].data.ptr;
+      if (!c)
+        accept_clients(listener);
+      else if (!c->streaming && read_request(c, now) < 0)
+        drop_client(c);
+    }
+
+    if (next_fault && now >= next_fault)
+    {
+      next_fault = g_fault_period ? next_fault + g_fault_period : 0;
+      g_fault_until = now + g_fault_secs;
+      if (FAULT_DROP == g_fault || FAULT_ERROR == g_fault)
+      {
+        for (c = g_clients; c; c = next)
+        {
+          next = c->next;
+          if (c->streaming)
+            drop_client(c);
+        }
+      }
+    }
+
+    /* what each client may get in this tick */
+    rate = g_rate;
+    if (now < g_fault_until && FAULT_STALL == g_fault)
+      rate = 0;
+    else if (now < g_fault_until && FAULT_TRICKLE == g_fault)
+      rate = g_fault_rate;
+
+    for (c = g_clients; c; c = next)
+    {
+      next = c->next;
+      if (!c->streaming)
+        continue;
+      if (c->start < now)
+        c->due += rate * (now - (c->start > last ? c->start : last));
+      if (serve(c, (unsigned long long)c->due) < 0)
+        drop_client(c);
+    }
+    last = now;
+  }
+
+  return EXIT_SUCCESS;
+}
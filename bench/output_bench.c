@@ -0,0 +1,149 @@
+/*
+ * Benchmark of the output backends of output.c: write() versus io_uring.
+ *
+ * Replays the write pattern of the recording loop for a number of
+ * streams: in every pass each stream hands one packet to output_writev(),
+ * then output_flush() is called once (it submits the io_uring batch).
+ * Reports system calls per second and per MB, and the latency of the
+ * output calls as seen by the recording loop (p50, p99, max).
+ *
+ * usage: output_bench [DIRECTORY [STREAMS [MB [WRITE-BYTES [BUFFERS]]]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "output.h"
+
+#define DEFAULT_STREAMS (32)
+#define DEFAULT_MEGABYTES (256)
+#define DEFAULT_WRITE (8 * 1024)
+#define DEFAULT_BUFFERS (128)
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void run(const char *name, const char *dir, int streams, size_t megabytes,
+                size_t size, int buffers)
+{
+  OUTPUT **out = calloc(streams, sizeof(OUTPUT *));
+  char *data = malloc(size);
+  size_t rounds = megabytes * 1024 * 1024 / size / streams;
+  size_t nsamples = rounds * (streams + 1);
+  double *samples = malloc(nsamples * sizeof(double));
+  size_t n = 0;
+  unsigned long syscalls;
+  struct iovec iov;
+  char path[4096];
+  double start;
+  double elapsed;
+  double t;
+  double mb;
+  size_t r;
+  int i;
+  int fd;
+
+  if (!out || !data || !samples || !rounds)
+  {
+    fprintf(stderr, "out of memory or nothing to do\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(data, 0x55, size);
+  iov.iov_base = data;
+  iov.iov_len = size;
+
+  if (buffers && output_uring_start(buffers) < 0)
+  {
+    printf("%-8s not available: %s\n", name, strerror(errno));
+    goto done;
+  }
+
+  for (i = 0; i < streams; ++i)
+  {
+    snprintf(path, sizeof(path), "%s/output_bench.%d", dir, i);
+    fd = open(path, O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 00666);
+    if (fd < 0 || !(out[i] = output_fdopen(fd)))
+    {
+      fprintf(stderr, "can't open '%s': %s\n", path, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    unlink(path);
+  }
+
+  syscalls = output_syscalls();
+  start = now_sec();
+
+  for (r = 0; r < rounds; ++r)
+  {
+    for (i = 0; i < streams; ++i)
+    {
+      t = now_sec();
+      while (0 == output_writev(out[i], &iov, 1))
+        output_flush(); /* out of buffers, as the loop would retry */
+      samples[n++] = now_sec() - t;
+    }
+
+    t = now_sec();
+    output_flush();
+    samples[n++] = now_sec() - t;
+  }
+
+  for (i = 0; i < streams; ++i)
+    output_close(out[i]);
+  output_uring_stop(); /* waits for the writes in flight */
+
+  elapsed = now_sec() - start;
+  syscalls = output_syscalls() - syscalls;
+  mb = (double)rounds * streams * size / (1024.0 * 1024.0);
+
+  qsort(samples, n, sizeof(double), compare_double);
+  printf("%-8s %8.1f MB/s %10.0f syscalls/s %8.1f syscalls/MB"
+         "   latency p50 %6.1f us p99 %7.1f us max %8.1f us\n",
+         name, mb / elapsed, syscalls / elapsed, syscalls / mb,
+         samples[n / 2] * 1e6, samples[n * 99 / 100] * 1e6, samples[n - 1] * 1e6);
+
+done:
+  free(samples);
+  free(data);
+  free(out);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *dir = (argc > 1 ? argv[1] : ".");
+  int streams = (argc > 2 ? atoi(argv[2]) : DEFAULT_STREAMS);
+  size_t megabytes = (argc > 3 ? strtoul(argv[3], NULL, 10) : DEFAULT_MEGABYTES);
+  size_t size = (argc > 4 ? strtoul(argv[4], NULL, 10) : DEFAULT_WRITE);
+  int buffers = (argc > 5 ? atoi(argv[5]) : DEFAULT_BUFFERS);
+
+  if (streams <= 0 || !megabytes || !size || size > OUTPUT_SLOT_SIZE || buffers <= 0)
+  {
+    fprintf(stderr, "usage: %s [DIRECTORY [STREAMS [MB [WRITE-BYTES <= %d [BUFFERS]]]]]\n",
+            argv[0], OUTPUT_SLOT_SIZE);
+    return EXIT_FAILURE;
+  }
+
+  printf("%d streams, %lu MB in writes of %lu bytes to '%s'\n",
+         streams, (unsigned long)megabytes, (unsigned long)size, dir);
+  run("write", dir, streams, megabytes, size, 0);
+  run("io_uring", dir, streams, megabytes, size, buffers);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,338 @@
+/*
+ * Reconnect-gap benchmark: how much audio does streamget lose or record
+ * twice when the stream breaks?
+ *
+ * Runs streamget against icecast_stub once per fault scenario (see the
+ * table below; a fault hits FAULT_AT seconds in and every FAULT_PERIOD
+ * seconds after that) and checks the recording against the sequence
+ * numbers the stub puts in every frame. For each scenario it reports
+ * per fault event the milliseconds of audio lost (frames skipped) and
+ * duplicated (frames recorded again), and the bytes of broken frames
+ * and junk that ended up in the file.
+ *
+ * Runs in real time, as the reconnect timeouts do. Run from the build
+ * tree; icecast_stub is looked up next to this program, streamget in
+ * ../src unless given. Options after "--" are passed to streamget
+ * (e.g. -- -F -D 10 -r 1).
+ *
+ * usage: reconnect_bench [STREAMGET [SECONDS [SCENARIO...]]] [-- OPTIONS]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define DEFAULT_SECONDS (50)
+#define FAULT_AT (5)
+#define FAULT_PERIOD (15)
+#define MAX_OPTIONS (32)
+
+/* the stream of the stub: MPEG-1 Layer III, 128 kbps, 44.1 kHz */
+#define KBPS "128"
+#define FRAME_MS (1152 * 1000.0 / 44100)
+#define CYCLE_FRAMES (8192) /* as in icecast_stub.c */
+
+typedef struct
+{
+  const char *name;
+  const char *fault;      /* -f of icecast_stub */
+  const char *redirects;  /* -r of icecast_stub, NULL for none */
+  const char *description;
+} Scenario;
+
+static const Scenario g_scenarios[] = {
+    {"drop", "drop", NULL, "connection closed mid-frame"},
+    {"stall2", "stall:2", NULL, "no data for 2 s, connection kept open"},
+    {"stall10", "stall:10", NULL, "no data for 10 s, connection kept open"},
+    {"trickle", "trickle:5:2000", NULL, "2000 bytes/s for 5 s"},
+    {"error", "error:5", NULL, "connection closed, 503 for 5 s"},
+    {"redirect", "drop", "3", "connection closed, reconnect through 3 redirects"},
+};
+
+#define NSCENARIOS ((int)(sizeof(g_scenarios) / sizeof(g_scenarios[0])))
+
+typedef struct
+{
+  unsigned long frames;  /* whole frames in the recording */
+  unsigned long lost;    /* frames skipped */
+  unsigned long dups;    /* frames recorded more than once */
+  unsigned long breaks;  /* places the sequence doesn't continue */
+  unsigned long garbage; /* bytes that are not part of a whole frame */
+} Result;
+
+/* a frame header of the stub's stream at p, returns its length or 0 */
+static size_t frame_at(const unsigned char *p, size_t left)
+{
+  if (left < 8 || p[0] != 0xFF || p[1] != 0xFB || (p[2] >> 4) != 9)
+    return 0;
+  return 144 * 128000 / 44100 + ((p[2] >> 1) & 1);
+}
+
+/*
+ * Walk the recording frame by frame. A frame counts when it is followed
+ * by another frame (or the end of the file); anything else, such as a
+ * frame cut short by a reconnect, is garbage. The frame data never
+ * contains 0xFF, so the walk finds the next frame right away.
+ */
+static int analyze(const char *path, Result *r)
+{
+  unsigned char *data;
+  size_t size, p, len;
+  long prev = -1, seq, diff;
+  FILE *f = fopen(path, "rb");
+
+  memset(r, 0, sizeof(*r));
+  if (!f)
+    return -1;
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  rewind(f);
+  data = malloc(size + 1);
+  if (!data || fread(data, 1, size, f) != size)
+  {
+    free(data);
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  for (p = 0; p < size;)
+  {
+    len = frame_at(data + p, size - p);
+    if (!len || p + len > size || (p + len < size && !frame_at(data + p + len, size - p - len)))
+    {
+      r->garbage++;
+      p++;
+      continue;
+    }
+
+    seq = ((long)data[p + 4] << 21) | (data[p + 5] << 14) | (data[p + 6] << 7) | data[p + 7];
+    if (prev >= 0)
+    {
+      diff = ((seq - prev) % CYCLE_FRAMES + CYCLE_FRAMES) % CYCLE_FRAMES;
+      if (diff != 1)
+      {
+        r->breaks++;
+        if (diff > 1 && diff < CYCLE_FRAMES / 2)
+          r->lost += diff - 1;
+        else
+          r->dups += diff ? CYCLE_FRAMES - diff + 1 : 1; /* 0: the same frame again */
+      }
+    }
+    prev = seq;
+    r->frames++;
+    p += len;
+  }
+
+  free(data);
+  return 0;
+}
+
+/* start icecast_stub with a fault on a free port, returns its pid */
+static pid_t start_stub(const char *stub, const Scenario *s, int *port)
+{
+  const char *args[16];
+  char at[16], period[16];
+  char line[64];
+  int nargs = 0;
+  int fds[2];
+  FILE *f;
+  pid_t pid;
+
+  snprintf(at, sizeof(at), "%d", FAULT_AT);
+  snprintf(period, sizeof(period), "%d", FAULT_PERIOD);
+  args[nargs++] = stub;
+  args[nargs++] = "-p";
+  args[nargs++] = "0";
+  args[nargs++] = "-b";
+  args[nargs++] = KBPS;
+  args[nargs++] = "-f";
+  args[nargs++] = s->fault;
+  args[nargs++] = "-T";
+  args[nargs++] = at;
+  args[nargs++] = "-P";
+  args[nargs++] = period;
+  if (s->redirects)
+  {
+    args[nargs++] = "-r";
+    args[nargs++] = s->redirects;
+  }
+  args[nargs] = NULL;
+
+  if (pipe(fds) < 0 || (pid = fork()) < 0)
+    return -1;
+
+  if (0 == pid)
+  {
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    execv(stub, (char *const *)args);
+    fprintf(stderr, "can't run '%s': %s\n", stub, strerror(errno));
+    _exit(127);
+  }
+
+  close(fds[1]);
+  f = fdopen(fds[0], "r");
+  if (!f || !fgets(line, sizeof(line), f) || sscanf(line, "port %d", port) != 1)
+  {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+  }
+  fclose(f);
+
+  return pid;
+}
+
+static int run(const Scenario *s, const char *stub, const char *streamget, int seconds,
+               char **options, int noptions)
+{
+  const char *args[MAX_OPTIONS + 8];
+  char url[64], limit[16];
+  char out[] = "/tmp/reconnect_bench.XXXXXX";
+  int events = seconds > FAULT_AT ? (seconds - FAULT_AT - 1) / FAULT_PERIOD + 1 : 0;
+  int nargs = 0;
+  Result r;
+  pid_t stub_pid, pid;
+  int status;
+  int port;
+  int fd;
+  int i;
+
+  fd = mkstemp(out);
+  if (fd < 0)
+  {
+    fprintf(stderr, "can't create a file in /tmp: %s\n", strerror(errno));
+    return -1;
+  }
+  close(fd);
+
+  stub_pid = start_stub(stub, s, &port);
+  if (stub_pid < 0)
+  {
+    fprintf(stderr, "can't start '%s'\n", stub);
+    unlink(out);
+    return -1;
+  }
+
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d/stream", port);
+  snprintf(limit, sizeof(limit), "%d", seconds);
+  args[nargs++] = streamget;
+  args[nargs++] = "-u";
+  args[nargs++] = url;
+  args[nargs++] = "-o";
+  args[nargs++] = out;
+  args[nargs++] = "-s";
+  args[nargs++] = limit;
+  for (i = 0; i < noptions; ++i)
+    args[nargs++] = options[i];
+  args[nargs] = NULL;
+
+  pid = fork();
+  if (0 == pid)
+  {
+    if (!freopen("/dev/null", "w", stdout))
+      _exit(127);
+    execv(streamget, (char *const *)args);
+    fprintf(stderr, "can't run '%s': %s\n", streamget, strerror(errno));
+    _exit(127);
+  }
+  if (pid < 0 || waitpid(pid, &status, 0) < 0)
+    status = -1;
+
+  kill(stub_pid, SIGTERM);
+  waitpid(stub_pid, NULL, 0);
+
+  if (analyze(out, &r) < 0)
+    memset(&r, 0, sizeof(r));
+  unlink(out);
+
+  printf("%-9s %6d %9.1f %9.0f %9.0f %9.0f %9.0f %7lu %9lu   %s%s\n",
+         s->name, events, r.frames * FRAME_MS / 1000,
+         r.lost * FRAME_MS, events ? r.lost * FRAME_MS / events : 0,
+         r.dups * FRAME_MS, events ? r.dups * FRAME_MS / events : 0,
+         r.breaks, r.garbage, s->description,
+         (WIFEXITED(status) && 0 == WEXITSTATUS(status)) ? "" : " (streamget failed)");
+  fflush(stdout);
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  char self[PATH_MAX], dir[PATH_MAX - 32];
+  char stub[PATH_MAX], streamget[PATH_MAX];
+  const char *selected[NSCENARIOS];
+  int nselected = 0;
+  int seconds = DEFAULT_SECONDS;
+  int options;
+  ssize_t n;
+  int i, j;
+
+  for (options = 1; options < argc && strcmp(argv[options], "--"); ++options)
+    ;
+
+  n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  if (n < 0)
+  {
+    fprintf(stderr, "can't find myself: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  self[n] = '\0';
+  snprintf(dir, sizeof(dir), "%s", dirname(self));
+  snprintf(stub, sizeof(stub), "%s/icecast_stub", dir);
+  if (options > 1 && *argv[1])
+    snprintf(streamget, sizeof(streamget), "%s", argv[1]);
+  else
+    snprintf(streamget, sizeof(streamget), "%s/../src/streamget", dir);
+  if (options > 2)
+    seconds = atoi(argv[2]);
+
+  for (i = 3; i < options; ++i)
+  {
+    for (j = 0; j < NSCENARIOS && strcmp(argv[i], g_scenarios[j].name); ++j)
+      ;
+    if (j == NSCENARIOS || nselected == NSCENARIOS)
+      seconds = 0; /* unknown scenario */
+    else
+      selected[nselected++] = g_scenarios[j].name;
+  }
+
+  if (seconds <= 0 || argc - options - 1 > MAX_OPTIONS)
+  {
+    fprintf(stderr, "usage: %s [STREAMGET [SECONDS [SCENARIO...]]] [-- OPTIONS]\nscenarios:", argv[0]);
+    for (j = 0; j < NSCENARIOS; ++j)
+      fprintf(stderr, " %s", g_scenarios[j].name);
+    fprintf(stderr, "\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("%d s per scenario, a fault at %d s and every %d s, streamget %s",
+         seconds, FAULT_AT, FAULT_PERIOD, streamget);
+  for (i = options + 1; i < argc; ++i)
+    printf(" %s", argv[i]);
+  printf("\n%-9s %6s %9s %9s %9s %9s %9s %7s %9s\n",
+         "scenario", "events", "audio(s)", "lost(ms)", "per event", "dup(ms)", "per event",
+         "breaks", "garbage");
+  fflush(stdout); /* before the children inherit the buffer */
+
+  for (j = 0; j < NSCENARIOS; ++j)
+  {
+    for (i = 0; i < nselected && strcmp(selected[i], g_scenarios[j].name); ++i)
+      ;
+    if (nselected && i == nselected)
+      continue;
+    run(&g_scenarios[j], stub, streamget, seconds,
+        options < argc ? argv + options + 1 : NULL, options < argc ? argc - options - 1 : 0);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,212 @@
+/*
+ * Microbenchmark for the receive buffer of url_fopen.c
+ *
+ * Replays two access patterns of sg_mainloop(): curl delivers packets of
+ * varying size through write_callback() until at least one read chunk is
+ * buffered, after which url_fread() takes out one chunk ("chunked"), and
+ * a reader that keeps up with the network and takes out whatever arrived
+ * after every packet ("drain"). Both are run against the old
+ * realloc()/memmove() buffer and against the ring buffer, reporting
+ * throughput and the number of heap allocations per MB moved.
+ *
+ * Allocations are counted by wrapping malloc/realloc/free at link time
+ * (-Wl,--wrap=...), so the figures include everything the code under
+ * test does.
+ *
+ * usage: ringbuf_bench [MB] [read-chunk-bytes] [ring-capacity-bytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ringbuf.h"
+
+#define DEFAULT_MEGABYTES (512)
+#define DEFAULT_CHUNK (64 * 1024)
+#define DEFAULT_CAPACITY (256 * 1024)
+#define MAX_PACKET (16 * 1024) /* CURL_MAX_WRITE_SIZE */
+
+/* volatile: the compiler assumes malloc() and friends leave it alone */
+static volatile unsigned long g_allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size)
+{
+  ++g_allocs;
+  return __real_malloc(size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  ++g_allocs;
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+  __real_free(ptr);
+}
+
+/* the buffer handling of url_fopen.c before the ring buffer */
+typedef struct
+{
+  char *buffer;
+  int buffer_len;
+  int buffer_pos;
+} LegacyBuffer;
+
+static void legacy_write(LegacyBuffer *lb, const char *src, int size)
+{
+  int rembuff = lb->buffer_len - lb->buffer_pos;
+
+  if (size > rembuff)
+  {
+    char *newbuff = realloc(lb->buffer, lb->buffer_len + (size - rembuff));
+    if (!newbuff)
+    {
+      fprintf(stderr, "realloc failed\n");
+      exit(EXIT_FAILURE);
+    }
+    lb->buffer_len += size - rembuff;
+    lb->buffer = newbuff;
+  }
+  memcpy(&lb->buffer[lb->buffer_pos], src, size);
+  lb->buffer_pos += size;
+}
+
+static int legacy_read(LegacyBuffer *lb, char *dst, int want)
+{
+  if (lb->buffer_pos < want)
+    want = lb->buffer_pos;
+
+  memcpy(dst, lb->buffer, want);
+  if (lb->buffer_pos - want <= 0)
+  {
+    free(lb->buffer);
+    lb->buffer = NULL;
+    lb->buffer_pos = 0;
+    lb->buffer_len = 0;
+  }
+  else
+  {
+    memmove(lb->buffer, &lb->buffer[want], lb->buffer_pos - want);
+    lb->buffer_pos -= want;
+  }
+  return want;
+}
+
+/* deterministic packet sizes, identical for both runs */
+static int next_packet(unsigned int *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return 1 + (*seed >> 8) % MAX_PACKET;
+}
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, const char *pattern, double total,
+                   double elapsed, unsigned long allocs)
+{
+  double mb = total / (1024.0 * 1024.0);
+
+  printf("%-8s %-8s %10.1f MB/s %12.2f allocs/MB %10lu allocs\n",
+         name, pattern, mb / elapsed, allocs / mb, allocs);
+}
+
+/* fill: read once at least this many bytes are buffered */
+static void run_legacy(size_t megabytes, int fill, int chunk, const char *packet, char *out)
+{
+  LegacyBuffer lb = {NULL, 0, 0};
+  size_t total = megabytes * 1024 * 1024;
+  size_t produced = 0;
+  size_t consumed = 0;
+  unsigned int seed = 1;
+  unsigned long allocs = g_allocs;
+  double start = now_sec();
+
+  while (consumed < total)
+  {
+    while (produced < total && lb.buffer_pos < fill)
+    {
+      int size = next_packet(&seed);
+      legacy_write(&lb, packet, size);
+      produced += size;
+    }
+    consumed += legacy_read(&lb, out, chunk);
+  }
+  report("legacy", fill > 1 ? "chunked" : "drain", consumed,
+         now_sec() - start, g_allocs - allocs);
+  free(lb.buffer);
+}
+
+static void run_ring(size_t megabytes, int fill, int chunk, size_t capacity,
+                     const char *packet, char *out)
+{
+  RingBuffer rb;
+  size_t total = megabytes * 1024 * 1024;
+  size_t produced = 0;
+  size_t consumed = 0;
+  unsigned int seed = 1;
+  unsigned long allocs = g_allocs;
+  double start = now_sec();
+
+  if (ringbuf_init(&rb, capacity) < 0)
+  {
+    perror("ringbuf_init");
+    exit(EXIT_FAILURE);
+  }
+
+  while (consumed < total)
+  {
+    while (produced < total && ringbuf_used(&rb) < (size_t)fill)
+    {
+      int size = next_packet(&seed);
+      if ((size_t)size > ringbuf_space(&rb))
+        break; /* write_callback() would pause the transfer here */
+      ringbuf_write(&rb, packet, size);
+      produced += size;
+    }
+    consumed += ringbuf_read(&rb, out, chunk);
+  }
+  report("ring", fill > 1 ? "chunked" : "drain", consumed,
+         now_sec() - start, g_allocs - allocs);
+  ringbuf_free(&rb);
+}
+
+int main(int argc, char *argv[])
+{
+  size_t megabytes = (argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_MEGABYTES);
+  int chunk = (argc > 2 ? atoi(argv[2]) : DEFAULT_CHUNK);
+  size_t capacity = (argc > 3 ? strtoul(argv[3], NULL, 10) : DEFAULT_CAPACITY);
+  char *packet = malloc(MAX_PACKET);
+  char *out = malloc(chunk);
+
+  if (!megabytes || chunk <= 0 || capacity < (size_t)chunk + MAX_PACKET || !packet || !out)
+  {
+    fprintf(stderr, "usage: %s [MB] [read-chunk-bytes] [ring-capacity-bytes >= chunk + %d]\n",
+            argv[0], MAX_PACKET);
+    return EXIT_FAILURE;
+  }
+  memset(packet, 0x55, MAX_PACKET);
+
+  printf("%lu MB, read chunk %d bytes, ring capacity %lu bytes\n",
+         (unsigned long)megabytes, chunk, (unsigned long)capacity);
+  run_legacy(megabytes, chunk, chunk, packet, out);
+  run_ring(megabytes, chunk, chunk, capacity, packet, out);
+  run_legacy(megabytes, 1, chunk, packet, out);
+  run_ring(megabytes, 1, chunk, capacity, packet, out);
+
+  free(packet);
+  free(out);
+  return EXIT_SUCCESS;
+}
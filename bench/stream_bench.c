@@ -0,0 +1,277 @@
+/*
+ * End-to-end benchmark of streamget: records a number of streams from
+ * the local Icecast stand-in (icecast_stub) and reports what that cost.
+ *
+ * Starts icecast_stub on a free port, writes a job file with one job
+ * per stream (all with the same time limit) and runs streamget on it,
+ * with allocount.so preloaded. Once streamget is done it reports:
+ *
+ * - CPU time (user + system) per stream, as a share of one core
+ * - bytes recorded per second, in total and per stream
+ * - read/write system calls per MB recorded (syscr + syscw of
+ *   /proc/self/io, so epoll_wait() and friends are not included)
+ * - peak RSS
+ * - heap allocations per MB recorded, libcurl's included
+ *
+ * The stub's own CPU time is reported as well, to tell when it rather
+ * than streamget is the bottleneck. SPEED > 1 makes the stub send
+ * faster than real time, so a short run moves a lot of data.
+ *
+ * Run from the build tree; icecast_stub and allocount.so are looked up
+ * next to this program, streamget in ../src unless given. Options after
+ * "--" are passed to streamget (e.g. -- -F -w 4194304).
+ *
+ * usage: stream_bench [STREAMGET [STREAMS [SECONDS [KBPS [SPEED]]]]] [-- OPTIONS]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <libgen.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define DEFAULT_STREAMS (100)
+#define DEFAULT_SECONDS (10)
+#define DEFAULT_KBPS (128)
+#define DEFAULT_SPEED (1.0)
+#define MAX_OPTIONS (32)
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_sec(const struct rusage *ru)
+{
+  return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 +
+         ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+/* start icecast_stub on a free port, returns its pid and sets *port */
+static pid_t start_stub(const char *stub, int kbps, double speed, int *port)
+{
+  char rate[16], factor[32];
+  char line[64];
+  int fds[2];
+  FILE *f;
+  pid_t pid;
+
+  snprintf(rate, sizeof(rate), "%d", kbps);
+  snprintf(factor, sizeof(factor), "%g", speed);
+
+  if (pipe(fds) < 0 || (pid = fork()) < 0)
+    return -1;
+
+  if (0 == pid)
+  {
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    execl(stub, stub, "-p", "0", "-b", rate, "-x", factor, (char *)NULL);
+    fprintf(stderr, "can't run '%s': %s\n", stub, strerror(errno));
+    _exit(127);
+  }
+
+  close(fds[1]);
+  f = fdopen(fds[0], "r");
+  if (!f || !fgets(line, sizeof(line), f) || sscanf(line, "port %d", port) != 1)
+  {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+  }
+  fclose(f);
+
+  return pid;
+}
+
+/* read "NAME VALUE" from the report of allocount.so, 0 if missing */
+static unsigned long report_value(const char *path, const char *key)
+{
+  unsigned long value = 0;
+  char name[32];
+  unsigned long v;
+  FILE *f = fopen(path, "r");
+
+  if (!f)
+    return 0;
+  while (fscanf(f, "%31s %lu", name, &v) == 2)
+  {
+    if (0 == strcmp(name, key))
+      value = v;
+  }
+  fclose(f);
+  return value;
+}
+
+int main(int argc, char *argv[])
+{
+  char self[PATH_MAX], dir[PATH_MAX - 32], path[PATH_MAX], jobfile[PATH_MAX];
+  char stub[PATH_MAX], preload[PATH_MAX], streamget[PATH_MAX];
+  char tmp[] = "/tmp/stream_bench.XXXXXX";
+  const char *args[MAX_OPTIONS + 4];
+  int nargs = 0;
+  const char *positional[5] = {NULL};
+  int npositional = 0;
+  int options;
+  int streams, seconds, kbps;
+  double speed;
+  struct rusage ru, stub_ru;
+  struct stat st;
+  double start, elapsed, cpu, mb;
+  unsigned long long bytes = 0;
+  unsigned long allocs, syscalls;
+  FILE *jobs;
+  pid_t stub_pid, pid;
+  int status;
+  int ran = 0;
+  int port;
+  int i;
+  ssize_t n;
+
+  /* positional arguments up to "--", the rest is for streamget */
+  for (i = 1; i < argc && strcmp(argv[i], "--"); ++i)
+  {
+    if (npositional < 5)
+      positional[npositional++] = argv[i];
+  }
+  options = i + 1;
+  n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  if (n < 0)
+  {
+    fprintf(stderr, "can't find myself: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  self[n] = '\0';
+  snprintf(dir, sizeof(dir), "%s", dirname(self));
+  snprintf(stub, sizeof(stub), "%s/icecast_stub", dir);
+  snprintf(preload, sizeof(preload), "%s/allocount.so", dir);
+  if (positional[0] && *positional[0])
+    snprintf(streamget, sizeof(streamget), "%s", positional[0]);
+  else
+    snprintf(streamget, sizeof(streamget), "%s/../src/streamget", dir);
+
+  streams = positional[1] ? atoi(positional[1]) : DEFAULT_STREAMS;
+  seconds = positional[2] ? atoi(positional[2]) : DEFAULT_SECONDS;
+  kbps = positional[3] ? atoi(positional[3]) : DEFAULT_KBPS;
+  speed = positional[4] ? atof(positional[4]) : DEFAULT_SPEED;
+
+  if (streams <= 0 || seconds <= 0 || kbps <= 0 || speed <= 0 ||
+      argc - options > MAX_OPTIONS)
+  {
+    fprintf(stderr, "usage: %s [STREAMGET [STREAMS [SECONDS [KBPS [SPEED]]]]] [-- OPTIONS]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (!mkdtemp(tmp))
+  {
+    fprintf(stderr, "can't create a directory in /tmp: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  stub_pid = start_stub(stub, kbps, speed, &port);
+  if (stub_pid < 0)
+  {
+    fprintf(stderr, "can't start '%s'\n", stub);
+    rmdir(tmp);
+    return EXIT_FAILURE;
+  }
+
+  snprintf(jobfile, sizeof(jobfile), "%s/jobs", tmp);
+  jobs = fopen(jobfile, "w");
+  if (!jobs)
+  {
+    fprintf(stderr, "can't write '%s': %s\n", jobfile, strerror(errno));
+    goto stop;
+  }
+  for (i = 0; i < streams; ++i)
+    fprintf(jobs, "http://127.0.0.1:%d/stream%d %s/out%d.mp3 %d\n", port, i, tmp, i, seconds);
+  fclose(jobs);
+
+  args[nargs++] = streamget;
+  args[nargs++] = "-j";
+  args[nargs++] = jobfile;
+  for (i = options; i < argc; ++i)
+    args[nargs++] = argv[i];
+  args[nargs] = NULL;
+
+  printf("%d streams of %d kbps (x%g) for %d s, streamget %s", streams, kbps, speed, seconds, streamget);
+  for (i = 3; i < nargs; ++i)
+    printf(" %s", args[i]);
+  printf("\n");
+  fflush(stdout);
+
+  start = now_sec();
+  pid = fork();
+  if (0 == pid)
+  {
+    snprintf(path, sizeof(path), "%s/allocs", tmp);
+    setenv("ALLOCOUNT_FILE", path, 1);
+    setenv("LD_PRELOAD", preload, 1);
+    if (!freopen("/dev/null", "w", stdout))
+      _exit(127);
+    execv(streamget, (char *const *)args);
+    fprintf(stderr, "can't run '%s': %s\n", streamget, strerror(errno));
+    _exit(127);
+  }
+  if (pid < 0 || wait4(pid, &status, 0, &ru) < 0)
+  {
+    fprintf(stderr, "can't run '%s': %s\n", streamget, strerror(errno));
+    goto stop;
+  }
+  elapsed = now_sec() - start;
+  ran = 1;
+
+stop:
+  kill(stub_pid, SIGTERM);
+  wait4(stub_pid, NULL, 0, &stub_ru);
+
+  for (i = 0; i < streams; ++i)
+  {
+    snprintf(path, sizeof(path), "%s/out%d.mp3", tmp, i);
+    if (stat(path, &st) == 0)
+      bytes += st.st_size;
+    unlink(path);
+  }
+
+  snprintf(path, sizeof(path), "%s/allocs", tmp);
+  allocs = report_value(path, "allocs");
+  syscalls = report_value(path, "syscr") + report_value(path, "syscw");
+  unlink(path);
+  unlink(jobfile);
+  rmdir(tmp);
+
+  if (!ran)
+    return EXIT_FAILURE;
+  if (!WIFEXITED(status) || WEXITSTATUS(status))
+    printf("streamget exited with status %d\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+  if (!bytes)
+  {
+    printf("nothing recorded\n");
+    return EXIT_FAILURE;
+  }
+
+  cpu = cpu_sec(&ru);
+  mb = bytes / (1024.0 * 1024.0);
+  printf("recorded   %10.1f MB in %.1f s: %.2f MB/s, %.1f KB/s per stream\n",
+         mb, elapsed, mb / elapsed, bytes / 1024.0 / elapsed / streams);
+  printf("cpu        %10.3f s: %.3f%% of a core per stream (stub %.3f s)\n",
+         cpu, 100.0 * cpu / elapsed / streams, cpu_sec(&stub_ru));
+  printf("syscalls   %10lu: %.1f per MB (read/write only)\n", syscalls, syscalls / mb);
+  printf("peak rss   %10ld KB: %.1f KB per stream\n", ru.ru_maxrss, (double)ru.ru_maxrss / streams);
+  printf("allocs     %10lu: %.1f per MB\n", allocs, allocs / mb);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+/*
+ * C11 atomics, with a fallback for compilers without <stdatomic.h>
+ * (GCC before 4.9).
+ *
+ * The fallback covers what this tree uses: the atomic types are plain
+ * volatile integers, the operations map to the __atomic builtins of
+ * GCC 4.7 and later, or else to the __sync builtins, which are full
+ * barriers and so at least as strong as any order asked for.
+ */
+
+#ifndef _ATOMICS_H_
+#define _ATOMICS_H_
+
+#include "config.h"
+
+#ifdef HAVE_STDATOMIC_H
+
+#include <stdatomic.h>
+
+#else
+
+#include <stddef.h>
+
+typedef volatile int atomic_int;
+typedef volatile unsigned long atomic_ulong;
+typedef volatile long long atomic_llong;
+typedef volatile unsigned long long atomic_ullong;
+typedef volatile size_t atomic_size_t;
+
+#define atomic_init(p, v) ((void)(*(p) = (v)))
+
+#ifdef __ATOMIC_RELAXED
+
+typedef enum
+{
+  memory_order_relaxed = __ATOMIC_RELAXED,
+  memory_order_acquire = __ATOMIC_ACQUIRE,
+  memory_order_release = __ATOMIC_RELEASE,
+  memory_order_seq_cst = __ATOMIC_SEQ_CST
+} memory_order;
+
+#define atomic_load_explicit(p, order) __atomic_load_n(p, order)
+#define atomic_store_explicit(p, v, order) __atomic_store_n(p, v, order)
+#define atomic_fetch_add_explicit(p, v, order) __atomic_fetch_add(p, v, order)
+#define atomic_compare_exchange_strong_explicit(p, expected, v, success, failure) \
+  __atomic_compare_exchange_n(p, expected, v, 0, success, failure)
+#define atomic_compare_exchange_weak_explicit(p, expected, v, success, failure) \
+  __atomic_compare_exchange_n(p, expected, v, 1, success, failure)
+
+#else
+
+typedef enum
+{
+  memory_order_relaxed,
+  memory_order_acquire,
+  memory_order_release,
+  memory_order_seq_cst
+} memory_order;
+
+#define atomic_load_explicit(p, order) __sync_fetch_and_add(p, 0)
+#define atomic_store_explicit(p, v, order) \
+  ((void)(__sync_synchronize(), *(p) = (v), __sync_synchronize()))
+#define atomic_fetch_add_explicit(p, v, order) __sync_fetch_and_add(p, v)
+#define atomic_compare_exchange_strong_explicit(p, expected, v, success, failure) \
+  ({                                                                           \
+    __typeof__(*(expected)) _old = *(expected);                                \
+    *(expected) = __sync_val_compare_and_swap(p, _old, v);                     \
+    *(expected) == _old;                                                       \
+  })
+#define atomic_compare_exchange_weak_explicit atomic_compare_exchange_strong_explicit
+
+#endif
+
+#define atomic_load(p) atomic_load_explicit(p, memory_order_seq_cst)
+#define atomic_store(p, v) atomic_store_explicit(p, v, memory_order_seq_cst)
+#define atomic_fetch_add(p, v) atomic_fetch_add_explicit(p, v, memory_order_seq_cst)
+#define atomic_compare_exchange_strong(p, expected, v) \
+  atomic_compare_exchange_strong_explicit(p, expected, v, memory_order_seq_cst, memory_order_seq_cst)
+
+#endif /* HAVE_STDATOMIC_H */
+
+#endif /* _ATOMICS_H_ */
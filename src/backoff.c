@@ -0,0 +1,178 @@
+/*
+ * Reconnect pacing, see backoff.h.
+ *
+ * The token bucket of a host holds up to burst tokens and gains rate
+ * tokens per second; every (re)connect attempt to the host takes one.
+ * Buckets are found by the host[:port] part of the url and live until
+ * bucket_free().
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "backoff.h"
+
+struct bucket
+{
+  char *host;         /* host[:port] of the urls sharing it */
+  double tokens;      /* attempts that may start right away */
+  long long stamp;    /* (msec) tokens were last topped up */
+  struct bucket *next;
+};
+
+static Bucket *g_buckets = NULL;
+static double g_rate = 0; /* tokens per second, 0 is no bucket */
+static int g_burst = 1;
+
+/*
+ * The policy called name: "fixed", "exp" or "jitter".
+ * Returns -1 for an unknown name.
+ */
+int backoff_policy(const char *name)
+{
+  if (0 == strcmp(name, "fixed"))
+    return BACKOFF_FIXED;
+  if (0 == strcmp(name, "exp"))
+    return BACKOFF_EXP;
+  if (0 == strcmp(name, "jitter"))
+    return BACKOFF_JITTER;
+  return -1;
+}
+
+void backoff_init(Backoff *b, int policy, int base, int cap, unsigned seed)
+{
+  b->policy = policy;
+  b->base = base;
+  b->cap = cap > base ? cap : base;
+  b->delay = 0;
+  b->attempts = 0;
+  b->seed = seed;
+}
+
+/*
+ * The delay (msec) before the next attempt.
+ */
+int backoff_next(Backoff *b)
+{
+  long long delay = b->base;
+  long long high;
+
+  switch (b->policy)
+  {
+  case BACKOFF_EXP:
+    if (b->attempts < 31)
+      delay = (long long)b->base << b->attempts;
+    else
+      delay = b->cap;
+    break;
+
+  case BACKOFF_JITTER:
+    high = b->delay ? b->delay * 3LL : b->base;
+    if (high > b->cap)
+      high = b->cap;
+    delay = b->base + rand_r(&b->seed) % (high - b->base + 1);
+    break;
+  }
+
+  if (delay > b->cap)
+    delay = b->cap;
+  b->delay = delay;
+  b->attempts++;
+  return b->delay;
+}
+
+/* the stream is back, start over with the base delay */
+void backoff_reset(Backoff *b)
+{
+  b->delay = 0;
+  b->attempts = 0;
+}
+
+/*
+ * Give every host rate attempts per second, burst at once; a rate of 0
+ * (the default) lets attempts start without waiting.
+ */
+void bucket_setrate(double rate, int burst)
+{
+  g_rate = rate;
+  g_burst = burst > 0 ? burst : 1;
+}
+
+/*
+ * The bucket of the host of url, shared with all other urls of that
+ * host. Returns NULL without a rate, or when out of memory.
+ */
+Bucket *bucket_get(const char *url)
+{
+  const char *host = strstr(url, "://");
+  size_t len;
+  Bucket *b;
+
+  if (!g_rate)
+    return NULL;
+
+  /* scheme://[user[:password]@]host[:port][/path] */
+  host = host ? host + 3 : url;
+  len = strcspn(host, "/?#");
+  if (memchr(host, '@', len))
+  {
+    const char *at = memchr(host, '@', len);
+
+    len -= at + 1 - host;
+    host = at + 1;
+  }
+
+  for (b = g_buckets; b; b = b->next)
+  {
+    if (strlen(b->host) == len && 0 == strncmp(b->host, host, len))
+      return b;
+  }
+
+  b = calloc(1, sizeof(Bucket));
+  if (!b || !(b->host = strndup(host, len)))
+  {
+    free(b);
+    return NULL;
+  }
+  b->tokens = g_burst;
+  b->next = g_buckets;
+  g_buckets = b;
+  return b;
+}
+
+/*
+ * Take a token for an attempt at now (msec).
+ * Returns 0 if taken, else the msecs until one is available.
+ */
+long bucket_take(Bucket *b, long long now)
+{
+  if (!b)
+    return 0;
+
+  if (b->stamp)
+  {
+    b->tokens += (now - b->stamp) * g_rate / 1000;
+    if (b->tokens > g_burst)
+      b->tokens = g_burst;
+  }
+  b->stamp = now;
+
+  if (b->tokens >= 1)
+  {
+    b->tokens -= 1;
+    return 0;
+  }
+  return (long)((1 - b->tokens) * 1000 / g_rate) + 1;
+}
+
+void bucket_free(void)
+{
+  Bucket *b;
+
+  while ((b = g_buckets))
+  {
+    g_buckets = b->next;
+    free(b->host);
+    free(b);
+  }
+}
@@ -0,0 +1,45 @@
+/*
+ * Include file for backoff.c
+ *
+ * Reconnect pacing: the delay before each reconnect attempt of a stream
+ * (a backoff policy) and a token bucket per host that all streams from
+ * that host share, so after an upstream restart they don't all knock
+ * at once.
+ */
+
+#ifndef _BACKOFF_H_
+#define _BACKOFF_H_
+
+/* backoff policies */
+#define BACKOFF_FIXED (0)  /* always the base delay */
+#define BACKOFF_EXP (1)    /* base doubling per attempt, up to the cap */
+#define BACKOFF_JITTER (2) /* decorrelated jitter: random in [base, 3 * previous], up to the cap */
+
+/* (msec) cap of the growing policies unless given */
+#define BACKOFF_DEFAULT_CAP (30000)
+
+typedef struct
+{
+  int policy;        /* one of the above */
+  int base;          /* (msec) first delay */
+  int cap;           /* (msec) longest delay */
+  int delay;         /* (msec) the last one */
+  unsigned attempts; /* since the last reset */
+  unsigned seed;     /* for the jitter */
+} Backoff;
+
+/* forward declaration */
+typedef struct bucket Bucket;
+
+/* API prototypes */
+int backoff_policy(const char *name);
+void backoff_init(Backoff *b, int policy, int base, int cap, unsigned seed);
+int backoff_next(Backoff *b);
+void backoff_reset(Backoff *b);
+
+void bucket_setrate(double rate, int burst);
+Bucket *bucket_get(const char *url);
+long bucket_take(Bucket *b, long long now);
+void bucket_free(void);
+
+#endif /* _BACKOFF_H_ */
@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mp3frame.h"
+#include "dedup.h"
+
+/*
+ * Allocate a history of at least seconds worth of frame hashes.
+ * Returns 0 on success, -1 (with errno set) on failure.
+ */
+int dedup_init(Dedup *dedup, int seconds)
+{
+  memset(dedup, 0, sizeof(*dedup));
+
+  if (seconds <= 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  dedup->size = (size_t)seconds * DEDUP_MAX_FPS;
+  dedup->hashes = malloc(dedup->size * sizeof(*dedup->hashes));
+  dedup->candidates = malloc(dedup->size * sizeof(*dedup->candidates));
+  if (!dedup->hashes || !dedup->candidates)
+  {
+    dedup_free(dedup);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  return 0;
+}
+
+void dedup_free(Dedup *dedup)
+{
+  free(dedup->hashes);
+  free(dedup->candidates);
+  dedup->hashes = NULL;
+  dedup->candidates = NULL;
+  dedup->size = 0;
+}
+
+/*
+ * The stream was reconnected, the next frames may repeat the tail of
+ * what was written.
+ */
+void dedup_reconnect(Dedup *dedup)
+{
+  dedup->matching = dedup->nframes != 0;
+}
+
+/* 64 bit FNV-1a of the frame at offset */
+static unsigned long long frame_hash(const struct iovec *in, int incnt, size_t offset, size_t len)
+{
+  unsigned long long hash = 0xcbf29ce484222325ULL;
+  int i;
+
+  for (i = 0; i < incnt && len; ++i)
+  {
+    const unsigned char *p = in[i].iov_base;
+    size_t n;
+
+    if (offset >= in[i].iov_len)
+    {
+      offset -= in[i].iov_len;
+      continue;
+    }
+    p += offset;
+    n = in[i].iov_len - offset;
+    if (n > len)
+      n = len;
+    len -= n;
+    offset = 0;
+
+    while (n--)
+    {
+      hash ^= *p++;
+      hash *= 0x100000001b3ULL;
+    }
+  }
+
+  return hash;
+}
+
+static size_t iov_total(const struct iovec *in, int incnt)
+{
+  size_t total = 0;
+
+  while (incnt-- > 0)
+    total += (in++)->iov_len;
+  return total;
+}
+
+/*
+ * Match a run of whole frames (from mp3sync_scan()) against the frames
+ * written before the reconnect. The first frame is looked up in the
+ * whole history, after that each frame only has to continue one of the
+ * positions it was found at. Only a run that reaches the last frame
+ * written is a replay: one that matches older audio and then breaks off
+ * (silence, a repeated jingle) is new audio.
+ * The duplicates are not recorded; the caller drops them.
+ * Returns the number of leading bytes that are duplicates, and sets
+ * *frames to the number of frames in them. Returns 0 with matching
+ * ended when the frames are new, and 0 with matching still on when all
+ * of them continue the history without reaching its end yet: the caller
+ * keeps them and calls again with what arrives after them, or gives up
+ * with dedup_giveup() when no more can come.
+ */
+size_t dedup_match(Dedup *dedup, const struct iovec *in, int incnt, unsigned long *frames)
+{
+  unsigned long long oldest, hash, n;
+  size_t total = iov_total(in, incnt);
+  size_t offset = 0;
+  size_t i, j;
+  Mp3Header header;
+
+  *frames = 0;
+  if (!dedup->matching)
+    return 0;
+
+  oldest = dedup->nframes > dedup->size ? dedup->nframes - dedup->size : 0;
+  dedup->ncandidates = 0;
+
+  while (offset < total)
+  {
+    if (!mp3_frame_at(in, incnt, offset, &header) || offset + header.length > total)
+      break;
+    hash = frame_hash(in, incnt, offset, header.length);
+
+    if (0 == offset)
+    {
+      /* every position of the frame in the history is a candidate */
+      for (n = oldest; n < dedup->nframes; ++n)
+      {
+        if (dedup->hashes[n % dedup->size] == hash)
+          dedup->candidates[dedup->ncandidates++] = n;
+      }
+    }
+    else
+    {
+      /* keep the candidates this frame continues */
+      for (i = j = 0; i < dedup->ncandidates; ++i)
+      {
+        n = dedup->candidates[i] + 1;
+        if (n < dedup->nframes && dedup->hashes[n % dedup->size] == hash)
+          dedup->candidates[j++] = n;
+      }
+      dedup->ncandidates = j;
+    }
+    if (!dedup->ncandidates)
+      break;
+
+    offset += header.length;
+    (*frames)++;
+
+    /* caught up with the last frame written, the rest is new */
+    for (i = 0; i < dedup->ncandidates; ++i)
+    {
+      if (dedup->candidates[i] + 1 == dedup->nframes)
+      {
+        dedup->matching = 0;
+        dedup->overlaps++;
+        dedup->frames += *frames;
+        dedup->bytes += offset;
+        return offset;
+      }
+    }
+  }
+
+  /* all frames continue the history, its end may still come */
+  *frames = 0;
+  if (offset == total)
+    return 0;
+
+  dedup->matching = 0;
+  return 0;
+}
+
+/* no more frames can come to complete a match, they are new audio */
+void dedup_giveup(Dedup *dedup)
+{
+  dedup->matching = 0;
+}
+
+/*
+ * Add the hashes of a run of whole frames that was written to the
+ * history, dropping the oldest.
+ */
+void dedup_record(Dedup *dedup, const struct iovec *in, int incnt)
+{
+  size_t total = iov_total(in, incnt);
+  size_t offset = 0;
+  Mp3Header header;
+
+  while (offset < total && mp3_frame_at(in, incnt, offset, &header))
+  {
+    if (offset + header.length > total)
+      break;
+    dedup->hashes[dedup->nframes++ % dedup->size] =
+        frame_hash(in, incnt, offset, header.length);
+    offset += header.length;
+  }
+}
@@ -0,0 +1,46 @@
+/*
+ * Include file for dedup.c
+ *
+ * Removes the audio an Icecast server replays after a reconnect
+ * (burst-on-connect) when it was already written before the drop.
+ */
+
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+/* upper bound of MPEG audio frames per second (layer I at 48 kHz) */
+#define DEDUP_MAX_FPS (125)
+
+typedef struct
+{
+  /* hashes of the last frames written, a ring indexed by frame number */
+  unsigned long long *hashes;
+  size_t size;
+  unsigned long long nframes; /* frames recorded since the start */
+
+  /* boolean looking for the overlap after a reconnect */
+  int matching;
+
+  /* frame numbers in the history the new frames may continue from,
+     used by dedup_match() */
+  unsigned long long *candidates;
+  size_t ncandidates;
+
+  /* overlaps found and what was dropped because of them */
+  unsigned long overlaps;
+  unsigned long frames;
+  unsigned long long bytes;
+} Dedup;
+
+/* API prototypes */
+int dedup_init(Dedup *dedup, int seconds);
+void dedup_free(Dedup *dedup);
+void dedup_reconnect(Dedup *dedup);
+size_t dedup_match(Dedup *dedup, const struct iovec *in, int incnt, unsigned long *frames);
+void dedup_giveup(Dedup *dedup);
+void dedup_record(Dedup *dedup, const struct iovec *in, int incnt);
+
+#endif /* _DEDUP_H_ */
@@ -0,0 +1,342 @@
+/*
+ * Asynchronous log, see logger.h.
+ *
+ * The ring is a bounded multi-producer queue: a producer claims a slot
+ * by advancing the tail with a compare-and-swap and publishes it through
+ * the sequence number of the slot, the flusher is the only consumer.
+ * Records carry the second they were logged in; the flusher turns that
+ * into a timestamp once per second and writes the lines it collected
+ * with one write() per flush.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "atomics.h"
+#include "logger.h"
+
+/* room for a record as JSON, every byte escaped */
+#define LINE_SIZE (LOGGER_LINE_MAX * 6 + 128)
+
+/* (bytes) written out by the flusher at once */
+#define FLUSH_SIZE (64 * 1024)
+
+typedef struct
+{
+  atomic_size_t seq; /* the position this slot is free (== pos) or full (== pos + 1) for */
+  time_t time;       /* second it was logged */
+  int fd;            /* to write it to */
+  int level;         /* LOGGER_INFO, _WARN or _ERROR */
+  int len;           /* length of text */
+  char text[LOGGER_LINE_MAX];
+} Record;
+
+static Record *g_ring = NULL;
+static atomic_size_t g_tail; /* next position to claim */
+static size_t g_head;        /* next position to flush, flusher only */
+static atomic_int g_running;
+static atomic_ulong g_dropped; /* records lost to a full ring */
+static unsigned long g_reported;
+static int g_format = LOGGER_TEXT;
+
+static pthread_t g_flusher;
+static int g_stop = 0;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_wake = PTHREAD_COND_INITIALIZER;
+
+/* timestamp of the last second formatted, used by one thread at a time */
+static time_t g_stamp_time = -1;
+static char g_stamp[40];
+
+static const char *const g_levels[] = {"info", "warn", "error"};
+
+static char g_out[FLUSH_SIZE];
+static size_t g_outlen = 0;
+static int g_outfd = -1;
+
+/* the timestamp of second t, formatted again only when t changed */
+static const char *stamp(time_t t)
+{
+  struct tm tm;
+
+  if (t != g_stamp_time)
+  {
+    localtime_r(&t, &tm);
+    if (LOGGER_JSON == g_format)
+      strftime(g_stamp, sizeof(g_stamp), "%Y-%m-%dT%H:%M:%S%z", &tm);
+    else
+      strftime(g_stamp, sizeof(g_stamp), "%b %d %H:%M:%S ", &tm);
+    g_stamp_time = t;
+  }
+  return g_stamp;
+}
+
+/* a log line of message text (len bytes) logged at t, returns its length */
+static size_t format_line(char *line, time_t t, int level, const char *text, int len)
+{
+  static const char hex[] = "0123456789abcdef";
+  size_t n;
+  int i;
+
+  if (LOGGER_JSON != g_format)
+  {
+    n = snprintf(line, LINE_SIZE, "%s ", stamp(t));
+    memcpy(line + n, text, len);
+    return n + len;
+  }
+
+  /* one line per record, the message without its final newline */
+  if (len > 0 && '\n' == text[len - 1])
+    len--;
+  n = snprintf(line, LINE_SIZE, "{\"time\":\"%s\",\"level\":\"%s\",\"msg\":\"", stamp(t), g_levels[level]);
+  for (i = 0; i < len; ++i)
+  {
+    unsigned char c = text[i];
+
+    if ('"' == c || '\\' == c)
+    {
+      line[n++] = '\\';
+      line[n++] = c;
+    }
+    else if ('\n' == c)
+    {
+      line[n++] = '\\';
+      line[n++] = 'n';
+    }
+    else if ('\t' == c)
+    {
+      line[n++] = '\\';
+      line[n++] = 't';
+    }
+    else if (c < 0x20)
+    {
+      memcpy(line + n, "\\u00", 4);
+      line[n + 4] = hex[c >> 4];
+      line[n + 5] = hex[c & 15];
+      n += 6;
+    }
+    else
+      line[n++] = c;
+  }
+  memcpy(line + n, "\"}\n", 3);
+  return n + 3;
+}
+
+static void write_all(int fd, const char *data, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0)
+  {
+    n = write(fd, data, len);
+    if (n < 0 && EINTR == errno)
+      continue;
+    if (n <= 0)
+      return; /* nowhere to report it */
+    data += n;
+    len -= n;
+  }
+}
+
+static void flush_out(void)
+{
+  if (g_outlen)
+    write_all(g_outfd, g_out, g_outlen);
+  g_outlen = 0;
+}
+
+/* queue a formatted line for fd */
+static void put_line(int fd, time_t t, int level, const char *text, int len)
+{
+  static char line[LINE_SIZE];
+  size_t n = format_line(line, t, level, text, len);
+
+  if (fd != g_outfd || g_outlen + n > sizeof(g_out))
+    flush_out();
+  g_outfd = fd;
+  memcpy(g_out + g_outlen, line, n);
+  g_outlen += n;
+}
+
+/* write out all records published so far */
+static void drain(void)
+{
+  unsigned long dropped;
+  char text[64];
+  Record *r;
+
+  for (;;)
+  {
+    r = &g_ring[g_head & (LOGGER_SLOTS - 1)];
+    if (atomic_load_explicit(&r->seq, memory_order_acquire) != g_head + 1)
+      break;
+    put_line(r->fd, r->time, r->level, r->text, r->len);
+    atomic_store_explicit(&r->seq, g_head + LOGGER_SLOTS, memory_order_release);
+    g_head++;
+  }
+
+  dropped = atomic_load_explicit(&g_dropped, memory_order_relaxed);
+  if (dropped != g_reported && g_outfd >= 0)
+  {
+    put_line(g_outfd, time(0), LOGGER_WARN, text,
+             snprintf(text, sizeof(text), "Log full, %lu records dropped.\n", dropped - g_reported));
+    g_reported = dropped;
+  }
+
+  flush_out();
+}
+
+static void *logger_flusher(void *arg)
+{
+  struct timespec until;
+
+  pthread_mutex_lock(&g_lock);
+  while (!g_stop)
+  {
+    pthread_mutex_unlock(&g_lock);
+    drain();
+    pthread_mutex_lock(&g_lock);
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += LOGGER_INTERVAL * 1000000L;
+    until.tv_sec += until.tv_nsec / 1000000000L;
+    until.tv_nsec %= 1000000000L;
+    if (!g_stop)
+      (void)pthread_cond_timedwait(&g_wake, &g_lock, &until);
+  }
+  pthread_mutex_unlock(&g_lock);
+
+  drain();
+  return arg;
+}
+
+/* LOGGER_TEXT or LOGGER_JSON, set before logging */
+void logger_setformat(int format)
+{
+  g_format = format;
+}
+
+/*
+ * Start the flusher thread; from now on logging doesn't wait for the
+ * log to be written. Call after daemonize(), threads don't survive a
+ * fork().
+ * Returns 0 on success, -1 (with errno set) on error.
+ */
+int logger_start(void)
+{
+  size_t i;
+
+  g_ring = calloc(LOGGER_SLOTS, sizeof(Record));
+  if (!g_ring)
+    return -1;
+  for (i = 0; i < LOGGER_SLOTS; ++i)
+    atomic_init(&g_ring[i].seq, i);
+  atomic_init(&g_tail, 0);
+  g_head = 0;
+  g_stop = 0;
+
+  /* what was logged directly goes out first */
+  fflush(stdout);
+  fflush(stderr);
+
+  errno = pthread_create(&g_flusher, NULL, logger_flusher, NULL);
+  if (errno)
+  {
+    free(g_ring);
+    g_ring = NULL;
+    return -1;
+  }
+
+  atomic_store(&g_running, 1);
+  return 0;
+}
+
+/*
+ * Write out what is left and stop the flusher thread.
+ */
+void logger_stop(void)
+{
+  if (!atomic_load(&g_running))
+    return;
+  atomic_store(&g_running, 0);
+
+  pthread_mutex_lock(&g_lock);
+  g_stop = 1;
+  pthread_cond_signal(&g_wake);
+  pthread_mutex_unlock(&g_lock);
+  pthread_join(g_flusher, NULL);
+
+  free(g_ring);
+  g_ring = NULL;
+}
+
+/*
+ * Log a message at level to stream (its file descriptor, once started).
+ */
+void logger_printf(FILE *stream, int level, const char *format, ...)
+{
+  static char line[LINE_SIZE];
+  char text[LOGGER_LINE_MAX];
+  size_t pos, seq;
+  va_list ap;
+  Record *r;
+  int len;
+
+  if (!atomic_load_explicit(&g_running, memory_order_acquire))
+  {
+    /* not started, write it right away */
+    va_start(ap, format);
+    len = vsnprintf(text, sizeof(text), format, ap);
+    va_end(ap);
+    if (len < 0)
+      return;
+    if (len >= (int)sizeof(text))
+      len = sizeof(text) - 1;
+    fwrite(line, 1, format_line(line, time(0), level, text, len), stream);
+    return;
+  }
+
+  /* claim a slot */
+  pos = atomic_load_explicit(&g_tail, memory_order_relaxed);
+  for (;;)
+  {
+    r = &g_ring[pos & (LOGGER_SLOTS - 1)];
+    seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+    if (seq == pos)
+    {
+      if (atomic_compare_exchange_weak_explicit(&g_tail, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else if ((ptrdiff_t)(seq - pos) < 0)
+    {
+      /* full, the flusher is behind */
+      atomic_fetch_add_explicit(&g_dropped, 1, memory_order_relaxed);
+      return;
+    }
+    else
+      pos = atomic_load_explicit(&g_tail, memory_order_relaxed);
+  }
+
+  va_start(ap, format);
+  len = vsnprintf(r->text, sizeof(r->text), format, ap);
+  va_end(ap);
+  if (len < 0)
+    len = 0;
+  if (len >= (int)sizeof(r->text))
+    len = sizeof(r->text) - 1;
+  r->len = len;
+  r->time = time(0);
+  r->fd = fileno(stream);
+  r->level = level;
+
+  /* publish it */
+  atomic_store_explicit(&r->seq, pos + 1, memory_order_release);
+}
@@ -0,0 +1,40 @@
+/*
+ * Include file for logger.c
+ *
+ * Asynchronous log: a record is formatted into a slot of a lock-free
+ * ring by the thread that logs it and written out by a flusher thread,
+ * so a slow log file never blocks the recording loop. When the ring is
+ * full records are dropped and counted, not waited for. Before
+ * logger_start() (and after logger_stop()) records are written
+ * directly.
+ */
+
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include <stdio.h>
+
+/* formats of the log lines */
+#define LOGGER_TEXT (0) /* "Oct 16 12:00:00  message" */
+#define LOGGER_JSON (1) /* {"time":"2026-10-16T12:00:00+0200","level":"info","msg":"message"} */
+
+/* levels of the records, the "level" of a JSON line */
+#define LOGGER_INFO (0)  /* "info" */
+#define LOGGER_WARN (1)  /* "warn": a stream was lost, or something fell back or behind */
+#define LOGGER_ERROR (2) /* "error": a recording (or part of it) failed */
+
+/* number of records the ring holds and longest record (the rest is cut) */
+#define LOGGER_SLOTS (256)
+#define LOGGER_LINE_MAX (512)
+
+/* (msec) between two flushes of the ring */
+#define LOGGER_INTERVAL (100)
+
+/* API prototypes */
+void logger_setformat(int format);
+int logger_start(void);
+void logger_stop(void);
+void logger_printf(FILE *stream, int level, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#endif /* _LOGGER_H_ */
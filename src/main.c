@@ -6,7 +6,8 @@
  * to reconnect. The transfer stops after a specified time.
  * This program is used to record streaming mp3 casts from an icecast server.
  * The program is usually started from cron at a specific time and continues
- * to record the stream for the specified time.
+ * to record the stream for the specified time, or runs resident and starts
+ * the recordings of a schedule itself (--schedule).
  *
  * Copyright (c) 2006 AUDIOserver.nl
  * Author: K.J. Wierenga <k.j.wierenga@audioserver.nl>
@@ -32,84 +33,129 @@
 #include <string.h>
 #include <ctype.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <getopt.h>
 #include <signal.h>
 #include <unistd.h>
 #include <time.h>
+#include <limits.h>
 
 #include <url_fopen.h>
 #include <daemonize.h>
+#include "output.h"
+#include "mp3frame.h"
+#include "dedup.h"
+#include "seekindex.h"
+#include "segment.h"
+#include "metrics.h"
+#include "logger.h"
+#include "timer.h"
+#include "backoff.h"
+#include "mirror.h"
+#include "schedule.h"
 #include "git-ref.h"
 #include "config.h"
 #include "lock.h"
 
-#define MAXTIMESTR 32
-
-#define GETTIMESTR            \
-  time_t _now_ = time(0);     \
-  char _timestr_[MAXTIMESTR]; \
-  (void)strftime(_timestr_, MAXTIMESTR, "%b %d %H:%M:%S ", localtime(&_now_));
-
-/* VERBOSE macro */
-#define LOGINFO0(stream, format)                \
-  do                                            \
-  {                                             \
-    GETTIMESTR                                  \
-    if (g_options.verbose > 0)                  \
-    {                                           \
-      fprintf(stream, "%s " format, _timestr_); \
-    }                                           \
+/*
+ * VERBOSE macros: nothing is formatted unless verbose, and the record
+ * then goes through the log ring (see logger.h) with its timestamp and
+ * level. LOGINFO for progress, LOGWARN for a lost stream or a fallback,
+ * LOGERROR for a recording (or part of it) that failed.
+ */
+#define LOGAT0(stream, level, format)       \
+  do                                        \
+  {                                         \
+    if (g_options.verbose > 0)              \
+    {                                       \
+      logger_printf(stream, level, format); \
+    }                                       \
+  } while (0)
+
+#define LOGAT1(stream, level, format, arg1)         \
+  do                                                \
+  {                                                 \
+    if (g_options.verbose > 0)                      \
+    {                                               \
+      logger_printf(stream, level, format, (arg1)); \
+    }                                               \
   } while (0)
 
-#define LOGINFO1(stream, format, arg1)                  \
-  do                                                    \
-  {                                                     \
-    GETTIMESTR                                          \
-    if (g_options.verbose > 0)                          \
-    {                                                   \
-      fprintf(stream, "%s " format, _timestr_, (arg1)); \
-    }                                                   \
+#define LOGAT2(stream, level, format, arg1, arg2)           \
+  do                                                        \
+  {                                                         \
+    if (g_options.verbose > 0)                              \
+    {                                                       \
+      logger_printf(stream, level, format, (arg1), (arg2)); \
+    }                                                       \
   } while (0)
 
-#define LOGINFO2(stream, format, arg1, arg2)                    \
-  GETTIMESTR                                                    \
-  do                                                            \
-  {                                                             \
-    if (g_options.verbose > 0)                                  \
-    {                                                           \
-      fprintf(stream, "%s " format, _timestr_, (arg1), (arg2)); \
-    }                                                           \
+#define LOGAT3(stream, level, format, arg1, arg2, arg3)             \
+  do                                                                \
+  {                                                                 \
+    if (g_options.verbose > 0)                                      \
+    {                                                               \
+      logger_printf(stream, level, format, (arg1), (arg2), (arg3)); \
+    }                                                               \
   } while (0)
 
-#define LOGINFO3(stream, format, arg1, arg2, arg3)                      \
-  GETTIMESTR                                                            \
-  do                                                                    \
-  {                                                                     \
-    if (g_options.verbose > 0)                                          \
-    {                                                                   \
-      fprintf(stream, "%s " format, _timestr_, (arg1), (arg2), (arg3)); \
-    }                                                                   \
+#define LOGAT4(stream, level, format, arg1, arg2, arg3, arg4)               \
+  do                                                                        \
+  {                                                                         \
+    if (g_options.verbose > 0)                                              \
+    {                                                                       \
+      logger_printf(stream, level, format, (arg1), (arg2), (arg3), (arg4)); \
+    }                                                                       \
   } while (0)
 
-#define LOGINFO4(stream, format, arg1, arg2, arg3, arg4)                        \
-  do                                                                            \
-  {                                                                             \
-    GETTIMESTR                                                                  \
-    if (g_options.verbose > 0)                                                  \
-    {                                                                           \
-      fprintf(stream, "%s " format, _timestr_, (arg1), (arg2), (arg3), (arg4)); \
-    }                                                                           \
+#define LOGAT5(stream, level, format, arg1, arg2, arg3, arg4, arg5)                 \
+  do                                                                                \
+  {                                                                                 \
+    if (g_options.verbose > 0)                                                      \
+    {                                                                               \
+      logger_printf(stream, level, format, (arg1), (arg2), (arg3), (arg4), (arg5)); \
+    }                                                                               \
   } while (0)
 
+#define LOGINFO0(stream, format) LOGAT0(stream, LOGGER_INFO, format)
+#define LOGINFO1(stream, format, arg1) LOGAT1(stream, LOGGER_INFO, format, arg1)
+#define LOGINFO2(stream, format, arg1, arg2) LOGAT2(stream, LOGGER_INFO, format, arg1, arg2)
+#define LOGINFO3(stream, format, arg1, arg2, arg3) LOGAT3(stream, LOGGER_INFO, format, arg1, arg2, arg3)
+#define LOGINFO4(stream, format, arg1, arg2, arg3, arg4) LOGAT4(stream, LOGGER_INFO, format, arg1, arg2, arg3, arg4)
+#define LOGINFO5(stream, format, arg1, arg2, arg3, arg4, arg5) LOGAT5(stream, LOGGER_INFO, format, arg1, arg2, arg3, arg4, arg5)
+
+#define LOGWARN0(stream, format) LOGAT0(stream, LOGGER_WARN, format)
+#define LOGWARN1(stream, format, arg1) LOGAT1(stream, LOGGER_WARN, format, arg1)
+#define LOGWARN2(stream, format, arg1, arg2) LOGAT2(stream, LOGGER_WARN, format, arg1, arg2)
+#define LOGWARN3(stream, format, arg1, arg2, arg3) LOGAT3(stream, LOGGER_WARN, format, arg1, arg2, arg3)
+#define LOGWARN4(stream, format, arg1, arg2, arg3, arg4) LOGAT4(stream, LOGGER_WARN, format, arg1, arg2, arg3, arg4)
+#define LOGWARN5(stream, format, arg1, arg2, arg3, arg4, arg5) LOGAT5(stream, LOGGER_WARN, format, arg1, arg2, arg3, arg4, arg5)
+
+#define LOGERROR0(stream, format) LOGAT0(stream, LOGGER_ERROR, format)
+#define LOGERROR1(stream, format, arg1) LOGAT1(stream, LOGGER_ERROR, format, arg1)
+#define LOGERROR2(stream, format, arg1, arg2) LOGAT2(stream, LOGGER_ERROR, format, arg1, arg2)
+#define LOGERROR3(stream, format, arg1, arg2, arg3) LOGAT3(stream, LOGGER_ERROR, format, arg1, arg2, arg3)
+#define LOGERROR4(stream, format, arg1, arg2, arg3, arg4) LOGAT4(stream, LOGGER_ERROR, format, arg1, arg2, arg3, arg4)
+#define LOGERROR5(stream, format, arg1, arg2, arg3, arg4, arg5) LOGAT5(stream, LOGGER_ERROR, format, arg1, arg2, arg3, arg4, arg5)
+
 /* local definitions */
-#define BUFFERSIZE (64 * 1024)        /* read/write in these chunks */
+#define BUFFERSIZE (64 * 1024)        /* write at most this much per call */
 #define DEFAULT_TIME_LIMIT (4 * 3600) /* (sec) four hours */
-#define DEFAULT_CONNECT_TIMEOUT (20)  /* (sec) twenty seconds */
-#define DEFAULT_CONNECT_PERIOD (-1)   /* (sec) -1 means inifinite */
-#define DEFAULT_RECONNECT_TIMEOUT (1) /* (sec) 1 second */
-#define DEFAULT_RECONNECT_PERIOD (-1) /* (sec) -1 means infinite */
+#define DEFAULT_CONNECT_TIMEOUT (20000) /* (msec) twenty seconds */
+#define DEFAULT_CONNECT_PERIOD (-1)      /* (msec) -1 means inifinite */
+#define DEFAULT_RECONNECT_TIMEOUT (1000) /* (msec) 1 second */
+#define DEFAULT_RECONNECT_PERIOD (-1)    /* (msec) -1 means infinite */
+#define DEFAULT_REDIRECT_FAILURES (2)    /* failed attempts on a redirect target before the url again */
+#define DEFAULT_REDIRECT_TTL (300000)    /* (msec) five minutes */
+#define DEFAULT_STAGGER (250)            /* (msec) between the connects of a race of mirrors */
+#define DEFAULT_MERGE_DEDUP (10)         /* (sec) history of frames written with --merge */
+#define MERGE_STALL (2000)               /* (msec) without data before the other source takes over */
+#define DEFAULT_PREWARM (5000)           /* (msec) a scheduled recording connects ahead of its start */
+#define SCHEDULE_SLOTS (32)              /* scheduled recordings running at once */
+#define LOOP_TIMEOUT (1000)           /* (msec) max time between job checks */
+#define RETRY_TIMEOUT (10)            /* (msec) retry when the pipeline was full */
 
 /* local typedefs */
 typedef struct
@@ -135,23 +181,20 @@ typedef struct
    */
   int time_from_connect;
 
-  /* (sec) Time between initial connects if stream not yet available. */
+  /* (msec) Time between initial connects if stream not yet available. */
   int connect_timeout;
 
-  /* (sec) How long to try initial succesful initial connect */
+  /* (msec) How long to try initial succesful initial connect */
   int connect_period;
 
-  /* countdown */
-  int connect_countdown;
-
-  /* (sec) Time between reconnects if stream drops. */
+  /* (msec) Time between reconnects if stream drops. */
   int reconnect_timeout;
 
-  /* (sec) How long to try reconnecting after dropped connection. */
+  /* (msec) How long to try reconnecting after dropped connection. */
   int reconnect_period;
 
-  /* reconnect countdown */
-  int reconnect_countdown;
+  /* (bytes) capacity of the receive buffer of the stream */
+  int buffer_size;
 
   /* show prgress yes/no */
   int progress;
@@ -162,21 +205,321 @@ typedef struct
   /* daemonize */
   int daemonize;
 
+  /* name of the job file, records multiple streams when set */
+  char *jobs;
+
+  /* (bytes) queue to the writer thread, 0 writes from the receive loop */
+  int pipeline;
+
+  /* number of io_uring write buffers, 0 uses write() */
+  int io_uring;
+
+  /* boolean write whole MP3 frames only */
+  int frame_sync;
+
+  /* (msec) open a standby connection when no data arrived for this long, 0 is off */
+  int hedge;
+
+  /* (bytes/sec) also open one when the stream is slower than this, 0 is off */
+  int hedge_rate;
+
+  /* (sec) history of frames checked for a replay after a reconnect, 0 is off */
+  int dedup;
+
+  /* boolean request ICY metadata, titles go to OUTPUT.meta */
+  int icy;
+
+  /* (frames) between the records of the seek index OUTPUT.idx, 0 is off */
+  int index;
+
+  /* (sec) length of the output segments, 0 writes one output file */
+  int segment;
+
+  /* (KiB) write back and drop from the page cache in windows, 0 is off */
+  int writeback;
+
+  /* (msec) most audio written but not synced to disk, 0 leaves it to the kernel */
+  int sync;
+
+  /* TCP port or unix socket path of the metrics endpoint, NULL is off */
+  char *metrics;
+
+  /* LOGGER_TEXT or LOGGER_JSON lines */
+  int log_format;
+
+  /* BACKOFF_FIXED, _EXP or _JITTER delays between reconnect attempts and (msec) their cap */
+  int backoff;
+  int backoff_cap;
+
+  /* (attempts/sec) and burst of (re)connect attempts per host, 0 is no limit */
+  double host_rate;
+  int host_burst;
+
+  /* failed attempts and (msec) age after which a cached redirect target is
+     dropped for the url, 0 failures doesn't cache */
+  int redirect_failures;
+  int redirect_ttl;
+
+  /* other urls of the stream given with --mirror, and (msec) between the
+     connects of a race of them */
+  char **mirrors;
+  int nmirrors;
+  int stagger;
+
+  /* second source recorded from at the same time, NULL is none */
+  char *merge;
+
+  /* schedule file of the resident mode, NULL records once; and (msec) the
+     stream of a scheduled recording is connected ahead of its start */
+  char *schedule;
+  int prewarm;
+
 } StreamgetOptions;
 
+/* defined valid states */
+enum
+{
+  IDLE,
+  CONNECTING,
+  CONNECTED,
+  RECONNECTING,
+  RECONNECTED,
+  DONE
+};
+
+/* names of the states above, as the metrics endpoint shows them */
+static const char *const sg_state_names[] = {
+    "idle", "connecting", "connected", "reconnecting", "reconnected", "done"};
+
+/* the timers of a job */
+enum
+{
+  JOB_LIMIT,   /* time-limit */
+  JOB_ATTEMPT, /* next (re)connect attempt */
+  JOB_PERIOD,  /* (re)connect period */
+  JOB_SECOND,  /* next connect attempt of the second source */
+  JOB_START    /* start of a scheduled recording */
+};
+
+/* a recording: one stream appended to one output file */
+typedef struct
+{
+  /* URL from which to read stream */
+  char *url;
+
+  /* name of the output file */
+  char *output;
+
+  /* (sec) Time-limit, 0 or less is no limit */
+  int time_limit;
+
+  /* boolean start the time-limit timer on first connect */
+  int time_from_connect;
+
+  /* (msec) (re)connect timeouts and periods */
+  int connect_timeout;
+  int connect_period;
+  int reconnect_timeout;
+  int reconnect_period;
+
+  /* timers of the time-limit, the next (re)connect attempt and the (re)connect period */
+  Timer limit;
+  Timer attempt;
+  Timer period;
+
+  /* boolean the time-limit expired, finish once the data received is written */
+  int expired;
+
+  /* boolean time for the next (re)connect attempt */
+  int attempt_due;
+
+  /* delays between reconnect attempts */
+  Backoff backoff;
+
+  /* (re)connect attempts allowed to the host of the url, NULL is no limit */
+  Bucket *bucket;
+
+  /* one of the states above */
+  int state;
+
+  /* the stream, NULL while waiting for the next (re)connect attempt */
+  URL_FILE *handle;
+
+  /* where the url redirected to last, reconnects go there directly; NULL if
+     it didn't redirect */
+  char *direct;
+
+  /* (msec, url_clock()) the redirect target was found, failed attempts on it
+     and boolean the stream was opened at it */
+  long long direct_at;
+  int direct_failures;
+  int via_direct;
+
+  /* the url and its mirrors, raced on every (re)connect when there are
+     mirrors, and the one recorded from */
+  MirrorList mirrors;
+  Mirror *mirror;
+
+  /* with --merge the url and the second source, and the one recorded from */
+  char *sources[2];
+  int source;
+
+  /* connection to the other source, kept receiving the last few seconds
+     to continue from when the recorded one is lost; NULL while down */
+  URL_FILE *second;
+
+  /* timer and boolean of the next connect attempt of the other source */
+  Timer second_timer;
+  int second_due;
+
+  /* resident mode: start of the scheduled recording, its timer and boolean
+     the stream is connected ahead of it, what arrives until then is dropped */
+  time_t scheduled;
+  Timer start;
+  int warming;
+
+  /* output file, NULL when not yet opened */
+  OUTPUT *out;
+
+  /* MP3 frame synchronising stage, used with --frame-sync */
+  Mp3Sync sync;
+
+  /* hashes of the frames written, used with --dedup */
+  Dedup dedup;
+
+  /* name of the current output file, a segment of output when segmenting */
+  char path[PATH_MAX];
+
+  /* file offset of the data written is base_offset + nwritten */
+  off_t base_offset;
+
+  /* bytes taken from the current stream */
+  unsigned long long stream_pos;
+
+  /* title sidecar file, NULL until the first title, and the last title */
+  FILE *meta;
+  char *title;
+
+  /* seek index, used with --index */
+  SeekIndex index;
+
+  /* segmented output: end of the current segment and its audio */
+  time_t segment_end;
+  double segment_seconds;
+
+  /* the next segment, opened ahead of time, NULL if not (yet) opened */
+  OUTPUT *next_out;
+  int next_fd;
+  int next_created;
+  time_t next_start;
+  char next_path[PATH_MAX];
+
+  /* rolling playlist of the segments written */
+  Playlist playlist;
+
+  /* (msec) stall time and (bytes/sec) minimum rate that start a hedge */
+  int hedge;
+  int hedge_rate;
+
+  /* second connection to the url while the stream is stalled, or NULL */
+  URL_FILE *standby;
+
+  /* (msec, url_clock()) no standby connection before this time */
+  long long standby_retry;
+
+  /* start of the current rate measurement and bytes received until then */
+  long long rate_mark;
+  unsigned long long rate_bytes;
+
+  /* boolean the last rate measurement was below hedge_rate */
+  int slow_rate;
+
+  /* standby connections opened and switched to */
+  unsigned long hedges;
+  unsigned long switches;
+
+  /* boolean output could not take all data, retry soon */
+  int blocked;
+
+  /* total bytes written to the output file */
+  off_t nwritten;
+
+  /* time the time-limit expires, 0 if not started or no limit */
+  time_t expires;
+
+  /* boolean disk space was reserved for the current output file */
+  int reserved;
+
+  /* live metrics, NULL when not served */
+  MetricsStream *metrics;
+
+  /* bytes received by the connections closed so far */
+  unsigned long long received_done;
+
+  /* (msec, url_clock()) last data of the connection that was lost */
+  long long lost_at;
+
+  /* start of the receive rate measurement of the metrics and bytes until then */
+  long long metrics_mark;
+  unsigned long long metrics_bytes;
+
+  /* exit code of the job */
+  int retval;
+
+} StreamgetJob;
+
 /* local function */
 static void sg_usage(FILE *ostream);
-static void sg_alrm(int);
-static int sg_sleep(time_t seconds);
-static int sg_set_alarm(int timeout);
-static void sg_reset_countdown(StreamgetOptions *options);
+static int sg_parse_msecs(const char *text);
 static int sg_open_logfile(StreamgetOptions *options);
 static int sg_parse_options(int argc, char **argv, StreamgetOptions *options);
-static int sg_mainloop(void);
+static int sg_iovlen(const struct iovec *iov, int iovcnt);
+static void sg_job_init(StreamgetJob *job, StreamgetOptions *options);
+static int sg_read_jobs(const char *path, StreamgetJob **jobs);
+static void sg_job_start_timer(StreamgetJob *job, time_t now);
+static void sg_job_finish(StreamgetJob *job);
+static long long sg_job_close_stream(StreamgetJob *job, URL_FILE *handle);
+static void sg_job_reconnected(StreamgetJob *job);
+static char *sg_job_open_url(StreamgetJob *job);
+static int sg_job_race(StreamgetJob *job);
+static void sg_job_redirected(StreamgetJob *job);
+static void sg_job_metrics(StreamgetJob *job);
+static int sg_job_connected(StreamgetJob *job, time_t now);
+static void sg_job_retry(StreamgetJob *job);
+static void sg_job_timer(StreamgetJob *job, int id);
+static void sg_job_expire(StreamgetJob *job);
+static void sg_job_switch(StreamgetJob *job);
+static void sg_job_consume(StreamgetJob *job, size_t len);
+static void sg_job_meta(StreamgetJob *job);
+static int sg_job_open_index(StreamgetJob *job);
+static int sg_open_output(const char *path, int *created);
+static int sg_job_set_output(StreamgetJob *job, int fd, const char *path);
+static void sg_job_close_output(StreamgetJob *job);
+static int sg_job_open_segment(StreamgetJob *job, time_t start);
+static void sg_job_preopen(StreamgetJob *job);
+static void sg_job_drop_next(StreamgetJob *job);
+static void sg_job_reserve(StreamgetJob *job, time_t now);
+static void sg_job_write_title(StreamgetJob *job, unsigned long long offset, const char *title);
+static void sg_job_hedge(StreamgetJob *job);
+static void sg_job_second(StreamgetJob *job);
+static int sg_job_stalled(StreamgetJob *job);
+static void sg_job_step(StreamgetJob *job, time_t now);
+static int sg_job_prepare(StreamgetJob *job, int index);
+static void sg_signal(int sig);
+static void sg_schedule_plan(time_t now);
+static void sg_schedule_launch(StreamgetJob *jobs, int njobs, time_t now);
+static int sg_mainloop(StreamgetJob *jobs, int njobs);
 
 /* global variables */
 static char *g_useragent = "Streamget/" VERSION " (" GIT_REF ")";
 
+/* resident mode: the recordings, and set by SIGHUP */
+static Schedule g_schedule = {NULL, 0};
+static volatile sig_atomic_t g_reload = 0;
+
+/* set by SIGTERM/SIGINT: end the recordings in progress, 2 once they are told */
+static volatile sig_atomic_t g_stop = 0;
+
 /* global variable to hold options */
 static StreamgetOptions g_options = {
     NULL, /* no URL specified */
@@ -187,17 +530,44 @@ static StreamgetOptions g_options = {
     0, /* start time-limit timer when program starts */
     DEFAULT_CONNECT_TIMEOUT,
     DEFAULT_CONNECT_PERIOD,
-    0,
     DEFAULT_RECONNECT_TIMEOUT,
     DEFAULT_RECONNECT_PERIOD,
-    0,
+    URL_DEFAULT_BUFFERSIZE,
     0, /* don't show progress */
     0, /* don't be verbose */
-    0, /* do not daemonize */
+    0,    /* do not daemonize */
+    NULL, /* no job file */
+    0,    /* no writer thread */
+    0,    /* no io_uring */
+    0,    /* write the stream as is */
+    0,    /* no hedged reconnect */
+    0,    /* no minimum rate */
+    0,    /* keep replayed audio */
+    0,    /* no ICY metadata */
+    0,    /* no seek index */
+    0,    /* one output file */
+    0,    /* kernel writeback */
+    0,    /* no durability policy */
+    NULL, /* no metrics endpoint */
+    LOGGER_TEXT, /* plain log lines */
+    BACKOFF_FIXED, /* reconnect-timeout between attempts */
+    BACKOFF_DEFAULT_CAP,
+    0, /* no per host limit */
+    1,
+    DEFAULT_REDIRECT_FAILURES,
+    DEFAULT_REDIRECT_TTL,
+    NULL, /* no mirrors */
+    0,
+    DEFAULT_STAGGER,
+    NULL, /* no second source */
+    NULL, /* record once */
+    DEFAULT_PREWARM,
 };
 
 void print_options(StreamgetOptions *options)
 {
+  int i;
+
   if (!options)
     return;
 
@@ -206,28 +576,53 @@ void print_options(StreamgetOptions *options)
   LOGINFO1(stdout, "log                : %s\n", options->logname ? options->logname : "<not set>");
   LOGINFO1(stdout, "time-limit         : %d seconds\n", options->time_limit);
   LOGINFO1(stdout, "time-from-connect  : %s\n", options->time_from_connect ? "yes" : "no");
-  LOGINFO1(stdout, "connect-timeout    : %d seconds\n", options->connect_timeout);
-  LOGINFO1(stdout, "connect-period     : %d seconds\n", options->connect_period);
-  LOGINFO1(stdout, "connect-countdown  : %d seconds\n", options->connect_countdown);
-  LOGINFO1(stdout, "reconnect-timeout  : %d seconds\n", options->reconnect_timeout);
-  LOGINFO1(stdout, "reconnect-period   : %d seconds\n", options->reconnect_period);
-  LOGINFO1(stdout, "reconnect-countdown: %d seconds\n", options->reconnect_countdown);
+  LOGINFO1(stdout, "connect-timeout    : %d msecs\n", options->connect_timeout);
+  LOGINFO1(stdout, "connect-period     : %d msecs\n", options->connect_period);
+  LOGINFO1(stdout, "reconnect-timeout  : %d msecs\n", options->reconnect_timeout);
+  LOGINFO1(stdout, "reconnect-period   : %d msecs\n", options->reconnect_period);
+  LOGINFO1(stdout, "buffer-size        : %d bytes\n", options->buffer_size);
   LOGINFO1(stdout, "progress           : %s\n", options->progress ? "yes" : "no");
   LOGINFO1(stdout, "verbose            : %d (level)\n", options->verbose);
   LOGINFO1(stdout, "daemonize          : %s\n", options->daemonize ? "yes" : "no");
+  LOGINFO1(stdout, "jobs               : %s\n", options->jobs ? options->jobs : "<not set>");
+  LOGINFO1(stdout, "pipeline           : %d bytes\n", options->pipeline);
+  LOGINFO1(stdout, "io-uring           : %d buffers\n", options->io_uring);
+  LOGINFO1(stdout, "frame-sync         : %s\n", options->frame_sync ? "yes" : "no");
+  LOGINFO1(stdout, "hedge              : %d msec\n", options->hedge);
+  LOGINFO1(stdout, "hedge-rate         : %d bytes/sec\n", options->hedge_rate);
+  LOGINFO1(stdout, "dedup              : %d seconds\n", options->dedup);
+  LOGINFO1(stdout, "icy                : %s\n", options->icy ? "yes" : "no");
+  LOGINFO1(stdout, "index              : %d frames\n", options->index);
+  LOGINFO1(stdout, "segment            : %d seconds\n", options->segment);
+  LOGINFO1(stdout, "writeback          : %d KiB\n", options->writeback);
+  LOGINFO1(stdout, "sync               : %d msecs\n", options->sync);
+  LOGINFO1(stdout, "metrics            : %s\n", options->metrics ? options->metrics : "<not set>");
+  LOGINFO1(stdout, "log-format         : %s\n", LOGGER_JSON == options->log_format ? "json" : "text");
+  LOGINFO2(stdout, "backoff            : %s, cap %d msecs\n",
+           BACKOFF_EXP == options->backoff ? "exp" : BACKOFF_JITTER == options->backoff ? "jitter" : "fixed",
+           options->backoff_cap);
+  LOGINFO2(stdout, "host-rate          : %g attempts/sec, burst %d\n", options->host_rate, options->host_burst);
+  LOGINFO2(stdout, "redirect-cache     : %d failures, %d msecs\n", options->redirect_failures, options->redirect_ttl);
+  for (i = 0; i < options->nmirrors; ++i)
+    LOGINFO1(stdout, "mirror             : %s\n", options->mirrors[i]);
+  LOGINFO1(stdout, "stagger            : %d msecs\n", options->stagger);
+  LOGINFO1(stdout, "merge              : %s\n", options->merge ? options->merge : "<not set>");
+  LOGINFO1(stdout, "schedule           : %s\n", options->schedule ? options->schedule : "<not set>");
+  LOGINFO1(stdout, "prewarm            : %d msecs\n", options->prewarm);
 }
 
-static void sg_reset_countdown(StreamgetOptions *options)
+/*
+ * Seconds, with a fraction if needed (e.g. "0.15"), in msecs.
+ * Returns -1 if text is no positive number of seconds.
+ */
+static int sg_parse_msecs(const char *text)
 {
-  if (!options)
-    return;
+  char *end;
+  double seconds = strtod(text, &end);
 
-  options->connect_countdown = (options->connect_period > 0
-                                    ? options->connect_period / options->connect_timeout
-                                    : -1);
-  options->reconnect_countdown = (options->reconnect_period > 0
-                                      ? options->reconnect_period / options->reconnect_timeout
-                                      : -1);
+  if (end == text || *end || !(seconds > 0) || seconds > INT_MAX / 1000)
+    return -1;
+  return seconds * 1000 + 0.5 < 1 ? 1 : (int)(seconds * 1000 + 0.5);
 }
 
 static int sg_open_logfile(StreamgetOptions *options)
@@ -294,6 +689,29 @@ static int sg_parse_options(int argc, char **argv, StreamgetOptions *options)
         {"connect-period", required_argument, 0, 't'},
         {"reconnect-timeout", required_argument, 0, 'r'},
         {"reconnect-period", required_argument, 0, 'e'},
+        {"buffer-size", required_argument, 0, 'b'},
+        {"jobs", required_argument, 0, 'j'},
+        {"pipeline", required_argument, 0, 'w'},
+        {"io-uring", required_argument, 0, 'U'},
+        {"frame-sync", no_argument, 0, 'F'},
+        {"hedge", required_argument, 0, 'H'},
+        {"hedge-rate", required_argument, 0, 'R'},
+        {"dedup", required_argument, 0, 'D'},
+        {"icy", no_argument, 0, 'I'},
+        {"index", required_argument, 0, 'X'},
+        {"segment", required_argument, 0, 'G'},
+        {"writeback", required_argument, 0, 'W'},
+        {"sync", required_argument, 0, 'S'},
+        {"metrics", required_argument, 0, 'M'},
+        {"log-format", required_argument, 0, 'L'},
+        {"backoff", required_argument, 0, 'B'},
+        {"host-rate", required_argument, 0, 'A'},
+        {"redirect-cache", required_argument, 0, 'E'},
+        {"mirror", required_argument, 0, 'm'},
+        {"stagger", required_argument, 0, 'K'},
+        {"merge", required_argument, 0, 'Y'},
+        {"schedule", required_argument, 0, 'C'},
+        {"prewarm", required_argument, 0, 'P'},
         {"progress", no_argument, 0, 'p'},
         {"daemonize", no_argument, 0, 'd'},
         {"verbose", no_argument, 0, 'v'},
@@ -302,7 +720,7 @@ static int sg_parse_options(int argc, char **argv, StreamgetOptions *options)
         {0, 0, 0, 0},
     };
 
-    c = getopt_long(argc, argv, "u:o:l:s:xc:t:r:e:pdvhV",
+    c = getopt_long(argc, argv, "u:o:l:s:xc:t:r:e:b:j:w:U:FH:R:D:IX:G:W:S:M:L:B:A:E:m:K:Y:C:P:pdvhV",
                     long_options, &option_index);
     if (c == -1)
       break;
@@ -336,37 +754,252 @@ static int sg_parse_options(int argc, char **argv, StreamgetOptions *options)
       break;
 
     case 'c':
-      options->connect_timeout = abs(atoi(optarg));
+      options->connect_timeout = sg_parse_msecs(optarg);
       if (options->connect_timeout <= 0)
       {
-        fprintf(stderr, "Error: invalid value for 'connect-timeout': %d\n", options->connect_timeout);
+        fprintf(stderr, "Error: invalid value for 'connect-timeout': %s\n", optarg);
         retval = 0;
       }
       break;
 
     case 't':
-      options->connect_period = abs(atoi(optarg));
+      options->connect_period = sg_parse_msecs(optarg);
       if (options->connect_period <= 0)
       {
-        fprintf(stderr, "Error: invalid value for 'connect-period': %d\n", options->connect_period);
+        fprintf(stderr, "Error: invalid value for 'connect-period': %s\n", optarg);
         retval = 0;
       }
       break;
 
     case 'r':
-      options->reconnect_timeout = abs(atoi(optarg));
+      options->reconnect_timeout = sg_parse_msecs(optarg);
       if (options->reconnect_timeout <= 0)
       {
-        fprintf(stderr, "Error: invalid value for 'reconnect-timeout': %d\n", options->reconnect_timeout);
+        fprintf(stderr, "Error: invalid value for 'reconnect-timeout': %s\n", optarg);
         retval = 0;
       }
       break;
 
     case 'e':
-      options->reconnect_period = abs(atoi(optarg));
+      options->reconnect_period = sg_parse_msecs(optarg);
       if (options->reconnect_period <= 0)
       {
-        fprintf(stderr, "Error: invalid value for 'reconnect-period': %d\n", options->reconnect_period);
+        fprintf(stderr, "Error: invalid value for 'reconnect-period': %s\n", optarg);
+        retval = 0;
+      }
+      break;
+
+    case 'b':
+      options->buffer_size = atoi(optarg);
+      if (options->buffer_size <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'buffer-size': %d\n", options->buffer_size);
+        retval = 0;
+      }
+      break;
+
+    case 'j':
+      options->jobs = optarg;
+      break;
+
+    case 'w':
+      options->pipeline = atoi(optarg);
+      if (options->pipeline <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'pipeline': %d\n", options->pipeline);
+        retval = 0;
+      }
+      break;
+
+    case 'U':
+      options->io_uring = atoi(optarg);
+      if (options->io_uring <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'io-uring': %d\n", options->io_uring);
+        retval = 0;
+      }
+      break;
+
+    case 'F':
+      options->frame_sync = 1;
+      break;
+
+    case 'H':
+      options->hedge = atoi(optarg);
+      if (options->hedge <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'hedge': %d\n", options->hedge);
+        retval = 0;
+      }
+      break;
+
+    case 'R':
+      options->hedge_rate = atoi(optarg);
+      if (options->hedge_rate <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'hedge-rate': %d\n", options->hedge_rate);
+        retval = 0;
+      }
+      break;
+
+    case 'D':
+      options->dedup = atoi(optarg);
+      if (options->dedup <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'dedup': %d\n", options->dedup);
+        retval = 0;
+      }
+      /* works on whole frames */
+      options->frame_sync = 1;
+      break;
+
+    case 'I':
+      options->icy = 1;
+      break;
+
+    case 'X':
+      options->index = atoi(optarg);
+      if (options->index <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'index': %d\n", options->index);
+        retval = 0;
+      }
+      /* works on whole frames */
+      options->frame_sync = 1;
+      break;
+
+    case 'G':
+      options->segment = atoi(optarg);
+      if (options->segment <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'segment': %d\n", options->segment);
+        retval = 0;
+      }
+      /* cut on frame boundaries */
+      options->frame_sync = 1;
+      break;
+
+    case 'W':
+      options->writeback = atoi(optarg);
+      if (options->writeback <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'writeback': %d\n", options->writeback);
+        retval = 0;
+      }
+      break;
+
+    case 'S':
+      options->sync = atoi(optarg);
+      if (options->sync <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'sync': %d\n", options->sync);
+        retval = 0;
+      }
+      break;
+
+    case 'M':
+      options->metrics = optarg;
+      break;
+
+    case 'L':
+      if (0 == strcmp(optarg, "json"))
+        options->log_format = LOGGER_JSON;
+      else if (0 == strcmp(optarg, "text"))
+        options->log_format = LOGGER_TEXT;
+      else
+      {
+        fprintf(stderr, "Error: invalid value for 'log-format': %s\n", optarg);
+        retval = 0;
+      }
+      logger_setformat(options->log_format);
+      break;
+
+    case 'B':
+    {
+      char *cap = strchr(optarg, ':');
+
+      if (cap)
+        *cap++ = '\0';
+      options->backoff = backoff_policy(optarg);
+      if (cap)
+        options->backoff_cap = sg_parse_msecs(cap);
+      if (options->backoff < 0 || options->backoff_cap <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'backoff': %s%s%s\n", optarg, cap ? ":" : "", cap ? cap : "");
+        retval = 0;
+      }
+      break;
+    }
+
+    case 'A':
+    {
+      char *burst = strchr(optarg, ':');
+
+      options->host_rate = atof(optarg);
+      if (burst)
+        options->host_burst = atoi(burst + 1);
+      if (!(options->host_rate > 0) || options->host_burst <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'host-rate': %s\n", optarg);
+        retval = 0;
+      }
+      break;
+    }
+
+    case 'E':
+    {
+      char *ttl = strchr(optarg, ':');
+
+      options->redirect_failures = atoi(optarg);
+      if (ttl)
+        options->redirect_ttl = sg_parse_msecs(ttl + 1);
+      if (options->redirect_failures < 0 || options->redirect_ttl <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'redirect-cache': %s\n", optarg);
+        retval = 0;
+      }
+      break;
+    }
+
+    case 'm':
+    {
+      char **mirrors = realloc(options->mirrors, (options->nmirrors + 1) * sizeof(char *));
+
+      if (!mirrors)
+      {
+        fprintf(stderr, "Error: out of memory for 'mirror': %s\n", optarg);
+        retval = 0;
+        break;
+      }
+      options->mirrors = mirrors;
+      options->mirrors[options->nmirrors++] = optarg;
+      break;
+    }
+
+    case 'K':
+      options->stagger = sg_parse_msecs(optarg);
+      if (options->stagger <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'stagger': %s\n", optarg);
+        retval = 0;
+      }
+      break;
+
+    case 'Y':
+      options->merge = optarg;
+      /* the sources are lined up by their frames */
+      options->frame_sync = 1;
+      break;
+
+    case 'C':
+      options->schedule = optarg;
+      break;
+
+    case 'P':
+      options->prewarm = sg_parse_msecs(optarg);
+      if (options->prewarm <= 0)
+      {
+        fprintf(stderr, "Error: invalid value for 'prewarm': %s\n", optarg);
         retval = 0;
       }
       break;
@@ -413,8 +1046,17 @@ static int sg_parse_options(int argc, char **argv, StreamgetOptions *options)
     return 0;
   }
 
-  /* reset countdown values */
-  sg_reset_countdown(options);
+  if (options->hedge_rate && !options->hedge)
+  {
+    fprintf(stderr, "Error: 'hedge-rate' requires 'hedge'\n");
+    retval = 0;
+  }
+
+  if (options->pipeline && options->io_uring)
+  {
+    fprintf(stderr, "Error: 'pipeline' and 'io-uring' can't be combined\n");
+    retval = 0;
+  }
 
   if (optind < argc)
   {
@@ -441,8 +1083,59 @@ void sg_usage(FILE *ostream)
                                         default is to start timer when the program starts\n\
    [--connect-timeout  |-c 20]       # in secs, time between initial connect attempts)\n\
    [--connect-period   |-t 600]      # in secs, total period to try to connect, default is infinte)\n\
-   [--reconnect-timeout|-r 1]        # in secs, time between reconnect attempts)\n\
+   [--reconnect-timeout|-r 1]        # in secs, time between reconnect attempts, fractions allowed\n\
+                                        down to msecs (e.g. 0.1)\n\
    [--reconnect-retries|-e 600]      # in secs, total period to try to connect, default is infinte)\n\
+   [--buffer-size      |-b 262144]   # in bytes, capacity of the receive buffer (min 65536)\n\
+   [--jobs             |-j FILENAME] # record all streams listed in FILENAME ('-' is stdin)\n\
+                                        instead of --url/--output, one stream per line:\n\
+                                        URL[|MIRROR...] OUTPUT [TIME-LIMIT [RECONNECT-TIMEOUT [RECONNECT-PERIOD]]]\n\
+   [--pipeline         |-w 4194304]  # in bytes, write to disk from a separate thread through\n\
+                                        a queue of this size (min 262144)\n\
+   [--io-uring         |-U 64]       # write to disk with io_uring using this many 64KiB buffers,\n\
+                                        falls back to write() when io_uring is not available\n\
+   [--frame-sync       |-F]          # write whole MP3 frames only, skip anything in between\n\
+                                        and drop partial frames at a reconnect\n\
+   [--hedge            |-H 500]      # in msecs, open a standby connection when no data arrived\n\
+                                        for this long and keep whichever connection delivers first\n\
+   [--hedge-rate       |-R 16000]    # in bytes/sec, also open one when the stream is slower\n\
+   [--dedup            |-D 10]       # in secs, skip audio the server replays after a reconnect\n\
+                                        that is within this much of what was written (implies -F)\n\
+   [--icy              |-I]          # request ICY metadata, strip it from the audio and append\n\
+                                        title changes to FILENAME.meta (offset, time, title)\n\
+   [--index            |-X 38]       # in frames, build the seek index FILENAME.idx with a record\n\
+                                        every this many frames (38 is about 1s) (implies -F)\n\
+   [--segment          |-G 60]       # in secs, write segments of this length aligned to the clock,\n\
+                                        FILENAME is a strftime() pattern (e.g. radio-%%Y%%m%%d-%%H%%M%%S.mp3)\n\
+                                        and a playlist of the last ones is kept in radio.m3u8 (implies -F)\n\
+   [--writeback        |-W 1024]     # in KiB, write the output back to disk in windows of this size\n\
+                                        and drop them from the page cache; reserves disk space for\n\
+                                        the expected size (bitrate and time limit, with -F)\n\
+   [--sync             |-S 2000]     # in msecs, sync the output files from a separate thread so\n\
+                                        at most this much written audio is not yet on disk\n\
+   [--metrics          |-M 9100]     # serve live metrics (Prometheus text format) on this TCP port\n\
+                                        of localhost, or on a unix socket when given a path\n\
+   [--log-format       |-L text]     # 'text' or 'json' log lines (one JSON object per line)\n\
+   [--backoff          |-B exp:30]   # delays between reconnect attempts: 'fixed' (reconnect-timeout),\n\
+                                        'exp' (doubling) or 'jitter' (decorrelated jitter), starting\n\
+                                        at reconnect-timeout and capped at the secs after ':' (30)\n\
+   [--host-rate        |-A 2:5]      # (re)connect attempts per sec to one host, shared by all streams\n\
+                                        from it, with a burst of the number after ':' (1)\n\
+   [--redirect-cache   |-E 2:300]    # reconnect straight to where the url redirected to, until that\n\
+                                        failed this many attempts in a row or after the secs after ':'\n\
+                                        (300) the url is asked again; 0 always starts at the url\n\
+   [--mirror           |-m URL]      # another url of the same stream, may be repeated; every (re)connect\n\
+                                        races the url and its mirrors and records from the first to deliver\n\
+   [--stagger          |-K 0.25]     # in secs, between the connects of a race of mirrors\n\
+   [--merge            |-Y URL]      # record the same stream from this url at the same time and\n\
+                                        continue from it, without gap or repeat, when the url is lost\n\
+                                        (implies -F and -D 10 unless given)\n\
+   [--schedule         |-C FILENAME] # run resident and record the schedule in FILENAME instead of\n\
+                                        --url/--output, reloaded on SIGHUP, one recording per line:\n\
+                                        MINUTE HOUR DAY MONTH WEEKDAY DURATION URL OUTPUT\n\
+                                        (time fields as in crontab, DURATION in secs, OUTPUT a\n\
+                                        strftime() pattern of the start time)\n\
+   [--prewarm          |-P 5]        # in secs, connect a scheduled recording this far ahead of its start\n\
    [--progress         | -p]         # show progress meter\n\
    [--daemonize        | -d]         # start the process in the background\n\
    [--verbose          | -v]         # increase verbosity level by 1,2, etc e.g. -v, -vv, -vvv, etc.\n\
@@ -452,254 +1145,1782 @@ void sg_usage(FILE *ostream)
 }
 
 /*
- * SIGALRM handler.
+ * Total number of bytes described by an iovec array.
  */
-static void sg_alrm(int signo)
+static int sg_iovlen(const struct iovec *iov, int iovcnt)
 {
-  if (g_options.verbose > 0)
-  {
-    time_t now = time(0);
+  int len = 0;
 
-    /* \n omitted intentionally, provided by ctime() */
-    LOGINFO2(stdout, "Time limit of %d seconds expired at %s",
-             g_options.time_limit, ctime(&now));
-    fsync(fileno(stdout));
-  }
-  exit(EXIT_SUCCESS);
+  while (iovcnt-- > 0)
+    len += (iov++)->iov_len;
+
+  return len;
 }
 
 /*
- * Set alarm to go off after timeout seconds.
- * Install SIGALRM handler.
+ * Initialise a job with the (command line) defaults in options.
  */
-static int sg_set_alarm(int timeout)
+static void sg_job_init(StreamgetJob *job, StreamgetOptions *options)
 {
-  if (SIG_ERR == signal(SIGALRM, sg_alrm))
-  {
-    return 1;
-  }
-  return alarm(timeout);
+  memset(job, 0, sizeof(*job));
+
+  job->url = options->url;
+  job->output = options->output;
+  job->time_limit = options->time_limit;
+  job->time_from_connect = options->time_from_connect;
+  job->connect_timeout = options->connect_timeout;
+  job->connect_period = options->connect_period;
+  job->reconnect_timeout = options->reconnect_timeout;
+  job->reconnect_period = options->reconnect_period;
+  job->attempt_due = 1;
+  job->second_due = 1;
+  job->state = IDLE;
+  job->out = NULL;
+  job->hedge = options->hedge;
+  job->hedge_rate = options->hedge_rate;
+  job->standby = NULL;
+  job->index.fd = -1;
+  job->next_out = NULL;
+  job->next_fd = -1;
 }
 
 /*
- * Sleep for the specified number of seconds.
- * This function does not interfere with signals.
+ * Read the jobs from a job file ('-' is stdin), one job per line:
+ *
+ *   URL[|MIRROR...] OUTPUT [TIME-LIMIT [RECONNECT-TIMEOUT [RECONNECT-PERIOD]]]
+ *
+ * Omitted fields take the values given on the command line, a TIME-LIMIT
+ * of 0 or less records without a time limit. The reconnect fields are
+ * in seconds and may have a fraction (e.g. 0.1). Empty lines and lines
+ * starting with '#' are ignored.
+ * Returns the number of jobs read, -1 on error.
  */
-int sg_sleep(time_t seconds)
-{
-  int ret = 0;
-  struct timespec req;
-  struct timespec rem;
-
-  req.tv_sec = seconds;
-  req.tv_nsec = 0;
-  memset(&rem, 0, sizeof(rem));
-
-  do
-  {
-    ret = nanosleep(&req, &rem);
-    memcpy(&req, &rem, sizeof(struct timespec));
-  } while (ret < 0 && EINTR == errno);
-
-  return ret;
-}
-
-int sg_mainloop(void)
+static int sg_read_jobs(const char *path, StreamgetJob **jobs)
 {
-  int retval = 0; /* assume success */
-  URL_FILE *handle = NULL;
-  int outfd = -1;
-  int nread = 0;
-  int nwritten = 0;     /* total written bytes written to file */
-  int nwritten_now = 0; /* bytes written in one iteration of the loop */
-  char buffer[BUFFERSIZE];
-
-  /* defined valid states */
-  enum
-  {
-    IDLE,
-    CONNECTING,
-    CONNECTED,
-    RECONNECTING,
-    RECONNECTED,
-    DONE
-  };
-  int state = IDLE;
-
-  /* Start time-limit timer, if required */
-  if (!g_options.time_from_connect)
+  FILE *file;
+  char line[4096];
+  char *field[5];
+  char *mirror, *next;
+  int nfields;
+  int njobs = 0;
+  int lineno = 0;
+  StreamgetJob *job;
+
+  *jobs = NULL;
+
+  file = (strcmp(path, "-") ? fopen(path, "r") : stdin);
+  if (!file)
   {
-    time_t now = time(0) + g_options.time_limit;
-
-    /* \n omitted intentionally, provided by ctime() */
-    LOGINFO2(stdout, "Time limit set to %d seconds, expires at %s",
-             g_options.time_limit, ctime(&now));
-    (void)sg_set_alarm(g_options.time_limit);
+    fprintf(stderr, "Error: couldn't open job file '%s'\n%s\n", path, strerror(errno));
+    return -1;
   }
 
-  int *countdown = &g_options.connect_countdown;
-
-  /* try forever or until (re)connect periods or the time limit expire */
-  while (1)
+  while (fgets(line, sizeof(line), file))
   {
+    ++lineno;
 
-    /* open URL */
-    if (handle)
-      url_fclose(handle);
-    handle = url_fopen(g_options.url, "r", g_useragent);
-
-    if (handle)
+    for (nfields = 0; nfields < 5; ++nfields)
     {
-      LOGINFO2(stdout, "Stream '%s' %s.\n", g_options.url, nwritten ? "reopened" : "opened");
+      field[nfields] = strtok(nfields ? NULL : line, " \t\r\n");
+      if (!field[nfields])
+        break;
+    }
+    if (!nfields || '#' == field[0][0])
+      continue;
 
-      /* set options */
-      if (g_options.verbose > 1)
-      {
-        url_setverbose(handle, g_options.verbose);
-      }
+    if (nfields < 2 || strtok(NULL, " \t\r\n"))
+    {
+      fprintf(stderr, "Error: %s:%d: expected URL[|MIRROR...] OUTPUT [TIME-LIMIT "
+                      "[RECONNECT-TIMEOUT [RECONNECT-PERIOD]]]\n",
+              path, lineno);
+      njobs = -1;
+      break;
+    }
 
-      /* first read */
-      nread = url_fread(buffer, 1, sizeof(buffer), handle);
+    job = realloc(*jobs, (njobs + 1) * sizeof(StreamgetJob));
+    if (!job)
+    {
+      fprintf(stderr, "Error: out of memory reading job file '%s'\n", path);
+      njobs = -1;
+      break;
+    }
+    *jobs = job;
+    job += njobs++;
 
-      /* be verbose if data was read */
-      if (nread)
-        url_setprogress(handle, g_options.progress);
+    sg_job_init(job, &g_options);
 
-      /* set alarm for time limit when first data is written */
-      if (nread > 0)
+    /* the url and its mirrors, separated by '|' */
+    mirror = NULL;
+    if (strchr(field[0], '|'))
+    {
+      for (mirror = field[0]; mirror; mirror = next)
       {
-        LOGINFO2(stdout, "Stream '%s' %s.\n", g_options.url, nwritten ? "reconnected" : "active");
+        next = strchr(mirror, '|');
+        if (next)
+          *next++ = '\0';
+        if (!*mirror || mirror_add(&job->mirrors, mirror) < 0)
+          break;
+      }
+    }
+    job->url = strdup(field[0]);
+    job->output = strdup(field[1]);
+    if (nfields > 2)
+      job->time_limit = atoi(field[2]);
+    if (nfields > 3)
+      job->reconnect_timeout = sg_parse_msecs(field[3]);
+    if (nfields > 4)
+      job->reconnect_period = sg_parse_msecs(field[4]);
+
+    if (mirror || !job->url || !job->output || job->reconnect_timeout <= 0 ||
+        (nfields > 4 && job->reconnect_period <= 0))
+    {
+      fprintf(stderr, "Error: %s:%d: invalid job\n", path, lineno);
+      njobs = -1;
+      break;
+    }
+  }
+
+  if (file != stdin)
+    fclose(file);
+
+  if (!njobs)
+    fprintf(stderr, "Error: no jobs in job file '%s'\n", path);
+
+  return njobs;
+}
+
+/*
+ * Start the time-limit timer of a job.
+ */
+static void sg_job_start_timer(StreamgetJob *job, time_t now)
+{
+  time_t expires = now + job->time_limit;
+
+  if (job->time_limit <= 0)
+    return;
+
+  /* \n omitted intentionally, provided by ctime() */
+  if (job->time_from_connect)
+  {
+    LOGINFO2(stdout, "Starting time-limit timer of %d seconds, will expire at %s",
+             job->time_limit, ctime(&expires));
+  }
+  else
+  {
+    LOGINFO2(stdout, "Time limit set to %d seconds, expires at %s",
+             job->time_limit, ctime(&expires));
+  }
+
+  timer_set(&job->limit, url_clock() + job->time_limit * 1000LL);
+  job->expires = expires;
+}
+
+/*
+ * Stop recording a job and release its stream and output file.
+ */
+static void sg_job_finish(StreamgetJob *job)
+{
+  int i;
+
+  if (g_options.frame_sync)
+  {
+    LOGINFO4(stdout, "Stream '%s': %lu frames, %lu bytes skipped, %lu resyncs.\n",
+             job->url, job->sync.frames, job->sync.skipped, job->sync.resyncs);
+  }
+  if (job->hedge)
+  {
+    LOGINFO3(stdout, "Stream '%s': %lu standby connections, %lu switches.\n",
+             job->url, job->hedges, job->switches);
+  }
+  if (g_options.dedup)
+  {
+    LOGINFO4(stdout, "Stream '%s': %lu overlaps, %lu frames (%llu bytes) skipped as replayed.\n",
+             job->url, job->dedup.overlaps, job->dedup.frames, job->dedup.bytes);
+  }
+  dedup_free(&job->dedup);
+
+  free(job->title);
+  job->title = NULL;
+
+  free(job->direct);
+  job->direct = NULL;
+
+  if (job->handle)
+    (void)sg_job_close_stream(job, job->handle);
+  job->handle = NULL;
+
+  if (job->standby)
+    (void)sg_job_close_stream(job, job->standby);
+  job->standby = NULL;
+
+  if (job->second)
+    (void)sg_job_close_stream(job, job->second);
+  job->second = NULL;
+
+  for (i = 0; i < job->mirrors.count; ++i)
+  {
+    if (job->mirrors.mirror[i].handle)
+      (void)sg_job_close_stream(job, job->mirrors.mirror[i].handle);
+  }
+  mirror_free(&job->mirrors);
+  job->mirror = NULL;
+
+  sg_job_close_output(job);
+  sg_job_drop_next(job);
+  playlist_free(&job->playlist);
+
+  timer_cancel(&job->limit);
+  timer_cancel(&job->attempt);
+  timer_cancel(&job->period);
+  timer_cancel(&job->second_timer);
+  timer_cancel(&job->start);
+  job->warming = 0;
+
+  job->state = DONE;
+}
+
+/*
+ * Close a connection of a job, its bytes count as received.
+ * Returns when it last received data (msec, url_clock()).
+ */
+static long long sg_job_close_stream(StreamgetJob *job, URL_FILE *handle)
+{
+  long long last = url_clock();
+  URL_STAT stat;
+
+  if (url_fstat(handle, &stat) == 0)
+  {
+    job->received_done += stat.received;
+    last = stat.last_receive;
+  }
+  url_fclose(handle);
+  return last;
+}
+
+/*
+ * Recording resumed after the stream was lost at job->lost_at.
+ */
+static void sg_job_reconnected(StreamgetJob *job)
+{
+  MetricsStream *m = job->metrics;
+  long long gap = url_clock() - job->lost_at;
+  URL_STAT stat;
+
+  /* time to first byte of the connection that made it */
+  stat.ttfb = -1;
+  (void)url_fstat(job->handle, &stat);
+
+  LOGINFO4(stdout, "Stream '%s' recovered after %lld msecs, %u attempts, first data %ld msecs after connecting.\n",
+           job->url, gap, job->backoff.attempts, stat.ttfb);
+  backoff_reset(&job->backoff);
+
+  if (!m)
+    return;
+
+  metrics_set(&m->reconnects, atomic_load_explicit(&m->reconnects, memory_order_relaxed) + 1);
+  metrics_set(&m->gap, gap);
+  if (stat.ttfb >= 0)
+    metrics_set(&m->ttfb, stat.ttfb);
+}
+
+/*
+ * The url to (re)connect to: where the url redirected to last, while that
+ * is fresh and not failing, else the url itself.
+ */
+static char *sg_job_open_url(StreamgetJob *job)
+{
+  if (!job->direct)
+    return job->url;
+
+  if (job->direct_failures >= g_options.redirect_failures)
+  {
+    LOGWARN3(stdout, "Stream '%s' redirect target '%s' failed %d times, asking the url again.\n",
+             job->url, job->direct, job->direct_failures);
+  }
+  else if (url_clock() - job->direct_at >= g_options.redirect_ttl)
+  {
+    LOGINFO2(stdout, "Stream '%s' redirect target '%s' expired, asking the url again.\n",
+             job->url, job->direct);
+  }
+  else
+    return job->direct;
+
+  free(job->direct);
+  job->direct = NULL;
+  return job->url;
+}
+
+/*
+ * Data arrived on a new connection, remember where the url redirected it
+ * to for the next reconnect.
+ */
+static void sg_job_redirected(StreamgetJob *job)
+{
+  const char *effective;
+
+  if (job->via_direct)
+  {
+    job->direct_failures = 0;
+    return;
+  }
+  if (!g_options.redirect_failures || job->mirrors.count || job->sources[1])
+    return;
+
+  free(job->direct);
+  job->direct = NULL;
+
+  effective = url_feffective(job->handle);
+  if (!effective || 0 == strcmp(effective, job->url))
+    return;
+
+  job->direct = strdup(effective);
+  job->direct_at = url_clock();
+  job->direct_failures = 0;
+  if (job->direct)
+  {
+    LOGINFO2(stdout, "Stream '%s' redirected to '%s', reconnects go there directly.\n",
+             job->url, job->direct);
+  }
+}
+
+/*
+ * Run the race of the mirrors of a job: open the next one each time the
+ * attempt timer expires, a stagger apart, and take the first one with
+ * data. Losing all of them is a failed attempt.
+ * Returns 1 when job->handle is the winner, 0 while racing.
+ */
+static int sg_job_race(StreamgetJob *job)
+{
+  MirrorList *l = &job->mirrors;
+  Mirror *m, *winner = NULL;
+  URL_STAT stat;
+  int running = 0;
+  int i;
+
+  for (i = 0; i < l->count; ++i)
+  {
+    m = &l->mirror[i];
+    if (!m->handle)
+      continue;
+
+    if (!winner && url_fstat(m->handle, &stat) == 0 && stat.buffered)
+    {
+      winner = m;
+      continue;
+    }
+    if (url_feof(m->handle))
+    {
+      (void)sg_job_close_stream(job, m->handle);
+      m->handle = NULL;
+      mirror_failed(m, url_clock());
+      LOGWARN2(stdout, "Stream '%s' mirror '%s' failed.\n", job->url, m->url);
+
+      /* the next one needn't wait for the stagger */
+      job->attempt_due = 1;
+      continue;
+    }
+    running++;
+  }
+
+  if (winner)
+  {
+    /* the others lost, that doesn't count against them */
+    for (i = 0; i < l->count; ++i)
+    {
+      m = &l->mirror[i];
+      if (m != winner && m->handle)
+      {
+        (void)sg_job_close_stream(job, m->handle);
+        m->handle = NULL;
+      }
+    }
+    mirror_reset(l);
+    mirror_won(winner, stat.ttfb);
+    timer_cancel(&job->attempt);
+    job->attempt_due = 0;
+
+    job->handle = winner->handle;
+    winner->handle = NULL;
+    job->mirror = winner;
+
+    LOGINFO3(stdout, "Stream '%s' recording from mirror '%s', first data after %ld msecs.\n",
+             job->url, winner->url, stat.ttfb);
+    return 1;
+  }
+
+  if (job->attempt_due)
+  {
+    job->attempt_due = 0;
+    if ((m = mirror_next(l)))
+    {
+      m->handle = url_fopen(m->url, "r", g_useragent);
+      if (m->handle)
+      {
+        LOGINFO2(stdout, "Stream '%s' racing mirror '%s'.\n", job->url, m->url);
+        url_setnonblocking(m->handle, 1);
+        if (g_options.verbose > 1)
+          url_setverbose(m->handle, g_options.verbose);
+        running++;
+      }
+      else
+      {
+        mirror_failed(m, url_clock());
+        LOGWARN2(stdout, "Stream '%s' mirror '%s' failed.\n", job->url, m->url);
+      }
+
+      /* the next one joins after the stagger, or right away */
+      timer_set(&job->attempt, url_clock() + (m->handle ? g_options.stagger : 0));
+      return 0;
+    }
+  }
+
+  if (!running && l->started == l->count)
+  {
+    /* all of them lost */
+    mirror_reset(l);
+    job->attempt_due = 0;
+    sg_job_retry(job);
+  }
+  return 0;
+}
+
+/*
+ * Publish the current state of a job to the metrics endpoint.
+ */
+static void sg_job_metrics(StreamgetJob *job)
+{
+  MetricsStream *m = job->metrics;
+  long long now;
+  unsigned long long received = job->received_done;
+  URL_STAT stat;
+
+  if (!m)
+    return;
+
+  stat.buffered = 0;
+  stat.capacity = 0;
+  if (job->handle && url_fstat(job->handle, &stat) == 0)
+    received += stat.received;
+
+  metrics_set(&m->received, received);
+  metrics_set(&m->written, job->nwritten);
+  metrics_set(&m->buffered, stat.buffered);
+  if (stat.capacity)
+    metrics_set(&m->capacity, stat.capacity);
+  atomic_store_explicit(&m->state, job->state, memory_order_relaxed);
+
+  now = url_clock();
+  if (now - job->metrics_mark >= 1000)
+  {
+    if (job->metrics_mark)
+      metrics_set(&m->rate, (received - job->metrics_bytes) * 1000 / (now - job->metrics_mark));
+    job->metrics_mark = now;
+    job->metrics_bytes = received;
+  }
+}
+
+/*
+ * Open the seek index OUTPUT.idx next to the output file.
+ * Returns 0 on success, -1 if the job had to be stopped.
+ */
+static int sg_job_open_index(StreamgetJob *job)
+{
+  size_t len = strlen(job->path) + sizeof(".idx");
+  char *name = malloc(len);
+
+  if (name)
+  {
+    snprintf(name, len, "%s.idx", job->path);
+    if (seekindex_open(&job->index, name, g_options.index) == 0)
+    {
+      free(name);
+      return 0;
+    }
+  }
+
+  LOGERROR2(stdout, "Error: couldn't open index file '%s.idx'\n%s.\n",
+           job->path, strerror(errno));
+  free(name);
+  return -1;
+}
+
+/*
+ * Open (create) and lock an output file for appending. *created tells
+ * whether it was created.
+ * Returns the file descriptor, -1 on error (logged).
+ */
+static int sg_open_output(const char *path, int *created)
+{
+  int fd = open(path, O_CREAT | O_EXCL | O_WRONLY | O_APPEND, 00666);
+
+  *created = (fd >= 0);
+  if (fd < 0 && EEXIST == errno)
+    fd = open(path, O_CREAT | O_WRONLY | O_APPEND, 00666);
+  if (fd < 0)
+  {
+    LOGERROR2(stdout, "Error: couldn't open output file '%s'\n%s.\n",
+             path, strerror(errno));
+    return -1;
+  }
+  if (!lockfd(fd))
+  {
+    LOGERROR2(stdout, "Error: couldn't lock output file '%s'\n%s.\n",
+             path, strerror(errno));
+    if (*created)
+      unlink(path);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/*
+ * Make an output file opened by sg_open_output() the one the job writes
+ * to, and open the sidecar files that go with it.
+ * Returns 0 on success, -1 on error (logged); the caller stops the job.
+ */
+static int sg_job_set_output(StreamgetJob *job, int fd, const char *path)
+{
+  snprintf(job->path, sizeof(job->path), "%s", path);
+
+  job->base_offset = lseek(fd, 0, SEEK_END) - job->nwritten;
+  job->reserved = 0;
+  job->out = output_fdopen(fd);
+  if (!job->out)
+  {
+    LOGERROR2(stdout, "Error: couldn't open output file '%s'\n%s.\n",
+             path, strerror(errno));
+    unlockfd(fd);
+    close(fd);
+    return -1;
+  }
+
+  if (g_options.index && sg_job_open_index(job) < 0)
+    return -1;
+
+  /* a segment starts with the title playing */
+  if (job->title)
+    sg_job_write_title(job, job->base_offset + job->nwritten, job->title);
+
+  return 0;
+}
+
+/*
+ * Close the output file and its sidecar files. A finished segment is
+ * added to the playlist.
+ */
+static void sg_job_close_output(StreamgetJob *job)
+{
+  if (job->out)
+  {
+    output_close(job->out);
+    job->out = NULL;
+
+    if (g_options.segment &&
+        playlist_add(&job->playlist, job->path, job->segment_seconds) < 0)
+    {
+      LOGERROR2(stdout, "Error: couldn't write playlist '%s'\n%s.\n",
+               job->playlist.path, strerror(errno));
+    }
+  }
+
+  seekindex_close(&job->index);
+
+  if (job->meta)
+    fclose(job->meta);
+  job->meta = NULL;
+}
+
+/*
+ * Start writing the segment that starts at start, on the file opened
+ * ahead of time if it is that one, and open the next one.
+ * Returns 0 on success, -1 if the job had to be stopped.
+ */
+static int sg_job_open_segment(StreamgetJob *job, time_t start)
+{
+  char path[PATH_MAX];
+  int created;
+  int fd = -1;
+
+  if (job->next_out && job->next_start == start)
+  {
+    snprintf(job->path, sizeof(job->path), "%s", job->next_path);
+    job->base_offset = lseek(job->next_fd, 0, SEEK_END) - job->nwritten;
+    job->out = job->next_out;
+    job->reserved = 1; /* by sg_job_preopen() */
+    job->next_out = NULL;
+    job->next_fd = -1;
+    if (g_options.index && sg_job_open_index(job) < 0)
+    {
+      job->retval = 2;
+      sg_job_finish(job);
+      return -1;
+    }
+    if (job->title)
+      sg_job_write_title(job, job->base_offset + job->nwritten, job->title);
+  }
+  else
+  {
+    sg_job_drop_next(job);
+    if (segment_name(path, sizeof(path), job->output, start) < 0 ||
+        (fd = sg_open_output(path, &created)) < 0 ||
+        sg_job_set_output(job, fd, path) < 0)
+    {
+      if (fd < 0 && ENAMETOOLONG == errno)
+      {
+        LOGERROR1(stdout, "Error: segment name of '%s' too long.\n", job->output);
+      }
+      job->retval = 2;
+      sg_job_finish(job);
+      return -1;
+    }
+  }
+
+  job->segment_end = start + g_options.segment;
+  job->segment_seconds = 0;
+
+  LOGINFO2(stdout, "Stream '%s' segment '%s'.\n", job->url, job->path);
+
+  sg_job_preopen(job);
+  return 0;
+}
+
+/*
+ * Open and preallocate the next segment ahead of time, so the rotation
+ * itself doesn't have to wait for the file system. Failing is not an
+ * error, the rotation opens it then.
+ */
+static void sg_job_preopen(StreamgetJob *job)
+{
+  if (segment_name(job->next_path, sizeof(job->next_path), job->output, job->segment_end) < 0 ||
+      0 == strcmp(job->next_path, job->path))
+    return;
+
+  job->next_fd = sg_open_output(job->next_path, &job->next_created);
+  if (job->next_fd < 0)
+    return;
+
+  job->next_out = output_fdopen(job->next_fd);
+  if (!job->next_out)
+  {
+    if (job->next_created)
+      unlink(job->next_path);
+    unlockfd(job->next_fd);
+    close(job->next_fd);
+    job->next_fd = -1;
+    return;
+  }
+  job->next_start = job->segment_end;
+
+  /* room for a segment at the bitrate of the stream */
+  if (job->sync.last.bitrate)
+    (void)output_preallocate(job->next_out, (off_t)job->sync.last.bitrate / 8 * g_options.segment);
+}
+
+/*
+ * Reserve disk space for what the current output file is expected to
+ * grow to: the rest of the segment or time limit at the bitrate of the
+ * stream. Without frame sync the bitrate is unknown; output.c then
+ * reserves a few writeback windows ahead.
+ */
+static void sg_job_reserve(StreamgetJob *job, time_t now)
+{
+  time_t end = job->segment_end ? job->segment_end : job->expires;
+
+  if (!job->sync.last.bitrate)
+    return;
+
+  job->reserved = 1;
+  if (end > now)
+    (void)output_preallocate(job->out, (off_t)job->sync.last.bitrate / 8 * (end - now));
+}
+
+/*
+ * Close the segment opened ahead of time, removing it if it was created
+ * for nothing.
+ */
+static void sg_job_drop_next(StreamgetJob *job)
+{
+  struct stat st;
+
+  if (!job->next_out)
+    return;
+
+  if (job->next_created && fstat(job->next_fd, &st) == 0 && 0 == st.st_size)
+    unlink(job->next_path);
+  output_close(job->next_out);
+  job->next_out = NULL;
+  job->next_fd = -1;
+}
+
+/*
+ * First data arrived on a freshly opened stream.
+ * Returns 0 on success, -1 if the job had to be stopped.
+ */
+static int sg_job_connected(StreamgetJob *job, time_t now)
+{
+  LOGINFO2(stdout, "Stream '%s' %s.\n", job->url, job->nwritten ? "reconnected" : "active");
+
+  /* be verbose now data was read */
+  url_setprogress(job->handle, g_options.progress);
+  sg_job_redirected(job);
+
+  /* update state */
+  if (0 == job->nwritten)
+    job->state = CONNECTED;
+  else
+  {
+    job->state = RECONNECTED;
+    sg_job_reconnected(job);
+  }
+
+  timer_cancel(&job->period);
+
+  if (CONNECTED == job->state && !job->out)
+  {
+    /*
+     * Open output file late (when first data is about to be written,
+     * to prevent creating an empty file when the source is not yet active.
+     */
+    if (g_options.segment)
+    {
+      if (sg_job_open_segment(job, segment_start(now, g_options.segment)) < 0)
+        return -1;
+    }
+    else
+    {
+      int created;
+      int outfd = sg_open_output(job->output, &created);
+
+      if (outfd < 0 || sg_job_set_output(job, outfd, job->output) < 0)
+      {
+        job->retval = 2;
+        sg_job_finish(job);
+        return -1;
+      }
+    }
+
+    /*
+     * Signal parent that recording has started by sending the CONT signal;
+     * a resident process has no parent waiting for it
+     */
+    if (!g_options.schedule)
+      kill(getppid(), SIGCONT);
+
+    /* start time-limit timer if required */
+    if (job->time_from_connect)
+      sg_job_start_timer(job, now);
+  }
+
+  return 0;
+}
+
+/*
+ * The stream of a job ended (or could not be opened). Schedule the next
+ * attempt, or give up when the (re)connect period expired.
+ */
+static void sg_job_retry(StreamgetJob *job)
+{
+  long long now = url_clock();
+  int delay;
+
+  if (job->warming)
+  {
+    /* before a scheduled start: connect again in time for it */
+    delay = backoff_next(&job->backoff);
+    LOGWARN2(stdout, "Stream '%s' lost before its scheduled start, retrying in %d msecs.\n",
+             job->url, delay);
+    job->state = CONNECTING;
+    timer_set(&job->attempt, now + delay);
+  }
+  else if (job->nwritten <= 0)
+  {
+    if (CONNECTING != job->state)
+    {
+      LOGINFO1(stdout, "Stream '%s' not active.\n", job->url);
+    }
+    /* update state */
+    job->state = CONNECTING;
+    timer_set(&job->attempt, now + job->connect_timeout);
+  }
+  else
+  {
+    delay = backoff_next(&job->backoff);
+    if (RECONNECTING != job->state)
+    {
+      LOGWARN1(stdout, "Lost connection. Reconnecting (timeout=%d msecs)...\n", delay);
+
+      /* the reconnect period starts now */
+      if (job->reconnect_period > 0)
+        timer_set(&job->period, now + job->reconnect_period);
+    }
+    /* update state */
+    job->state = RECONNECTING;
+    timer_set(&job->attempt, now + delay);
+  }
+}
+
+/*
+ * A timer of a job expired.
+ */
+static void sg_job_timer(StreamgetJob *job, int id)
+{
+  switch (id)
+  {
+  case JOB_LIMIT:
+    /* finished by the next step, after writing what was received */
+    job->expired = 1;
+    break;
+
+  case JOB_ATTEMPT:
+    job->attempt_due = 1;
+    break;
+
+  case JOB_SECOND:
+    job->second_due = 1;
+    break;
+
+  case JOB_START:
+    /* record from here, the stream is connected already; time() may lag
+       the msec the timer fired in by a second */
+    LOGINFO2(stdout, "Scheduled recording of '%s' to '%s' starts.\n", job->url, job->output);
+    job->warming = 0;
+    backoff_reset(&job->backoff);
+    if (!job->time_from_connect)
+      sg_job_start_timer(job, time(0) > job->scheduled ? time(0) : job->scheduled);
+    break;
+
+  case JOB_PERIOD:
+    /* no data since the (re)connect period started */
+    if (job->nwritten <= 0)
+    {
+      LOGERROR2(stdout,
+               "Connect period of %g seconds expired. "
+               "Failed to open URL '%s'.\n",
+               job->connect_period / 1000.0, job->url);
+    }
+    else
+    {
+      LOGERROR2(stdout,
+               "Reconnect period of %g seconds expired. "
+               "Failed to open URL '%s'.\n",
+               job->reconnect_period / 1000.0, job->url);
+    }
+
+    sg_job_finish(job); /* stop recording */
+    break;
+  }
+}
+
+/*
+ * The time-limit of a job expired, or the program was stopped: stop recording.
+ */
+static void sg_job_expire(StreamgetJob *job)
+{
+  if (g_stop)
+  {
+    LOGINFO1(stdout, "Stopped recording to '%s'.\n", job->output);
+  }
+  else
+  {
+    LOGINFO2(stdout, "Time limit of %d seconds expired for '%s'.\n",
+             job->time_limit, job->output);
+  }
+  sg_job_finish(job);
+}
+
+/*
+ * Release data taken from the stream buffer.
+ */
+static void sg_job_consume(StreamgetJob *job, size_t len)
+{
+  url_fconsume(job->handle, len);
+  job->stream_pos += len;
+}
+
+/*
+ * Append a title line to the sidecar file OUTPUT.meta.
+ */
+static void sg_job_write_title(StreamgetJob *job, unsigned long long offset, const char *title)
+{
+  char stamp[32];
+  time_t now;
+
+  if (!job->meta)
+  {
+    size_t len = strlen(job->path) + sizeof(".meta");
+    char *name = malloc(len);
+
+    if (!name)
+      return;
+    snprintf(name, len, "%s.meta", job->path);
+    job->meta = fopen(name, "a");
+    if (!job->meta)
+    {
+      LOGERROR2(stdout, "Error: couldn't open title file '%s'\n%s.\n", name, strerror(errno));
+      free(name);
+      return;
+    }
+    free(name);
+  }
+
+  now = time(0);
+  strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+  fprintf(job->meta, "%llu\t%s\t%s\n", offset, stamp, title);
+  fflush(job->meta);
+}
+
+/*
+ * Append the title changes in the ICY metadata of the stream to the
+ * sidecar file OUTPUT.meta, one line per change:
+ *
+ *   OFFSET<tab>TIME<tab>TITLE
+ *
+ * OFFSET is the byte offset in the output file where the title starts
+ * (audio still buffered in front of the metadata block is counted as
+ * written), TIME the local time it arrived.
+ */
+static void sg_job_meta(StreamgetJob *job)
+{
+  char text[URL_ICY_MAX + 1];
+  char *title, *end;
+  unsigned long long offset;
+
+  /* output offsets are only known once the output is open */
+  while (job->out && url_fmeta(job->handle, &offset, text, sizeof(text)))
+  {
+    title = strstr(text, "StreamTitle='");
+    if (!title)
+      continue;
+    title += strlen("StreamTitle='");
+    end = strstr(title, "';");
+    if (end)
+      *end = '\0';
+
+    if (job->title && 0 == strcmp(job->title, title))
+      continue;
+    free(job->title);
+    job->title = strdup(title);
+
+    sg_job_write_title(job, job->base_offset + job->nwritten + offset - job->stream_pos, title);
+
+    LOGINFO2(stdout, "Stream '%s' title '%s'.\n", job->url, title);
+  }
+}
+
+/*
+ * Continue recording from the standby connection. Whatever the old
+ * connection still buffered is dropped, the standby starts anywhere in
+ * a frame.
+ */
+static void sg_job_switch(StreamgetJob *job)
+{
+  if (job->handle)
+    job->lost_at = sg_job_close_stream(job, job->handle);
+
+  job->handle = job->standby;
+  job->standby = NULL;
+  job->via_direct = 0;
+  sg_job_redirected(job);
+  job->stream_pos = 0;
+  job->sync.synced = 0;
+  dedup_reconnect(&job->dedup);
+  seekindex_gap(&job->index);
+  job->slow_rate = 0;
+  job->rate_mark = url_clock();
+  job->rate_bytes = 0;
+  job->switches++;
+  job->state = RECONNECTED;
+  sg_job_reconnected(job);
+  timer_cancel(&job->period);
+
+  LOGINFO1(stdout, "Stream '%s' switched to the standby connection.\n", job->url);
+}
+
+/*
+ * Hedged reconnect: when the stream stalls (no data for hedge msecs) or
+ * slows down (below hedge_rate over the last hedge msecs), open a
+ * standby connection to the same url without closing the stream. The
+ * first of the two to deliver data is kept, the other is closed.
+ * Only called with the stream buffer drained, so a stream paused by a
+ * full buffer never counts as stalled.
+ */
+static void sg_job_hedge(StreamgetJob *job)
+{
+  long long now = url_clock();
+  struct iovec iov[2];
+  URL_STAT stat;
+  int slow;
+
+  if (url_fstat(job->handle, &stat) < 0)
+    return;
+
+  if (!job->rate_mark)
+  {
+    job->rate_mark = now;
+    job->rate_bytes = stat.received;
+  }
+  else if (now - job->rate_mark >= job->hedge)
+  {
+    job->slow_rate = job->hedge_rate > 0 &&
+                     (stat.received - job->rate_bytes) * 1000 <
+                         (unsigned long long)job->hedge_rate * (now - job->rate_mark);
+    job->rate_mark = now;
+    job->rate_bytes = stat.received;
+  }
+  slow = job->slow_rate || now - stat.last_receive >= job->hedge;
+
+  if (!job->standby)
+  {
+    if (!slow || now < job->standby_retry)
+      return;
+
+    job->standby = url_fopen(job->mirror ? job->mirror->url : job->url, "r", g_useragent);
+    if (!job->standby)
+    {
+      job->standby_retry = now + job->hedge;
+      return;
+    }
+    url_setnonblocking(job->standby, 1);
+    job->hedges++;
+
+    LOGWARN2(stdout, "Stream '%s' %s, opened a standby connection.\n",
+             job->url, job->slow_rate ? "is slow" : "stalled");
+    return;
+  }
+
+  if (!slow)
+  {
+    /* the stream recovered before the standby delivered */
+    (void)sg_job_close_stream(job, job->standby);
+    job->standby = NULL;
+    LOGINFO1(stdout, "Stream '%s' recovered, closed the standby connection.\n", job->url);
+  }
+  else if (url_fpeek(job->standby, iov, 1) > 0)
+  {
+    sg_job_switch(job);
+  }
+  else if (url_fended(job->standby))
+  {
+    /* standby failed as well, try again later */
+    (void)sg_job_close_stream(job, job->standby);
+    job->standby = NULL;
+    job->standby_retry = now + job->hedge;
+  }
+}
+
+/*
+ * Keep the other source of a --merge job receiving: (re)connect it when
+ * due and drop its oldest data beyond half its buffer, so it holds the
+ * last few seconds the recording can be continued from. Its frames are
+ * lined up with what was written by the dedup history when it takes over.
+ */
+static void sg_job_second(StreamgetJob *job)
+{
+  char *url = job->sources[!job->source];
+  URL_STAT stat;
+
+  if (!job->second)
+  {
+    if (!job->second_due)
+      return;
+    job->second_due = 0;
+
+    job->second = url_fopen(url, "r", g_useragent);
+    if (!job->second)
+    {
+      timer_set(&job->second_timer, url_clock() + job->reconnect_timeout);
+      return;
+    }
+    url_setnonblocking(job->second, 1);
+
+    LOGINFO2(stdout, "Stream '%s' second source '%s' opened.\n", job->url, url);
+    return;
+  }
+
+  if (url_fstat(job->second, &stat) == 0 && stat.buffered > stat.capacity / 2)
+    url_fconsume(job->second, stat.buffered - stat.capacity / 2);
+
+  if (url_feof(job->second))
+  {
+    (void)sg_job_close_stream(job, job->second);
+    job->second = NULL;
+    timer_set(&job->second_timer, url_clock() + job->reconnect_timeout);
 
-        /* update state */
-        if (0 == nwritten)
-          state = CONNECTED;
-        else
-          state = RECONNECTED;
+    LOGWARN2(stdout, "Stream '%s' second source '%s' lost.\n", job->url, url);
+  }
+}
 
-        sg_reset_countdown(&g_options);
+/*
+ * Boolean the source recorded from went quiet for MERGE_STALL msecs
+ * while the other one still delivers.
+ */
+static int sg_job_stalled(StreamgetJob *job)
+{
+  long long now = url_clock();
+  URL_STAT stat, other;
 
-        if (CONNECTED == state)
-        {
+  if (!job->second || url_fstat(job->handle, &stat) < 0 || url_fstat(job->second, &other) < 0)
+    return 0;
+  if (stat.buffered || now - stat.last_receive < MERGE_STALL || now - other.last_receive >= MERGE_STALL)
+    return 0;
 
-          /*
-           * Open output file late (when first data is about to be written,
-           * to prevent creating an empty file when the source is not yet active.
-           */
-          outfd = open(g_options.output, O_CREAT | O_WRONLY | O_APPEND, 00666);
-          if (outfd < 0)
-          {
-            LOGINFO2(stdout, "Error: couldn't open output file '%s'\n%s.\n",
-                     g_options.output, strerror(errno));
-            retval = 2;
-            goto exit;
-          }
-          if (!lockfd(outfd))
-          {
-            LOGINFO2(stdout, "Error: couldn't lock output file '%s'\n%s.\n",
-                     g_options.output, strerror(errno));
-            retval = 2;
-            goto exit;
-          }
-
-          /*
-           * Signal parent that recording has started by sending the CONT signal
-           */
-          kill(getppid(), SIGCONT);
-
-          /* start time-limit timer if required */
-          if (g_options.time_from_connect)
-          {
-            time_t now = time(0) + g_options.time_limit;
-
-            /* \n omitted intentionally, provided by ctime() */
-            LOGINFO2(stdout, "Starting time-limit timer of %d seconds, will expire at %s",
-                     g_options.time_limit, ctime(&now));
-            (void)sg_set_alarm(g_options.time_limit);
-          }
-        }
+  LOGWARN2(stdout, "Stream '%s' source '%s' stalled.\n", job->url, job->sources[job->source]);
+  return 1;
+}
+
+/*
+ * Advance the state machine of one job without blocking: (re)open the
+ * stream when it is time to, write whatever data arrived and notice
+ * when the stream ended.
+ */
+static void sg_job_step(StreamgetJob *job, time_t now)
+{
+  struct iovec iov[2]; /* borrowed from the stream buffer, no copy */
+  struct iovec frames[2];
+  struct iovec *data;
+  Mp3Scan scan;
+  int iovcnt = 0;
+  int datacnt = 0;
+  int nread = 0;
+  int nconsume = 0; /* bytes taken from the stream buffer */
+  unsigned long nframes;
+  size_t nreplayed;
+  int nwritten_now = 0; /* bytes written in one iteration of the loop */
+  struct timespec start, end; /* of a write, for the metrics */
+  long wait;
+  long long lost_at;
+  char *url;
+  URL_STAT stat;
+
+  job->blocked = 0;
+
+  if (DONE == job->state)
+    return;
+
+  if (job->sources[1])
+    sg_job_second(job);
+
+  /* open URL */
+  if (!job->handle)
+  {
+    if (job->expired)
+    {
+      sg_job_expire(job);
+      return;
+    }
+
+    /* the other source has what followed the loss, continue from it */
+    if (job->second && url_fstat(job->second, &stat) == 0 && stat.buffered)
+    {
+      job->handle = job->second;
+      job->second = NULL;
+      job->source = !job->source;
+      job->attempt_due = 0;
+      timer_cancel(&job->attempt);
+
+      /* the lost one becomes the second source */
+      timer_set(&job->second_timer, url_clock() + job->reconnect_timeout);
+
+      LOGINFO2(stdout, "Stream '%s' continues from source '%s'.\n", job->url, job->sources[job->source]);
+    }
+    else if (!job->attempt_due && !job->mirrors.started)
+      return;
+
+    /* wait for the turn of this stream when the host is busy with others */
+    wait = job->handle || job->mirrors.started ? 0 : bucket_take(job->bucket, url_clock());
+    if (wait)
+    {
+      job->attempt_due = 0;
+      timer_set(&job->attempt, url_clock() + wait);
+      return;
+    }
+
+    if (job->mirrors.count)
+    {
+      /* the race takes the attempts until there is a winner */
+      if (!sg_job_race(job))
+        return;
+    }
+    else if (!job->handle)
+    {
+      job->attempt_due = 0;
+      url = job->sources[1] ? job->sources[job->source] : sg_job_open_url(job);
+      job->via_direct = url != job->url;
+      job->handle = url_fopen(url, "r", g_useragent);
+      if (!job->handle)
+      {
+        job->direct_failures += job->via_direct;
+        sg_job_retry(job);
+        return;
       }
 
-      while (nread)
+      if (job->via_direct)
       {
-        if (nread != (nwritten_now = write(outfd, buffer, nread)))
-        {
-          LOGINFO2(stdout, "Error writing to file '%s' : %s.\n",
-                   g_options.output, strerror(errno));
-          retval = 4;
-          goto exit;
-        }
-        nwritten += nwritten_now;
-        nread = url_fread(buffer, 1, sizeof(buffer), handle);
+        LOGINFO2(stdout, "Stream '%s' reopened at the redirect target '%s'.\n", job->url, url);
+      }
+      else
+      {
+        LOGINFO2(stdout, "Stream '%s' %s.\n", job->url, job->nwritten ? "reopened" : "opened");
       }
     }
 
-    if (*countdown < 0 || --*countdown > 0)
+    /* a new connection starts anywhere in a frame */
+    job->stream_pos = 0;
+    job->sync.synced = 0;
+    job->rate_mark = 0;
+
+    /* and may start with audio written before the drop */
+    dedup_reconnect(&job->dedup);
+    seekindex_gap(&job->index);
+
+    /* set options */
+    url_setnonblocking(job->handle, 1);
+    if (g_options.verbose > 1)
+    {
+      url_setverbose(job->handle, g_options.verbose);
+    }
+  }
+
+  /* looking for a replay looks at all the data buffered at once */
+  while ((iovcnt = url_fpeek(job->handle, iov, job->dedup.matching ? (size_t)g_options.buffer_size : BUFFERSIZE)) > 0)
+  {
+    /* connected ahead of a scheduled start: keep the connection warm and
+       drop the data, the recording starts with what arrives after it */
+    if (job->warming)
+    {
+      sg_job_consume(job, sg_iovlen(iov, iovcnt));
+      job->sync.synced = 0;
+      continue;
+    }
+
+    data = iov;
+    datacnt = iovcnt;
+    nconsume = sg_iovlen(iov, iovcnt);
+
+    if (g_options.frame_sync)
     {
-      if (nwritten <= 0)
+      /* only whole frames, a partial frame stays in the stream buffer */
+      data = frames;
+      nconsume = mp3sync_scan(&job->sync, iov, iovcnt, frames, &datacnt, &scan);
+      if (0 == nconsume)
       {
-        if (CONNECTING != state)
+        /* the stream ended inside a frame, drop the partial frame */
+        if (url_fended(job->handle))
         {
-          LOGINFO1(stdout, "Stream '%s' not active.\n", g_options.url);
+          sg_job_consume(job, sg_iovlen(iov, iovcnt));
+          continue;
         }
-        /* update state */
-        state = CONNECTING;
-        sg_sleep(g_options.connect_timeout);
+        break;
       }
-      else
+      if (0 == datacnt)
+      {
+        mp3sync_commit(&job->sync, &scan);
+        sg_job_consume(job, nconsume);
+        continue;
+      }
+
+      /* drop the frames the server replayed after a reconnect. They are
+         only known to be a replay once they reach the last frame written,
+         until then they stay in the stream buffer */
+      if (job->dedup.matching)
       {
-        countdown = &g_options.reconnect_countdown;
-        if (RECONNECTING != state)
+        nreplayed = dedup_match(&job->dedup, frames, datacnt, &nframes);
+        if (nreplayed)
+        {
+          if (nreplayed < scan.bytes)
+            scan.lost = 0;
+          scan.bytes = nreplayed;
+          scan.frames = nframes;
+          mp3sync_commit(&job->sync, &scan);
+          sg_job_consume(job, scan.skipped + nreplayed);
+          continue;
+        }
+        if (job->dedup.matching)
         {
-          LOGINFO2(stdout, "Lost connection. Reconnecting (count=%d, timeout=%d)...\n",
-                   *countdown, g_options.reconnect_timeout);
+          /* wait for more, unless no more can come */
+          if (!job->expired && !url_fended(job->handle) && url_fstat(job->handle, &stat) == 0 &&
+              stat.capacity - stat.buffered >= BUFFERSIZE)
+            break;
+          dedup_giveup(&job->dedup);
         }
-        /* update state */
-        state = RECONNECTING;
-        sg_sleep(g_options.reconnect_timeout);
+        /* new audio, written as usual */
+        continue;
       }
     }
+    nread = sg_iovlen(data, datacnt);
+
+    if (CONNECTED != job->state && RECONNECTED != job->state)
+    {
+      if (sg_job_connected(job, now) < 0)
+        return;
+    }
+
+    /* cut the segment on the frame boundary in front of this data */
+    if (job->segment_end && now >= job->segment_end)
+    {
+      sg_job_close_output(job);
+      if (sg_job_open_segment(job, segment_start(now, g_options.segment)) < 0)
+        return;
+    }
+
+    /* write (or queue) straight from the stream buffer */
+    if (job->metrics)
+      clock_gettime(CLOCK_MONOTONIC, &start);
+    nwritten_now = output_writev(job->out, data, datacnt);
+    if (job->metrics)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      metrics_write(job->metrics, (end.tv_sec - start.tv_sec) * 1000000000LL +
+                                      (end.tv_nsec - start.tv_nsec));
+    }
+    if (0 == nwritten_now)
+    {
+      /* writer thread is behind, the stream buffer holds the data */
+      job->blocked = 1;
+      break;
+    }
+    if (nread != nwritten_now)
+    {
+      LOGERROR2(stdout, "Error writing to file '%s' : %s.\n",
+               job->path, strerror(errno));
+      job->retval = 4;
+      sg_job_finish(job);
+      return;
+    }
+    if (g_options.frame_sync)
+      mp3sync_commit(&job->sync, &scan);
+    if (g_options.dedup)
+      dedup_record(&job->dedup, data, datacnt);
+    if (g_options.segment)
+      job->segment_seconds += mp3_duration(data, datacnt);
+    if (g_options.writeback && !job->reserved)
+      sg_job_reserve(job, now);
+    if (g_options.index &&
+        seekindex_frames(&job->index, job->base_offset + job->nwritten, data, datacnt) < 0)
+    {
+      LOGERROR2(stdout, "Error writing to index file '%s.idx' : %s.\n",
+               job->path, strerror(errno));
+      seekindex_close(&job->index);
+    }
+    sg_job_consume(job, nconsume);
+    job->nwritten += nwritten_now;
+  }
+
+  if (g_options.icy)
+    sg_job_meta(job);
+
+  /* the data received before the time-limit expired is written now */
+  if (job->expired)
+  {
+    sg_job_expire(job);
+    return;
+  }
+
+  if (job->hedge && !job->blocked &&
+      (CONNECTED == job->state || RECONNECTED == job->state))
+  {
+    sg_job_hedge(job);
+  }
+
+  if (!job->blocked && (url_feof(job->handle) || sg_job_stalled(job)))
+  {
+    if (job->standby)
+    {
+      /* the standby is already connecting, no reconnect-timeout */
+      sg_job_switch(job);
+      return;
+    }
+    lost_at = sg_job_close_stream(job, job->handle);
+    job->handle = NULL;
+
+    /* a failed attempt doesn't move the time the stream was lost */
+    if (CONNECTED == job->state || RECONNECTED == job->state)
+      job->lost_at = lost_at;
     else
+      job->direct_failures += job->via_direct;
+    sg_job_retry(job);
+
+    /* fail over: race the others right away, the lost one ranks last */
+    if (job->mirror)
+    {
+      mirror_failed(job->mirror, url_clock());
+      job->mirror = NULL;
+      timer_set(&job->attempt, url_clock());
+    }
+
+    /* or continue from the other source right away */
+    if (job->second)
+      timer_set(&job->attempt, url_clock());
+  }
+}
+
+/*
+ * Set up the timers, reconnect pacing and history of a job about to run
+ * as stream index of the loop. A job doesn't move anymore after this.
+ * Returns 0 on success, -1 on error.
+ */
+static int sg_job_prepare(StreamgetJob *job, int index)
+{
+  timer_init(&job->limit, job, JOB_LIMIT);
+  timer_init(&job->attempt, job, JOB_ATTEMPT);
+  timer_init(&job->period, job, JOB_PERIOD);
+  timer_init(&job->second_timer, job, JOB_SECOND);
+  timer_init(&job->start, job, JOB_START);
+
+  backoff_init(&job->backoff, g_options.backoff, job->reconnect_timeout,
+               g_options.backoff_cap, (unsigned)url_clock() ^ (unsigned)getpid() ^ (unsigned)index);
+  job->bucket = bucket_get(job->url);
+
+  if (g_options.dedup && dedup_init(&job->dedup, g_options.dedup) < 0)
+  {
+    LOGERROR1(stdout, "Error: couldn't allocate the frame history\n%s.\n", strerror(errno));
+    return -1;
+  }
+  if (g_options.segment && playlist_init(&job->playlist, job->output, g_options.segment) < 0)
+  {
+    LOGERROR1(stdout, "Error: output '%s' is no strftime() pattern, needed for segments.\n",
+             job->output);
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * SIGTERM and SIGINT stop, SIGHUP reloads the schedule of the resident mode.
+ */
+static void sg_signal(int sig)
+{
+  if (SIGHUP == sig)
+    g_reload = 1;
+  else
+    g_stop = 1;
+}
+
+/*
+ * Find the next start of every recording of the schedule. A recording
+ * that started less than its duration ago is still due, it is recorded
+ * for the rest of its duration.
+ */
+static void sg_schedule_plan(time_t now)
+{
+  ScheduleEntry *entry;
+  int i;
+
+  for (i = 0; i < g_schedule.count; ++i)
+  {
+    entry = &g_schedule.entries[i];
+    entry->next = schedule_next(entry, now - entry->duration);
+  }
+}
+
+/*
+ * Launch the recordings of the schedule that start within the pre-warm
+ * time, each in a free one of the njobs slots in jobs. The stream is
+ * connected right away and the recording starts exactly at its start.
+ */
+static void sg_schedule_launch(StreamgetJob *jobs, int njobs, time_t now)
+{
+  ScheduleEntry *entry;
+  StreamgetJob *job;
+  char name[PATH_MAX];
+  char *url, *output, *old_url, *old_output;
+  struct timeval tv;
+  long long delay;
+  time_t start;
+  int i, j;
+
+  for (i = 0; i < g_schedule.count; ++i)
+  {
+    entry = &g_schedule.entries[i];
+    if (!entry->next || now < entry->next - (g_options.prewarm + 999) / 1000)
+      continue;
+    start = entry->next;
+    entry->next = schedule_next(entry, start);
+
+    if (now >= start + entry->duration)
+    {
+      LOGERROR2(stdout, "Missed the scheduled recording of '%s' to '%s'.\n", entry->url, entry->output);
+      continue;
+    }
+
+    /* segments are named by the pattern itself */
+    if (g_options.segment)
+      snprintf(name, sizeof(name), "%s", entry->output);
+    else if (segment_name(name, sizeof(name), entry->output, start) < 0)
+    {
+      LOGERROR1(stdout, "Error: output '%s' of the schedule is too long.\n", entry->output);
+      continue;
+    }
+
+    /* running already when the schedule was reloaded, else a free slot */
+    job = NULL;
+    for (j = 0; j < njobs; ++j)
+    {
+      if (DONE != jobs[j].state && jobs[j].scheduled == start &&
+          0 == strcmp(jobs[j].url, entry->url) && 0 == strcmp(jobs[j].output, name))
+        break;
+      if (!job && DONE == jobs[j].state)
+        job = &jobs[j];
+    }
+    if (j < njobs)
+      continue;
+    if (!job)
+    {
+      LOGERROR2(stdout, "Error: %d scheduled recordings running, skipped '%s'.\n", njobs, entry->url);
+      continue;
+    }
+
+    url = strdup(entry->url);
+    output = strdup(name);
+    if (!url || !output)
+    {
+      LOGERROR1(stdout, "Error: out of memory launching '%s'.\n", entry->url);
+      free(url);
+      free(output);
+      continue;
+    }
+
+    /* the strings of the slot's last recording, until the metrics let go */
+    old_url = job->url;
+    old_output = job->output;
+
+    sg_job_init(job, &g_options);
+    job->url = url;
+    job->output = output;
+    job->scheduled = start;
+    job->warming = 1;
+    job->time_limit = start + entry->duration - (now > start ? now : start);
+    if (g_options.metrics)
+      job->metrics = metrics_stream(job - jobs, url, output);
+    free(old_url);
+    free(old_output);
+
+    if (sg_job_prepare(job, job - jobs) < 0)
+    {
+      job->retval = 1;
+      sg_job_finish(job);
+      continue;
+    }
+
+    gettimeofday(&tv, NULL);
+    delay = (start - tv.tv_sec) * 1000LL - tv.tv_usec / 1000;
+    if (delay < 0)
+      delay = 0;
+    timer_set(&job->start, url_clock() + delay);
+    if (job->connect_period > 0)
+      timer_set(&job->period, url_clock() + job->connect_period);
+
+    LOGINFO3(stdout, "Scheduled recording of '%s' to '%s' connecting, starts in %lld msecs.\n",
+             url, output, delay);
+  }
+}
+
+/*
+ * Record all jobs from a single loop, all streams share one curl multi
+ * handle. Runs until every job is done (time limit, (re)connect period
+ * expired or error); in resident mode the jobs are slots the recordings
+ * of the schedule are launched in, and it runs until stopped.
+ * Returns the highest exit code of the jobs.
+ */
+static int sg_mainloop(StreamgetJob *jobs, int njobs)
+{
+  int retval = 0; /* assume success */
+  OutputPipelineStats stats;
+  OutputSyncStats sync;
+  size_t quarter = 0; /* high-water mark reported, in quarters of the queue */
+  unsigned long overdue = 0; /* late commits reported */
+  long timeout;
+  time_t now = time(0);
+  Timer *timer;
+  int active;
+  int i;
+
+  if (g_options.pipeline && output_pipeline_start(g_options.pipeline) < 0)
+  {
+    LOGERROR1(stdout, "Error: couldn't start writer thread\n%s.\n", strerror(errno));
+    return 1;
+  }
+
+  output_setwriteback((size_t)g_options.writeback * 1024);
+
+  if (g_options.sync && output_sync_start(g_options.sync) < 0)
+  {
+    LOGERROR1(stdout, "Error: couldn't start committer thread\n%s.\n", strerror(errno));
+    return 1;
+  }
+
+  if (g_options.io_uring && output_uring_start(g_options.io_uring) < 0)
+  {
+    LOGWARN1(stdout, "io_uring not available (%s), using write().\n", strerror(errno));
+  }
+
+  if (g_options.metrics)
+  {
+    if (metrics_start(g_options.metrics, njobs, sg_state_names,
+                      sizeof(sg_state_names) / sizeof(sg_state_names[0])) < 0)
     {
+      LOGERROR2(stdout, "Error: couldn't serve metrics on '%s'\n%s.\n", g_options.metrics, strerror(errno));
+      return 1;
+    }
+    for (i = 0; i < njobs; ++i)
+      jobs[i].metrics = metrics_stream(i, jobs[i].url, jobs[i].output);
+  }
+
+  bucket_setrate(g_options.host_rate, g_options.host_burst);
+
+  for (i = 0; i < njobs; ++i)
+  {
+    /* free slots of the resident mode are prepared when launched */
+    if (DONE != jobs[i].state && sg_job_prepare(&jobs[i], i) < 0)
+      return 1;
+  }
 
-      if (nwritten <= 0)
+  /* Start time-limit timer, if required, and the connect period */
+  for (i = 0; i < njobs; ++i)
+  {
+    if (DONE == jobs[i].state)
+      continue;
+    if (!jobs[i].time_from_connect)
+      sg_job_start_timer(&jobs[i], now);
+    if (jobs[i].connect_period > 0)
+      timer_set(&jobs[i].period, url_clock() + jobs[i].connect_period);
+  }
+
+  /* try until all jobs are done */
+  do
+  {
+    timeout = LOOP_TIMEOUT;
+    active = 0;
+    now = time(0);
+
+    while ((timer = timer_expire(url_clock())))
+      sg_job_timer(timer->data, timer->id);
+
+    if (g_options.schedule)
+    {
+      if (g_reload)
       {
-        LOGINFO2(stdout,
-                 "Connect period of %d seconds expired. "
-                 "Failed to open URL '%s'.\n",
-                 g_options.connect_period, g_options.url);
-        state = DONE;
+        g_reload = 0;
+        if (schedule_load(&g_schedule, g_options.schedule) < 0)
+        {
+          LOGWARN1(stdout, "Couldn't reload the schedule '%s', keeping the last one.\n", g_options.schedule);
+        }
+        else
+        {
+          LOGINFO2(stdout, "Reloaded the schedule '%s', %d recordings.\n", g_options.schedule, g_schedule.count);
+          sg_schedule_plan(now);
+        }
       }
-      else
+
+      if (!g_stop)
+        sg_schedule_launch(jobs, njobs, now);
+    }
+
+    /* stopped: write what was received and close as if the time-limit
+       expired, the teardown below flushes and syncs the outputs */
+    if (1 == g_stop)
+    {
+      g_stop = 2;
+      LOGINFO0(stdout, "Stopping, ending the recordings in progress.\n");
+      for (i = 0; i < njobs; ++i)
       {
-        LOGINFO2(stdout,
-                 "Reconnect period of %d seconds expired. "
-                 "Failed to open URL '%s'.\n",
-                 g_options.reconnect_period, g_options.url);
-        state = DONE;
+        if (DONE != jobs[i].state)
+          jobs[i].expired = 1;
       }
+    }
+
+    for (i = 0; i < njobs; ++i)
+    {
+      sg_job_step(&jobs[i], now);
+      sg_job_metrics(&jobs[i]);
+      if (DONE == jobs[i].state)
+        continue;
+
+      ++active;
+
+      if (jobs[i].blocked)
+        timeout = RETRY_TIMEOUT;
+
+      /* notice a stall within a fraction of the hedge time */
+      if (jobs[i].hedge && jobs[i].handle && jobs[i].hedge / 4 < timeout)
+        timeout = jobs[i].hedge / 4 > RETRY_TIMEOUT ? jobs[i].hedge / 4 : RETRY_TIMEOUT;
+    }
+
+    /* don't oversleep the next timer: a time-limit or (re)connect attempt */
+    timeout = timer_next(url_clock(), timeout);
+
+    /* submit the writes of this pass for all streams at once */
+    output_flush();
+
+    /* wait for data on any of the streams, or the next start */
+    if (active || (g_options.schedule && !g_stop))
+      url_fwait(timeout);
 
-      break; // stop recording
+    /* report the writer thread falling behind, every quarter of the queue */
+    if (output_pipeline_stats(&stats) && stats.highwater * 4 / stats.capacity > quarter)
+    {
+      quarter = stats.highwater * 4 / stats.capacity;
+      LOGWARN3(stdout, "Pipeline queue high-water mark %lu of %lu bytes (depth %lu).\n",
+               (unsigned long)stats.highwater, (unsigned long)stats.capacity,
+               (unsigned long)stats.depth);
+    }
+
+    /* report the disk not keeping up with the durability policy */
+    if (output_sync_stats(&sync) && sync.overdue > overdue)
+    {
+      overdue = sync.overdue;
+      LOGWARN3(stdout, "Sync took longer than %d msecs, %lld msecs of audio were at risk (%lu times).\n",
+               g_options.sync, sync.exposure_max, sync.overdue);
     }
+
+  } while (active || (g_options.schedule && !g_stop));
+
+  for (i = 0; i < njobs; ++i)
+  {
+    if (jobs[i].retval > retval)
+      retval = jobs[i].retval;
+  }
+
+  if (output_pipeline_stats(&stats))
+  {
+    LOGINFO3(stdout, "Pipeline queue high-water mark %lu of %lu bytes, %lu times full.\n",
+             (unsigned long)stats.highwater, (unsigned long)stats.capacity, stats.full);
   }
+  output_pipeline_stop();
+  output_uring_stop();
+  metrics_stop();
+  bucket_free();
+  url_cleanup();
 
-exit:
-  if (handle)
-    url_fclose(handle);
-  if (outfd > 0)
+  if (output_sync_stats(&sync))
   {
-    unlockfd(outfd);
-    close(outfd);
+    output_sync_stop();
+    (void)output_sync_stats(&sync);
+    LOGINFO5(stdout, "Sync: %lu commits in %lu rounds, latency %lld msecs max (%lld avg), %lld msecs most at risk.\n",
+             sync.commits, sync.rounds, sync.latency_max,
+             sync.commits ? sync.latency_total / (long long)sync.commits : 0LL, sync.exposure_max);
   }
+
   if (g_options.log)
     fclose(g_options.log);
   return retval;
 }
+
 /*
  * Main program
  * output to two test files (note the fgets method will corrupt binary files if
  * they contain 0 chars */
 int main(int argc, char *argv[])
 {
+  StreamgetJob single;
+  StreamgetJob *jobs = NULL;
+  int njobs = 0;
+  int retval;
+  int i;
+
   if (!sg_parse_options(argc, argv, &g_options))
   {
     sg_usage(stderr);
@@ -711,23 +2932,120 @@ int main(int argc, char *argv[])
     print_options(&g_options);
   }
 
-  if (!g_options.url)
+  if (g_options.schedule)
   {
-    fprintf(stderr, "Error: no URL specified.\n");
-    sg_usage(stderr);
-    exit(EXIT_FAILURE);
+    if (g_options.jobs || g_options.url || g_options.output || g_options.nmirrors || g_options.merge)
+    {
+      fprintf(stderr, "Error: --schedule can't be combined with --jobs, --url, --output, --mirror or --merge.\n");
+      sg_usage(stderr);
+      exit(EXIT_FAILURE);
+    }
+
+    if (schedule_load(&g_schedule, g_options.schedule) < 0)
+      exit(EXIT_FAILURE);
+    sg_schedule_plan(time(0));
+
+    /* slots the recordings run in, they don't move once the loop runs */
+    jobs = calloc(SCHEDULE_SLOTS, sizeof(StreamgetJob));
+    if (!jobs)
+    {
+      fprintf(stderr, "Error: out of memory for the scheduled recordings.\n");
+      exit(EXIT_FAILURE);
+    }
+    njobs = SCHEDULE_SLOTS;
+    for (i = 0; i < njobs; ++i)
+    {
+      sg_job_init(&jobs[i], &g_options);
+      jobs[i].state = DONE;
+    }
   }
-  if (!g_options.output)
+  else if (g_options.jobs)
   {
-    fprintf(stderr, "Error: no output file specified.\n");
-    sg_usage(stderr);
-    exit(EXIT_FAILURE);
+    if (g_options.url || g_options.output || g_options.nmirrors || g_options.merge)
+    {
+      fprintf(stderr, "Error: --jobs can't be combined with --url, --output, --mirror or --merge.\n");
+      sg_usage(stderr);
+      exit(EXIT_FAILURE);
+    }
+
+    njobs = sg_read_jobs(g_options.jobs, &jobs);
+    if (njobs <= 0)
+      exit(EXIT_FAILURE);
+  }
+  else
+  {
+    if (!g_options.url)
+    {
+      fprintf(stderr, "Error: no URL specified.\n");
+      sg_usage(stderr);
+      exit(EXIT_FAILURE);
+    }
+    if (!g_options.output)
+    {
+      fprintf(stderr, "Error: no output file specified.\n");
+      sg_usage(stderr);
+      exit(EXIT_FAILURE);
+    }
+
+    if (g_options.merge && (g_options.nmirrors || g_options.hedge))
+    {
+      fprintf(stderr, "Error: --merge can't be combined with --mirror or --hedge.\n");
+      sg_usage(stderr);
+      exit(EXIT_FAILURE);
+    }
+    if (g_options.merge && !g_options.dedup)
+      g_options.dedup = DEFAULT_MERGE_DEDUP;
+
+    /* the single recording given on the command line */
+    sg_job_init(&single, &g_options);
+    single.sources[0] = g_options.url;
+    single.sources[1] = g_options.merge;
+    jobs = &single;
+    njobs = 1;
+
+    for (i = 0; g_options.nmirrors && i <= g_options.nmirrors; ++i)
+    {
+      if (mirror_add(&single.mirrors, i ? g_options.mirrors[i - 1] : g_options.url) < 0)
+      {
+        fprintf(stderr, "Error: out of memory for the mirrors.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
   }
 
   /* daemonize if requested */
   if (g_options.daemonize)
     daemonize();
 
+  /* end the recordings in progress cleanly on SIGTERM/SIGINT, and reload
+     the schedule on SIGHUP when resident; no SA_RESTART, so the loop wakes
+     up for them */
+  {
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sg_signal;
+    sigemptyset(&action.sa_mask);
+    if (g_options.schedule)
+      sigaction(SIGHUP, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+  }
+
+  /* size the receive buffer once, it is reused for the whole recording */
+  url_setbuffersize(g_options.buffer_size);
+  url_seticy(g_options.icy);
+
+  /* log from a thread of its own, a slow log doesn't hold up the recording */
+  if (logger_start() < 0)
+  {
+    LOGWARN1(stdout, "Couldn't start the log thread (%s), logging directly.\n", strerror(errno));
+  }
+
   /* we got the parameters, get going... */
-  return sg_mainloop();
+  retval = sg_mainloop(jobs, njobs);
+  schedule_free(&g_schedule);
+
+  logger_stop();
+  return retval;
 }
@@ -0,0 +1,361 @@
+/*
+ * Live metrics of the recordings, see metrics.h.
+ *
+ * The listener thread answers every request on the socket with the
+ * metrics of all streams (any path, so both "/metrics" and "/" work)
+ * and closes the connection. Scrapes are served one at a time.
+ */
+
+#define _GNU_SOURCE /* open_memstream() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include "metrics.h"
+
+/* (sec) a scraper gets to send its request */
+#define REQUEST_TIMEOUT (2)
+
+static MetricsStream *g_streams = NULL;
+static int g_nstreams = 0;
+static const char *const *g_states;
+static int g_nstates;
+static int g_listener = -1;
+static char g_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static pthread_t g_thread;
+static const long long g_bounds[METRICS_NBUCKETS] = METRICS_WRITE_BUCKETS;
+/* held by a scrape and while a stream is (re)labelled */
+static pthread_mutex_t g_labels = PTHREAD_MUTEX_INITIALIZER;
+
+/* a label value, with backslash, quote and newline escaped */
+static void put_label(FILE *f, const char *name, const char *value)
+{
+  fprintf(f, "%s=\"", name);
+  for (; *value; ++value)
+  {
+    if ('\\' == *value || '"' == *value)
+      fputc('\\', f);
+    if ('\n' == *value)
+      fputs("\\n", f);
+    else
+      fputc(*value, f);
+  }
+  fputc('"', f);
+}
+
+static void put_labels(FILE *f, const MetricsStream *m)
+{
+  put_label(f, "url", m->url);
+  fputc(',', f);
+  put_label(f, "output", m->output);
+}
+
+/* one metric with a value per stream, the field at offset divided by scale */
+static void put_metric(FILE *f, const char *name, const char *type, const char *help,
+                       size_t offset, double scale)
+{
+  unsigned long long value;
+  int i;
+
+  fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+  for (i = 0; i < g_nstreams; ++i)
+  {
+    if (!g_streams[i].url)
+      continue;
+    value = atomic_load_explicit((atomic_ullong *)((char *)&g_streams[i] + offset),
+                                 memory_order_relaxed);
+    fprintf(f, "%s{", name);
+    put_labels(f, &g_streams[i]);
+    if (1 == scale)
+      fprintf(f, "} %llu\n", value);
+    else
+      fprintf(f, "} %.3f\n", value / scale);
+  }
+}
+
+static void put_metrics(FILE *f)
+{
+  unsigned long long count;
+  int i, j, state;
+
+  put_metric(f, "streamget_received_bytes_total", "counter",
+             "Bytes received from the stream.", offsetof(MetricsStream, received), 1);
+  put_metric(f, "streamget_written_bytes_total", "counter",
+             "Bytes written to the output.", offsetof(MetricsStream, written), 1);
+  put_metric(f, "streamget_reconnects_total", "counter",
+             "Times recording resumed after the stream was lost.", offsetof(MetricsStream, reconnects), 1);
+  put_metric(f, "streamget_last_reconnect_gap_seconds", "gauge",
+             "Time without data of the last reconnect.", offsetof(MetricsStream, gap), 1000);
+  put_metric(f, "streamget_last_reconnect_ttfb_seconds", "gauge",
+             "Time from opening the connection of the last reconnect to its first data.",
+             offsetof(MetricsStream, ttfb), 1000);
+  put_metric(f, "streamget_receive_rate_bytes_per_second", "gauge",
+             "Bytes per second received over the last second.", offsetof(MetricsStream, rate), 1);
+  put_metric(f, "streamget_buffer_bytes", "gauge",
+             "Bytes waiting in the receive buffer.", offsetof(MetricsStream, buffered), 1);
+  put_metric(f, "streamget_buffer_capacity_bytes", "gauge",
+             "Size of the receive buffer.", offsetof(MetricsStream, capacity), 1);
+
+  fprintf(f, "# HELP streamget_state Current state of the recording.\n"
+             "# TYPE streamget_state gauge\n");
+  for (i = 0; i < g_nstreams; ++i)
+  {
+    if (!g_streams[i].url)
+      continue;
+    state = atomic_load_explicit(&g_streams[i].state, memory_order_relaxed);
+    for (j = 0; j < g_nstates; ++j)
+    {
+      fprintf(f, "streamget_state{");
+      put_labels(f, &g_streams[i]);
+      fprintf(f, ",state=\"%s\"} %d\n", g_states[j], j == state);
+    }
+  }
+
+  fprintf(f, "# HELP streamget_write_seconds Time to write (or queue) data to the output.\n"
+             "# TYPE streamget_write_seconds histogram\n");
+  for (i = 0; i < g_nstreams; ++i)
+  {
+    MetricsStream *m = &g_streams[i];
+
+    if (!m->url)
+      continue;
+    count = 0;
+    for (j = 0; j <= METRICS_NBUCKETS; ++j)
+    {
+      count += atomic_load_explicit(&m->write_buckets[j], memory_order_relaxed);
+      fprintf(f, "streamget_write_seconds_bucket{");
+      put_labels(f, m);
+      if (j < METRICS_NBUCKETS)
+        fprintf(f, ",le=\"%g\"} %llu\n", g_bounds[j] / 1e9, count);
+      else
+        fprintf(f, ",le=\"+Inf\"} %llu\n", count);
+    }
+    fprintf(f, "streamget_write_seconds_sum{");
+    put_labels(f, m);
+    fprintf(f, "} %.9f\n", atomic_load_explicit(&m->write_sum, memory_order_relaxed) / 1e9);
+    fprintf(f, "streamget_write_seconds_count{");
+    put_labels(f, m);
+    fprintf(f, "} %llu\n", count);
+  }
+}
+
+/* answer one scrape */
+static void serve(int fd)
+{
+  struct timeval timeout = {REQUEST_TIMEOUT, 0};
+  char request[1024];
+  size_t len = 0;
+  size_t size = 0;
+  char *body = NULL;
+  char header[128];
+  ssize_t n;
+  FILE *f;
+
+  /* read the request up to the empty line, its content doesn't matter */
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  while (len < sizeof(request) - 1 &&
+         (n = recv(fd, request + len, sizeof(request) - 1 - len, 0)) > 0)
+  {
+    len += n;
+    request[len] = '\0';
+    if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+      break;
+  }
+
+  f = open_memstream(&body, &size);
+  if (!f)
+    return;
+  pthread_mutex_lock(&g_labels);
+  put_metrics(f);
+  pthread_mutex_unlock(&g_labels);
+  fclose(f);
+
+  n = snprintf(header, sizeof(header),
+               "HTTP/1.0 200 OK\r\n"
+               "Content-Type: text/plain; version=0.0.4\r\n"
+               "Content-Length: %lu\r\n\r\n",
+               (unsigned long)size);
+  if (send(fd, header, n, MSG_NOSIGNAL) == n)
+  {
+    for (len = 0; len < size; len += n)
+    {
+      n = send(fd, body + len, size - len, MSG_NOSIGNAL);
+      if (n <= 0)
+        break;
+    }
+  }
+  free(body);
+}
+
+static void *metrics_listener(void *arg)
+{
+  int fd;
+
+  for (;;)
+  {
+    fd = accept(g_listener, NULL, NULL);
+    if (fd < 0)
+    {
+      if (EINTR == errno || ECONNABORTED == errno)
+        continue;
+      break; /* shut down by metrics_stop() */
+    }
+    serve(fd);
+    close(fd);
+  }
+
+  return arg;
+}
+
+/*
+ * Listen on address, a TCP port on localhost or the path of a unix
+ * socket (anything with a '/'), and serve the metrics of nstreams
+ * streams. states names the values of the state of a stream.
+ * Returns 0 on success, -1 (with errno set) on error.
+ */
+int metrics_start(const char *address, int nstreams, const char *const *states, int nstates)
+{
+  struct sockaddr_un sun;
+  struct sockaddr_in sin;
+  int one = 1;
+  int error;
+
+  g_streams = calloc(nstreams, sizeof(MetricsStream));
+  if (!g_streams)
+    return -1;
+  g_nstreams = nstreams;
+  g_states = states;
+  g_nstates = nstates;
+
+  if (strchr(address, '/'))
+  {
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen(address) >= sizeof(sun.sun_path))
+    {
+      errno = ENAMETOOLONG;
+      goto fail;
+    }
+    strcpy(sun.sun_path, address);
+    unlink(address); /* left by an earlier run */
+    g_listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (g_listener < 0 || bind(g_listener, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+      goto fail;
+    strcpy(g_path, address);
+  }
+  else
+  {
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons(atoi(address));
+    g_listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (g_listener < 0)
+      goto fail;
+    setsockopt(g_listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(g_listener, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+      goto fail;
+  }
+
+  if (listen(g_listener, 16) < 0)
+    goto fail;
+
+  errno = pthread_create(&g_thread, NULL, metrics_listener, NULL);
+  if (errno)
+    goto fail;
+
+  return 0;
+
+fail:
+  error = errno;
+  if (g_listener >= 0)
+    close(g_listener);
+  g_listener = -1;
+  if (g_path[0])
+    unlink(g_path);
+  g_path[0] = '\0';
+  free(g_streams);
+  g_streams = NULL;
+  g_nstreams = 0;
+  errno = error;
+  return -1;
+}
+
+/* stop serving, after the recording loop has ended */
+void metrics_stop(void)
+{
+  if (g_listener < 0)
+    return;
+
+  shutdown(g_listener, SHUT_RDWR);
+  pthread_join(g_thread, NULL);
+  close(g_listener);
+  g_listener = -1;
+
+  if (g_path[0])
+    unlink(g_path);
+  g_path[0] = '\0';
+
+  free(g_streams);
+  g_streams = NULL;
+  g_nstreams = 0;
+}
+
+/*
+ * The metrics of stream index, labelled with its url and output (which
+ * must stay valid until the stream is labelled again). Labelling a stream
+ * again starts its values over, a NULL url leaves it out of scrapes.
+ * Returns NULL when metrics are not served.
+ */
+MetricsStream *metrics_stream(int index, const char *url, const char *output)
+{
+  MetricsStream *m;
+  int i;
+
+  if (index < 0 || index >= g_nstreams)
+    return NULL;
+
+  m = &g_streams[index];
+  pthread_mutex_lock(&g_labels);
+  if (m->url)
+  {
+    metrics_set(&m->received, 0);
+    metrics_set(&m->written, 0);
+    atomic_store_explicit(&m->state, 0, memory_order_relaxed);
+    metrics_set(&m->reconnects, 0);
+    metrics_set(&m->gap, 0);
+    metrics_set(&m->ttfb, 0);
+    metrics_set(&m->rate, 0);
+    metrics_set(&m->buffered, 0);
+    metrics_set(&m->capacity, 0);
+    for (i = 0; i <= METRICS_NBUCKETS; ++i)
+      metrics_set(&m->write_buckets[i], 0);
+    metrics_set(&m->write_sum, 0);
+  }
+  m->url = url;
+  m->output = output;
+  pthread_mutex_unlock(&g_labels);
+  return m;
+}
+
+/* account a write to the output that took nsecs */
+void metrics_write(MetricsStream *m, long long nsecs)
+{
+  int i;
+
+  for (i = 0; i < METRICS_NBUCKETS && nsecs > g_bounds[i]; ++i)
+    ;
+  metrics_set(&m->write_buckets[i],
+              atomic_load_explicit(&m->write_buckets[i], memory_order_relaxed) + 1);
+  metrics_set(&m->write_sum,
+              atomic_load_explicit(&m->write_sum, memory_order_relaxed) + nsecs);
+}
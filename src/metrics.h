@@ -0,0 +1,51 @@
+/*
+ * Include file for metrics.c
+ *
+ * Live metrics of the recordings in the Prometheus text format, served
+ * by a thread of its own on a localhost TCP port or a unix socket. The
+ * recording loop is the only writer of a stream's metrics and updates
+ * them with plain relaxed atomic stores, no locks and no read-modify-
+ * write; a scrape reads whatever the values are at that moment. Only
+ * (re)labelling a stream waits for a scrape in progress.
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include "atomics.h"
+
+/* upper bounds of the write latency histogram buckets, in nsecs */
+#define METRICS_WRITE_BUCKETS \
+  {10000, 50000, 100000, 500000, 1000000, 5000000, 10000000, 50000000, 100000000, 500000000, 1000000000}
+#define METRICS_NBUCKETS (11)
+
+typedef struct
+{
+  const char *url;
+  const char *output;
+  atomic_ullong received;   /* bytes received from the stream */
+  atomic_ullong written;    /* bytes written to the output */
+  atomic_int state;         /* index into the state names */
+  atomic_ullong reconnects; /* recording resumed after losing the stream */
+  atomic_ullong gap;        /* (msec) of the last reconnect, no data in between */
+  atomic_ullong ttfb;       /* (msec) from opening the connection of the last reconnect to its first data */
+  atomic_ullong rate;       /* (bytes/sec) received over the last second */
+  atomic_ullong buffered;   /* bytes in the receive buffer */
+  atomic_ullong capacity;   /* size of the receive buffer */
+  atomic_ullong write_buckets[METRICS_NBUCKETS + 1]; /* last one is +Inf */
+  atomic_ullong write_sum;  /* (nsec) of all writes */
+} MetricsStream;
+
+/* API prototypes */
+int metrics_start(const char *address, int nstreams, const char *const *states, int nstates);
+void metrics_stop(void);
+MetricsStream *metrics_stream(int index, const char *url, const char *output);
+void metrics_write(MetricsStream *m, long long nsecs);
+
+/* update a value only the recording loop writes */
+static inline void metrics_set(atomic_ullong *value, unsigned long long v)
+{
+  atomic_store_explicit(value, v, memory_order_relaxed);
+}
+
+#endif /* _METRICS_H_ */
@@ -0,0 +1,108 @@
+/*
+ * Mirrors of a stream, see mirror.h.
+ *
+ * The list is ranked when a race starts, so a mirror that failed during
+ * the last race is tried last in the next one.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mirror.h"
+
+/* the list being ranked, for the comparison */
+static const MirrorList *g_ranking;
+
+static int compare(const void *a, const void *b)
+{
+  const Mirror *x = &g_ranking->mirror[*(const int *)a];
+  const Mirror *y = &g_ranking->mirror[*(const int *)b];
+
+  if (x->failures != y->failures)
+    return x->failures < y->failures ? -1 : 1;
+  if (x->failed_at != y->failed_at)
+    return x->failed_at < y->failed_at ? -1 : 1;
+  if (x->ttfb >= 0 && y->ttfb >= 0 && x->ttfb != y->ttfb)
+    return x->ttfb < y->ttfb ? -1 : 1;
+
+  /* the order given */
+  return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * Append url to the list.
+ * Returns 0 on success, -1 when out of memory.
+ */
+int mirror_add(MirrorList *l, const char *url)
+{
+  Mirror *mirror = realloc(l->mirror, (l->count + 1) * sizeof(Mirror));
+  int *order;
+
+  if (!mirror)
+    return -1;
+  l->mirror = mirror;
+
+  order = realloc(l->order, (l->count + 1) * sizeof(int));
+  if (!order)
+    return -1;
+  l->order = order;
+
+  mirror += l->count;
+  memset(mirror, 0, sizeof(Mirror));
+  mirror->url = strdup(url);
+  if (!mirror->url)
+    return -1;
+  mirror->ttfb = -1;
+  l->order[l->count] = l->count;
+  l->count++;
+  return 0;
+}
+
+/*
+ * The next mirror to open in the race, the first call ranks them.
+ * Returns NULL once all were opened.
+ */
+Mirror *mirror_next(MirrorList *l)
+{
+  if (!l->started)
+  {
+    g_ranking = l;
+    qsort(l->order, l->count, sizeof(int), compare);
+  }
+
+  if (l->started == l->count)
+    return NULL;
+  return &l->mirror[l->order[l->started++]];
+}
+
+/* the race is over, the next one starts with a new ranking */
+void mirror_reset(MirrorList *l)
+{
+  l->started = 0;
+}
+
+/* the mirror didn't deliver, or its connection was lost at now (msec) */
+void mirror_failed(Mirror *m, long long now)
+{
+  m->failures++;
+  m->failed_at = now;
+}
+
+/* the mirror won a race, its first data came ttfb msecs after the open */
+void mirror_won(Mirror *m, long ttfb)
+{
+  m->failures = 0;
+  m->ttfb = ttfb;
+}
+
+/* free the list, the connections were closed already */
+void mirror_free(MirrorList *l)
+{
+  int i;
+
+  for (i = 0; i < l->count; ++i)
+    free(l->mirror[i].url);
+  free(l->mirror);
+  free(l->order);
+  memset(l, 0, sizeof(*l));
+}
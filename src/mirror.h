@@ -0,0 +1,41 @@
+/*
+ * Include file for mirror.c
+ *
+ * Equivalent urls of one stream. A (re)connect races them: they are
+ * opened one after the other, a stagger apart, best ranked first, and
+ * the first to deliver data is recorded from. A mirror ranks lower the
+ * more often in a row it failed, and among equals the more recently it
+ * failed and the slower its last first data was.
+ */
+
+#ifndef _MIRROR_H_
+#define _MIRROR_H_
+
+#include "url_fopen.h"
+
+typedef struct
+{
+  char *url;
+  URL_FILE *handle;    /* its connection in the current race, NULL if none */
+  int failures;        /* attempts failed and connections lost in a row */
+  long long failed_at; /* (msec, url_clock()) of the last failure, 0 if none */
+  long ttfb;           /* (msec) to the first data when it last won, -1 if never */
+} Mirror;
+
+typedef struct
+{
+  Mirror *mirror; /* in the order given */
+  int count;
+  int *order;     /* indices of mirror, best first */
+  int started;    /* of order, opened in the current race */
+} MirrorList;
+
+/* API prototypes */
+int mirror_add(MirrorList *l, const char *url);
+Mirror *mirror_next(MirrorList *l);
+void mirror_reset(MirrorList *l);
+void mirror_failed(Mirror *m, long long now);
+void mirror_won(Mirror *m, long ttfb);
+void mirror_free(MirrorList *l);
+
+#endif /* _MIRROR_H_ */
@@ -0,0 +1,463 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "mp3frame.h"
+
+/* kbit/s by [MPEG 1 / MPEG 2(.5)][layer - 1][index] */
+static const short bitrates[2][3][15] =
+{
+  {
+    { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+    { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+    { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 }
+  },
+  {
+    { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+    { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+    { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }
+  }
+};
+
+/* Hz by [MPEG 1 / 2 / 2.5][index] */
+static const int samplerates[3][3] =
+{
+  { 44100, 48000, 32000 },
+  { 22050, 24000, 16000 },
+  { 11025, 12000, 8000 }
+};
+
+/*
+ * Parse the 4 byte frame header at p. Free format (bitrate index 0)
+ * and the reserved values are rejected, so a random 0xFFE sync word
+ * in the audio data is less likely to pass.
+ * Returns 1 and fills in header if it is valid, 0 otherwise.
+ */
+int mp3_parse_header(const unsigned char *p, Mp3Header *header)
+{
+  int version_bits, layer_bits, bitrate_index, samplerate_index;
+  int mpeg, kbps;
+
+  if (p[0] != 0xFF || (p[1] & 0xE0) != 0xE0)
+    return 0;
+
+  version_bits = (p[1] >> 3) & 0x03;
+  layer_bits = (p[1] >> 1) & 0x03;
+  bitrate_index = (p[2] >> 4) & 0x0F;
+  samplerate_index = (p[2] >> 2) & 0x03;
+
+  if (version_bits == 1 || layer_bits == 0 ||
+      bitrate_index == 0 || bitrate_index == 15 ||
+      samplerate_index == 3 || (p[3] & 0x03) == 2)
+    return 0;
+
+  /* 0: MPEG 1, 1: MPEG 2, 2: MPEG 2.5 */
+  mpeg = version_bits == 3 ? 0 : version_bits == 2 ? 1 : 2;
+
+  header->version = mpeg == 0 ? 10 : mpeg == 1 ? 20 : 25;
+  header->layer = 4 - layer_bits;
+  kbps = bitrates[mpeg ? 1 : 0][header->layer - 1][bitrate_index];
+  header->bitrate = kbps * 1000;
+  header->samplerate = samplerates[mpeg][samplerate_index];
+  header->padding = (p[2] >> 1) & 0x01;
+  header->channels = ((p[3] >> 6) & 0x03) == 3 ? 1 : 2;
+
+  if (header->layer == 1)
+  {
+    header->samples = 384;
+    header->length = (12 * header->bitrate / header->samplerate + header->padding) * 4;
+  }
+  else if (header->layer == 3 && mpeg)
+  {
+    header->samples = 576;
+    header->length = 72 * header->bitrate / header->samplerate + header->padding;
+  }
+  else
+  {
+    header->samples = 1152;
+    header->length = 144 * header->bitrate / header->samplerate + header->padding;
+  }
+
+  return 1;
+}
+
+/*
+ * Vectorised scans for the 11 bit sync word: a 0xFF byte followed by
+ * a byte with its top 3 bits set. Each compares a block with the same
+ * block shifted by one byte, so every candidate pair is tested at once.
+ * They return the offset of the first match within the blocks scanned
+ * and set *scanned to the number of positions covered.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+
+__attribute__((target("avx2")))
+static size_t find_sync_avx2(const unsigned char *p, size_t len, size_t *scanned)
+{
+  const __m256i ff = _mm256_set1_epi8((char)0xFF);
+  const __m256i e0 = _mm256_set1_epi8((char)0xE0);
+  size_t i;
+
+  for (i = 0; i + 33 <= len; i += 32)
+  {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 1));
+    __m256i m = _mm256_and_si256(_mm256_cmpeq_epi8(a, ff),
+                                 _mm256_cmpeq_epi8(_mm256_and_si256(b, e0), e0));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(m);
+
+    if (mask)
+    {
+      *scanned = i;
+      return i + __builtin_ctz(mask);
+    }
+  }
+
+  *scanned = i;
+  return len;
+}
+
+__attribute__((target("sse2")))
+static size_t find_sync_sse2(const unsigned char *p, size_t len, size_t *scanned)
+{
+  const __m128i ff = _mm_set1_epi8((char)0xFF);
+  const __m128i e0 = _mm_set1_epi8((char)0xE0);
+  size_t i;
+
+  for (i = 0; i + 17 <= len; i += 16)
+  {
+    __m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + i + 1));
+    __m128i m = _mm_and_si128(_mm_cmpeq_epi8(a, ff),
+                              _mm_cmpeq_epi8(_mm_and_si128(b, e0), e0));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(m);
+
+    if (mask)
+    {
+      *scanned = i;
+      return i + __builtin_ctz(mask);
+    }
+  }
+
+  *scanned = i;
+  return len;
+}
+
+typedef size_t (*find_sync_fn)(const unsigned char *, size_t, size_t *);
+
+static find_sync_fn find_sync_vector(void)
+{
+  static find_sync_fn fn = NULL;
+
+  if (!fn)
+  {
+    __builtin_cpu_init();
+    fn = __builtin_cpu_supports("avx2") ? find_sync_avx2 : find_sync_sse2;
+  }
+  return fn;
+}
+
+#define FIND_SYNC_VECTOR(p, len, scanned) (find_sync_vector()((p), (len), (scanned)))
+
+#elif defined(__ARM_NEON)
+
+static size_t find_sync_neon(const unsigned char *p, size_t len, size_t *scanned)
+{
+  const uint8x16_t ff = vdupq_n_u8(0xFF);
+  const uint8x16_t e0 = vdupq_n_u8(0xE0);
+  size_t i, j;
+
+  for (i = 0; i + 17 <= len; i += 16)
+  {
+    uint8x16_t a = vld1q_u8(p + i);
+    uint8x16_t b = vld1q_u8(p + i + 1);
+    uint8x16_t m = vandq_u8(vceqq_u8(a, ff), vceqq_u8(vandq_u8(b, e0), e0));
+    uint64x2_t m64 = vreinterpretq_u64_u8(m);
+
+    if (vgetq_lane_u64(m64, 0) | vgetq_lane_u64(m64, 1))
+    {
+      for (j = 0; j < 16; ++j)
+        if (p[i + j] == 0xFF && (p[i + j + 1] & 0xE0) == 0xE0)
+          break;
+      *scanned = i;
+      return i + j;
+    }
+  }
+
+  *scanned = i;
+  return len;
+}
+
+#define FIND_SYNC_VECTOR(p, len, scanned) find_sync_neon((p), (len), (scanned))
+
+#endif
+
+/*
+ * Find the first frame sync word in p[0..len). The byte following the
+ * 0xFF must be within the range, so the last byte is never a match.
+ * Returns its offset, or len if there is none.
+ */
+size_t mp3_find_sync(const unsigned char *p, size_t len)
+{
+  size_t i = 0;
+
+  if (len < 2)
+    return len;
+
+#ifdef FIND_SYNC_VECTOR
+  {
+    size_t found = FIND_SYNC_VECTOR(p, len, &i);
+    if (found < len)
+      return found;
+  }
+#endif
+
+  for (; i + 1 < len; ++i)
+    if (p[i] == 0xFF && (p[i + 1] & 0xE0) == 0xE0)
+      return i;
+
+  return len;
+}
+
+void mp3sync_reset(Mp3Sync *sync)
+{
+  memset(sync, 0, sizeof(*sync));
+}
+
+/*
+ * The input of the stage is a byte range given as up to two iovecs,
+ * as returned by url_fpeek(). Frames may straddle the two.
+ */
+static void copy_range(const struct iovec *in, int incnt, size_t offset,
+                       unsigned char *dst, size_t len)
+{
+  int i;
+
+  for (i = 0; i < incnt && len; ++i)
+  {
+    size_t n;
+
+    if (offset >= in[i].iov_len)
+    {
+      offset -= in[i].iov_len;
+      continue;
+    }
+    n = in[i].iov_len - offset;
+    if (n > len)
+      n = len;
+    memcpy(dst, (const char *)in[i].iov_base + offset, n);
+    dst += n;
+    len -= n;
+    offset = 0;
+  }
+}
+
+static int header_at(const struct iovec *in, int incnt, size_t total,
+                     size_t offset, Mp3Header *header)
+{
+  unsigned char p[MP3_HEADER_SIZE];
+
+  if (offset + MP3_HEADER_SIZE > total)
+    return 0;
+  copy_range(in, incnt, offset, p, MP3_HEADER_SIZE);
+  return mp3_parse_header(p, header);
+}
+
+/*
+ * Parse the header of the frame at offset in a run of whole frames, as
+ * passed on by mp3sync_scan().
+ * Returns 1 if there is a valid header, 0 otherwise.
+ */
+int mp3_frame_at(const struct iovec *in, int incnt, size_t offset, Mp3Header *header)
+{
+  size_t total = 0;
+  int i;
+
+  for (i = 0; i < incnt; ++i)
+    total += in[i].iov_len;
+
+  return header_at(in, incnt, total, offset, header);
+}
+
+/*
+ * Playing time in seconds of a run of whole frames.
+ */
+double mp3_duration(const struct iovec *in, int incnt)
+{
+  size_t total = 0, offset = 0;
+  double seconds = 0;
+  Mp3Header header;
+  int i;
+
+  for (i = 0; i < incnt; ++i)
+    total += in[i].iov_len;
+
+  while (offset < total && header_at(in, incnt, total, offset, &header))
+  {
+    seconds += (double)header.samples / header.samplerate;
+    offset += header.length;
+  }
+
+  return seconds;
+}
+
+/* frames of one stream share version, layer and sample rate */
+static int same_stream(const Mp3Header *a, const Mp3Header *b)
+{
+  return a->version == b->version && a->layer == b->layer &&
+         a->samplerate == b->samplerate;
+}
+
+/*
+ * Offset of the first sync word at or after offset, or total if there
+ * is none. The pair straddling the two iovecs is checked separately.
+ */
+static size_t find_sync_iov(const struct iovec *in, int incnt, size_t total,
+                            size_t offset)
+{
+  size_t len0 = incnt > 0 ? in[0].iov_len : 0;
+  const unsigned char *p0 = incnt > 0 ? in[0].iov_base : NULL;
+  const unsigned char *p1 = incnt > 1 ? in[1].iov_base : NULL;
+  size_t found;
+
+  if (offset < len0)
+  {
+    found = offset + mp3_find_sync(p0 + offset, len0 - offset);
+    if (found < len0)
+      return found;
+    if (incnt > 1 && in[1].iov_len && p0[len0 - 1] == 0xFF && (p1[0] & 0xE0) == 0xE0)
+      return len0 - 1;
+    offset = len0;
+  }
+  if (incnt > 1 && offset < total)
+    return offset + mp3_find_sync(p1 + offset - len0, total - offset);
+
+  return total;
+}
+
+/*
+ * Look for whole frames at the front of the input. A run of frames is
+ * passed to out (at most two iovecs into the input, no copy is made);
+ * bytes in front of it that are no frame are skipped. A partial frame
+ * at the end is left in place until more data arrives, so the caller
+ * only consumes the bytes returned.
+ * When not synchronised, a frame is only accepted if the header of the
+ * frame following it is valid as well.
+ * The stage state is not changed; call mp3sync_commit() with the scan
+ * once the frames have been passed on.
+ * Returns the number of input bytes handled (skipped plus passed).
+ */
+size_t mp3sync_scan(const Mp3Sync *sync, const struct iovec *in, int incnt,
+                    struct iovec out[2], int *outcnt, Mp3Scan *scan)
+{
+  size_t total = 0, pos = 0, start, end, len0;
+  Mp3Header header, next, ref;
+  int i;
+
+  for (i = 0; i < incnt; ++i)
+    total += in[i].iov_len;
+
+  memset(scan, 0, sizeof(*scan));
+  *outcnt = 0;
+
+  if (sync->synced)
+  {
+    ref = sync->last;
+    if (!header_at(in, incnt, total, 0, &header) || !same_stream(&header, &ref))
+    {
+      /* need a whole header to tell */
+      if (total < MP3_HEADER_SIZE)
+        return 0;
+      scan->lost = 1;
+      scan->skipped = 1;
+      return 1;
+    }
+  }
+  else
+  {
+    for (;;)
+    {
+      pos = find_sync_iov(in, incnt, total, pos);
+      if (pos + MP3_HEADER_SIZE > total)
+      {
+        /* keep a possible start of a sync word */
+        scan->skipped = total ? (pos < total ? pos : total - 1) : 0;
+        return scan->skipped;
+      }
+      if (header_at(in, incnt, total, pos, &header))
+      {
+        if (pos + header.length + MP3_HEADER_SIZE > total)
+        {
+          /* wait for the next header to confirm this one */
+          scan->skipped = pos;
+          return pos;
+        }
+        if (header_at(in, incnt, total, pos + header.length, &next) &&
+            same_stream(&header, &next))
+          break;
+      }
+      ++pos;
+    }
+    ref = header;
+  }
+
+  start = pos;
+  while (pos + MP3_HEADER_SIZE <= total)
+  {
+    if (!header_at(in, incnt, total, pos, &header) || !same_stream(&header, &ref))
+    {
+      scan->lost = 1;
+      break;
+    }
+    if (pos + header.length > total)
+      break;
+    pos += header.length;
+    scan->frames++;
+    scan->last = header;
+  }
+
+  scan->skipped = start;
+  scan->bytes = pos - start;
+
+  end = pos;
+  len0 = incnt > 0 ? in[0].iov_len : 0;
+  if (start < len0)
+  {
+    out[*outcnt].iov_base = (char *)in[0].iov_base + start;
+    out[*outcnt].iov_len = (end < len0 ? end : len0) - start;
+    if (out[*outcnt].iov_len)
+      (*outcnt)++;
+  }
+  if (end > len0 && incnt > 1)
+  {
+    size_t from = start > len0 ? start - len0 : 0;
+    out[*outcnt].iov_base = (char *)in[1].iov_base + from;
+    out[*outcnt].iov_len = end - len0 - from;
+    (*outcnt)++;
+  }
+
+  return scan->skipped + scan->bytes;
+}
+
+/*
+ * Account for a scan whose frames have been passed on.
+ */
+void mp3sync_commit(Mp3Sync *sync, const Mp3Scan *scan)
+{
+  sync->skipped += scan->skipped;
+  sync->frames += scan->frames;
+
+  if (scan->frames)
+  {
+    sync->last = scan->last;
+    sync->synced = 1;
+  }
+  if (scan->lost && sync->synced)
+  {
+    sync->synced = 0;
+    sync->resyncs++;
+  }
+}
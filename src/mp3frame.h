@@ -0,0 +1,59 @@
+/*
+ * Include file for mp3frame.c
+ *
+ * MPEG audio (MP3) frame header parsing and a frame synchronising
+ * stage: it passes only whole, valid frames and skips anything else.
+ */
+
+#ifndef _MP3FRAME_H_
+#define _MP3FRAME_H_
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define MP3_HEADER_SIZE (4)
+
+typedef struct
+{
+  int version;      /* 10 (MPEG 1), 20 (MPEG 2) or 25 (MPEG 2.5) */
+  int layer;        /* 1, 2 or 3 */
+  int bitrate;      /* bits per second */
+  int samplerate;   /* Hz */
+  int padding;      /* 1 if the frame has a padding slot */
+  int channels;     /* 1 or 2 */
+  int length;       /* frame length in bytes, including the header */
+  int samples;      /* samples per channel in the frame */
+} Mp3Header;
+
+/* state of the frame synchronising stage */
+typedef struct
+{
+  int synced;             /* locked to the frames of the stream */
+  Mp3Header last;         /* header of the last frame passed */
+  unsigned long frames;   /* frames passed */
+  unsigned long skipped;  /* bytes skipped while (re)synchronising */
+  unsigned long resyncs;  /* times the lock was lost */
+} Mp3Sync;
+
+/* outcome of one mp3sync_scan() */
+typedef struct
+{
+  size_t skipped;     /* bytes at the front that are no (whole) frames */
+  size_t bytes;       /* bytes of whole frames following them */
+  unsigned long frames;
+  Mp3Header last;     /* header of the last whole frame */
+  int lost;           /* the frames ran into bytes that are no frame */
+} Mp3Scan;
+
+/* API prototypes */
+int mp3_parse_header(const unsigned char *p, Mp3Header *header);
+size_t mp3_find_sync(const unsigned char *p, size_t len);
+int mp3_frame_at(const struct iovec *in, int incnt, size_t offset, Mp3Header *header);
+double mp3_duration(const struct iovec *in, int incnt);
+
+void mp3sync_reset(Mp3Sync *sync);
+size_t mp3sync_scan(const Mp3Sync *sync, const struct iovec *in, int incnt,
+                    struct iovec out[2], int *outcnt, Mp3Scan *scan);
+void mp3sync_commit(Mp3Sync *sync, const Mp3Scan *scan);
+
+#endif /* _MP3FRAME_H_ */
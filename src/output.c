@@ -0,0 +1,1074 @@
+/*
+ * Output files of the recordings.
+ *
+ * By default output_writev() writes synchronously. In pipeline mode the
+ * data is queued to a writer thread through a lock-free single-producer/
+ * single-consumer queue instead, so a slow disk no longer stalls the
+ * thread that receives the streams. The queue holds records: a header
+ * followed by the data to write. Closing an output is a record as well,
+ * so it is closed after all its data has been written.
+ *
+ * With the io_uring backend the data is copied into registered buffers
+ * and queued as fixed-buffer writes at explicit offsets. output_flush()
+ * submits the writes of all outputs in one system call and reaps the
+ * completions without waiting for them.
+ *
+ * In writeback mode (output_setwriteback()) the pages of an output are
+ * written back every window bytes with sync_file_range() instead of in
+ * bursts by the flusher, and once written back dropped from the page
+ * cache with posix_fadvise(), so long recordings don't fill the cache
+ * with audio that is never read again. Disk space is reserved ahead of
+ * the writes to keep the files from fragmenting. All of this happens in
+ * whichever thread writes the data.
+ *
+ * With a durability policy (output_sync_start()) a committer thread
+ * calls fdatasync() on every output written to since its last round,
+ * for all outputs in one go, so no more than the given time of audio is
+ * ever at risk and the receive loop never waits for the disk. Closed
+ * outputs are handed to the committer, which syncs them a last time.
+ */
+
+#define _GNU_SOURCE /* fallocate(), sync_file_range() */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "atomics.h"
+#include "lock.h"
+#include "spscq.h"
+#include "uring.h"
+#include "output.h"
+
+struct output
+{
+  int fd;
+  atomic_int error; /* errno of a failed write by the writer thread */
+  off_t offset;     /* io_uring: file offset of the next write */
+  int inflight;     /* io_uring: writes submitted but not completed */
+  int closing;      /* io_uring: close once inflight drops to 0 */
+  int preallocated; /* space was reserved beyond the end of the file */
+  off_t reserved;   /* end of the space reserved */
+  off_t end;        /* writeback: end of the data written */
+  off_t started;    /* writeback: started up to here */
+  off_t dropped;    /* writeback: dropped from the page cache up to here */
+  atomic_llong dirty_since; /* sync: (msec) first write not yet synced, 0 if none */
+  int listed;       /* sync: on the list of the committer */
+  int released;     /* sync: closed, to be synced and released */
+  OUTPUT *prev;     /* sync: list of the open outputs */
+  OUTPUT *next;
+};
+
+/* record operations */
+enum
+{
+  OP_WRITE,
+  OP_PREALLOCATE,
+  OP_CLOSE,
+  OP_STOP
+};
+
+typedef struct
+{
+  OUTPUT *out;
+  size_t len; /* bytes of data following the header */
+  int op;
+} OutputRecord;
+
+/* the pipeline, only the writer thread consumes from the queue */
+static int g_pipeline = 0;
+static SpscQueue g_queue;
+static sem_t g_records; /* number of records in the queue */
+static pthread_t g_writer;
+
+/* the io_uring backend, one registered buffer per write in flight */
+typedef struct
+{
+  OUTPUT *out;
+  off_t offset; /* where the buffer goes in the file */
+  size_t len;   /* bytes in the buffer */
+  size_t done;  /* bytes written so far (short writes) */
+} OutputSlot;
+
+static int g_uring = 0;
+static Uring g_ring;
+static char *g_buffers;      /* g_nslots registered buffers of OUTPUT_SLOT_SIZE */
+static OutputSlot *g_slots;  /* bookkeeping of the buffers */
+static unsigned *g_free;     /* stack of free buffer indices */
+static unsigned g_nslots;
+static unsigned g_nfree;
+
+/* system calls issued to write the data, for statistics */
+static unsigned long g_syscalls = 0;
+
+/* (bytes) writeback window, 0 leaves writeback to the kernel */
+static size_t g_writeback = 0;
+
+/* the committer, with the list of all outputs it syncs */
+static int g_sync = 0;         /* (msec) most time of audio at risk */
+static int g_sync_stop = 0;
+static OUTPUT *g_outputs = NULL;
+static pthread_mutex_t g_sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_sync_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t g_committer;
+static OutputSyncStats g_sync_stats;
+static pthread_mutex_t g_sync_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* outputs synced with one lock of the list */
+#define SYNC_BATCH (64)
+
+/* monotonic clock in msecs */
+static long long output_clock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Write all bytes described by iov, continue after partial writes.
+ * Returns the number of bytes written, -1 on error.
+ */
+static ssize_t output_write_all(int fd, const struct iovec *iov, int iovcnt)
+{
+  struct iovec left[2];
+  ssize_t total = 0;
+  ssize_t n;
+  int i;
+
+  if (iovcnt > 2)
+  {
+    /* not needed by the callers, keep it simple */
+    errno = EINVAL;
+    return -1;
+  }
+  memcpy(left, iov, iovcnt * sizeof(struct iovec));
+
+  for (i = 0; i < iovcnt;)
+  {
+    g_syscalls++;
+    n = writev(fd, &left[i], iovcnt - i);
+    if (n < 0)
+    {
+      if (EINTR == errno)
+        continue;
+      return -1;
+    }
+    total += n;
+
+    while (i < iovcnt && (size_t)n >= left[i].iov_len)
+      n -= left[i++].iov_len;
+    if (i < iovcnt)
+    {
+      left[i].iov_base = (char *)left[i].iov_base + n;
+      left[i].iov_len -= n;
+    }
+  }
+
+  return total;
+}
+
+/*
+ * Reserve disk space for the next len bytes of the file, without
+ * changing its size. Returns 0 on success, -1 (with errno set) on failure.
+ */
+static int output_reserve(OUTPUT *out, off_t len)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+  struct stat st;
+
+  if (fstat(out->fd, &st) < 0 ||
+      fallocate(out->fd, FALLOC_FL_KEEP_SIZE, st.st_size, len) < 0)
+    return -1;
+  out->preallocated = 1;
+  if (out->reserved < st.st_size + len)
+    out->reserved = st.st_size + len;
+  return 0;
+#else
+  (void)out;
+  (void)len;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/*
+ * The data up to offset end is written. In writeback mode, once a
+ * window has filled up start writing it back, and wait for the window
+ * before it (it had the time of a whole window to get written) so its
+ * pages can be dropped from the cache.
+ */
+static void output_written(OUTPUT *out, off_t end)
+{
+  long long none = 0;
+
+  out->end = end;
+
+  if (g_sync)
+    atomic_compare_exchange_strong(&out->dirty_since, &none, output_clock());
+
+  if (!g_writeback || (size_t)(out->end - out->started) < g_writeback)
+    return;
+
+#ifdef HAVE_SYNC_FILE_RANGE
+  (void)sync_file_range(out->fd, out->started, out->end - out->started,
+                        SYNC_FILE_RANGE_WRITE);
+  if (out->started > out->dropped)
+    (void)sync_file_range(out->fd, out->dropped, out->started - out->dropped,
+                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                              SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+#ifdef HAVE_POSIX_FADVISE
+  if (out->started > out->dropped)
+    (void)posix_fadvise(out->fd, out->dropped, out->started - out->dropped,
+                        POSIX_FADV_DONTNEED);
+#endif
+  out->dropped = out->started;
+  out->started = out->end;
+
+  /* keep space reserved ahead of the writes */
+  if ((size_t)(out->reserved - out->end) < g_writeback)
+    (void)output_reserve(out, (off_t)g_writeback * OUTPUT_RESERVE_WINDOWS);
+}
+
+static void output_finish(OUTPUT *out)
+{
+  struct stat st;
+
+  /* nothing this recording wrote needs to stay cached, what an earlier
+     one appended to the file is left alone */
+  if (g_writeback && out->end > out->dropped)
+  {
+#ifdef HAVE_SYNC_FILE_RANGE
+    (void)sync_file_range(out->fd, out->dropped, out->end - out->dropped,
+                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                              SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+#ifdef HAVE_POSIX_FADVISE
+    (void)posix_fadvise(out->fd, out->dropped, out->end - out->dropped, POSIX_FADV_DONTNEED);
+#endif
+  }
+
+  /* give back the space reserved but not written */
+  if (out->preallocated && fstat(out->fd, &st) == 0)
+    (void)ftruncate(out->fd, st.st_size);
+
+  unlockfd(out->fd);
+  close(out->fd);
+  free(out);
+}
+
+/*
+ * Done writing to an output. With a durability policy the committer
+ * syncs and releases it, otherwise that happens right away.
+ */
+static void output_release(OUTPUT *out)
+{
+  if (!out->listed)
+  {
+    output_finish(out);
+    return;
+  }
+
+  pthread_mutex_lock(&g_sync_lock);
+  out->released = 1;
+  pthread_cond_signal(&g_sync_wake);
+  pthread_mutex_unlock(&g_sync_lock);
+}
+
+/*
+ * One round of the committer: fdatasync() every output that was written
+ * to since it was last synced, release the outputs that were closed.
+ * The descriptors are duplicated while the list is locked, so an output
+ * closed meanwhile can't have its descriptor reused under the sync.
+ */
+static void output_commit(void)
+{
+  struct
+  {
+    int fd;
+    long long since;
+    OUTPUT *released;
+  } batch[SYNC_BATCH];
+  OUTPUT *out, *next;
+  long long start, done;
+  int n, i;
+
+  do
+  {
+    n = 0;
+    pthread_mutex_lock(&g_sync_lock);
+    for (out = g_outputs; out && n < SYNC_BATCH; out = next)
+    {
+      next = out->next;
+      /* only this thread clears it, the writer sets it when it is 0 */
+      batch[n].since = atomic_load(&out->dirty_since);
+      batch[n].released = NULL;
+
+      if (out->released)
+      {
+        /* off the list, now only ours */
+        if (out->prev)
+          out->prev->next = out->next;
+        else
+          g_outputs = out->next;
+        if (out->next)
+          out->next->prev = out->prev;
+        batch[n].fd = -1;
+        batch[n].released = out;
+        ++n;
+      }
+      else if (batch[n].since && (batch[n].fd = dup(out->fd)) >= 0)
+      {
+        /* stays dirty when it can't be synced now (EMFILE), the next
+           round tries again */
+        atomic_store(&out->dirty_since, 0);
+        ++n;
+      }
+    }
+    pthread_mutex_unlock(&g_sync_lock);
+
+    for (i = 0; i < n; ++i)
+    {
+      start = output_clock();
+      if (batch[i].released)
+      {
+        /* trim first, so the final size is what gets synced */
+        out = batch[i].released;
+        if (out->preallocated)
+        {
+          struct stat st;
+
+          if (fstat(out->fd, &st) == 0)
+            (void)ftruncate(out->fd, st.st_size);
+          out->preallocated = 0;
+        }
+        (void)fdatasync(out->fd);
+        output_finish(out);
+      }
+      else
+      {
+        (void)fdatasync(batch[i].fd);
+        close(batch[i].fd);
+      }
+      done = output_clock();
+
+      if (!batch[i].since)
+        continue;
+      pthread_mutex_lock(&g_sync_stats_lock);
+      g_sync_stats.commits++;
+      g_sync_stats.latency_total += done - start;
+      if (done - start > g_sync_stats.latency_max)
+        g_sync_stats.latency_max = done - start;
+      if (done - batch[i].since > g_sync_stats.exposure_max)
+        g_sync_stats.exposure_max = done - batch[i].since;
+      if (done - batch[i].since > g_sync)
+        g_sync_stats.overdue++;
+      pthread_mutex_unlock(&g_sync_stats_lock);
+    }
+  } while (SYNC_BATCH == n);
+
+  pthread_mutex_lock(&g_sync_stats_lock);
+  g_sync_stats.rounds++;
+  pthread_mutex_unlock(&g_sync_stats_lock);
+}
+
+/*
+ * The committer: a round every half of the time at risk, so data is
+ * synced within that time even when it was written right after a round.
+ */
+static void *output_committer(void *arg)
+{
+  struct timespec until;
+  int stop = 0;
+
+  while (!stop)
+  {
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += g_sync / 2 / 1000;
+    until.tv_nsec += (long)(g_sync / 2 % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000)
+    {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&g_sync_lock);
+    while (!g_sync_stop)
+    {
+      if (pthread_cond_timedwait(&g_sync_wake, &g_sync_lock, &until) == ETIMEDOUT)
+        break;
+    }
+    stop = g_sync_stop;
+    pthread_mutex_unlock(&g_sync_lock);
+
+    output_commit();
+  }
+
+  return arg;
+}
+
+/* queue a record, returns 1 when queued, 0 when the queue is full */
+static int output_push(int op, OUTPUT *out, const struct iovec *iov, int iovcnt)
+{
+  OutputRecord record;
+  struct iovec rec[3];
+  int i;
+
+  record.out = out;
+  record.len = 0;
+  record.op = op;
+
+  rec[0].iov_base = &record;
+  rec[0].iov_len = sizeof(record);
+  for (i = 0; i < iovcnt; ++i)
+  {
+    rec[i + 1] = iov[i];
+    record.len += iov[i].iov_len;
+  }
+
+  if (!spscq_push(&g_queue, rec, iovcnt + 1))
+    return 0;
+
+  sem_post(&g_records);
+  return 1;
+}
+
+/* queue a record that must not be lost, wait for space if needed */
+static void output_push_wait(int op, OUTPUT *out)
+{
+  struct timespec wait = {0, 1000000}; /* 1 msec */
+
+  while (!output_push(op, out, NULL, 0))
+    nanosleep(&wait, NULL);
+}
+
+static void *output_writer(void *arg)
+{
+  OutputRecord record;
+  struct iovec iov[2];
+  size_t copied;
+  ssize_t written;
+  off_t len;
+  int n;
+  int i;
+
+  for (;;)
+  {
+    while (sem_wait(&g_records) < 0 && EINTR == errno)
+      ;
+
+    /* the header may wrap around the end of the queue as well */
+    n = spscq_peek(&g_queue, iov, 0, sizeof(record));
+    for (i = 0, copied = 0; i < n; ++i)
+    {
+      memcpy((char *)&record + copied, iov[i].iov_base, iov[i].iov_len);
+      copied += iov[i].iov_len;
+    }
+
+    switch (record.op)
+    {
+    case OP_WRITE:
+      n = spscq_peek(&g_queue, iov, sizeof(record), record.len);
+      if (!atomic_load(&record.out->error))
+      {
+        written = output_write_all(record.out->fd, iov, n);
+        if (written < 0)
+          atomic_store(&record.out->error, errno ? errno : EIO);
+        else
+          output_written(record.out, record.out->end + written);
+      }
+      break;
+
+    case OP_PREALLOCATE:
+      n = spscq_peek(&g_queue, iov, sizeof(record), sizeof(len));
+      for (i = 0, copied = 0; i < n; ++i)
+      {
+        memcpy((char *)&len + copied, iov[i].iov_base, iov[i].iov_len);
+        copied += iov[i].iov_len;
+      }
+      (void)output_reserve(record.out, len);
+      break;
+
+    case OP_CLOSE:
+      if (atomic_load(&record.out->error))
+      {
+        fprintf(stderr, "Error writing to output: %s\n",
+                strerror(atomic_load(&record.out->error)));
+      }
+      output_release(record.out);
+      break;
+
+    case OP_STOP:
+      spscq_consume(&g_queue, sizeof(record));
+      return NULL;
+    }
+
+    spscq_consume(&g_queue, sizeof(record) + record.len);
+  }
+
+  return arg;
+}
+
+/*
+ * Switch to pipeline mode: start the writer thread with a queue of
+ * capacity bytes. Returns 0 on success, -1 on error.
+ */
+int output_pipeline_start(size_t capacity)
+{
+  if (g_pipeline || g_uring)
+    return g_pipeline ? 0 : -1;
+
+  if (capacity < OUTPUT_MIN_PIPELINE)
+    capacity = OUTPUT_MIN_PIPELINE;
+
+  if (spscq_init(&g_queue, capacity) < 0)
+    return -1;
+
+  if (sem_init(&g_records, 0, 0) < 0)
+  {
+    spscq_free(&g_queue);
+    return -1;
+  }
+
+  errno = pthread_create(&g_writer, NULL, output_writer, NULL);
+  if (errno)
+  {
+    sem_destroy(&g_records);
+    spscq_free(&g_queue);
+    return -1;
+  }
+
+  g_pipeline = 1;
+  return 0;
+}
+
+/* write everything still queued, then stop the writer thread */
+void output_pipeline_stop(void)
+{
+  if (!g_pipeline)
+    return;
+
+  output_push_wait(OP_STOP, NULL);
+  pthread_join(g_writer, NULL);
+
+  sem_destroy(&g_records);
+  spscq_free(&g_queue);
+  g_pipeline = 0;
+}
+
+/* Returns 1 and fills stats in pipeline mode, 0 otherwise */
+int output_pipeline_stats(OutputPipelineStats *stats)
+{
+  if (!g_pipeline)
+    return 0;
+
+  stats->capacity = g_queue.size;
+  stats->depth = spscq_used(&g_queue);
+  stats->highwater = atomic_load(&g_queue.highwater);
+  stats->full = atomic_load(&g_queue.full);
+
+  return 1;
+}
+
+/* queue a fixed-buffer write of the (remaining) data of a buffer */
+static void output_uring_prep(unsigned slot)
+{
+  OutputSlot *s = &g_slots[slot];
+  struct io_uring_sqe *sqe;
+
+  /* never NULL: the ring has at least one entry per buffer */
+  sqe = uring_get_sqe(&g_ring);
+
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->fd = s->out->fd;
+  sqe->addr = (unsigned long)(g_buffers + (size_t)slot * OUTPUT_SLOT_SIZE + s->done);
+  sqe->len = s->len - s->done;
+  sqe->off = s->offset + s->done;
+  sqe->buf_index = slot;
+  sqe->user_data = slot;
+}
+
+/*
+ * End of the data of out written without a gap: completions arrive in
+ * any order, so up to the first write still in flight.
+ */
+static off_t output_uring_completed(const OUTPUT *out)
+{
+  off_t end = out->offset;
+  unsigned i;
+
+  for (i = 0; i < g_nslots; ++i)
+  {
+    if (g_slots[i].out == out && g_slots[i].offset < end)
+      end = g_slots[i].offset;
+  }
+  return end;
+}
+
+/* handle all completions that are available, without waiting */
+static void output_uring_reap(void)
+{
+  struct io_uring_cqe *cqe;
+  OutputSlot *s;
+  OUTPUT *out;
+  unsigned slot;
+  off_t end;
+  int res;
+
+  while ((cqe = uring_peek_cqe(&g_ring)))
+  {
+    slot = (unsigned)cqe->user_data;
+    res = cqe->res;
+    uring_cqe_seen(&g_ring);
+
+    s = &g_slots[slot];
+    if (res > 0 && s->done + res < s->len)
+    {
+      /* short write, queue the rest */
+      s->done += res;
+      output_uring_prep(slot);
+      continue;
+    }
+
+    if (res <= 0 && !atomic_load(&s->out->error))
+      atomic_store(&s->out->error, res < 0 ? -res : EIO);
+
+    out = s->out;
+    s->out = NULL;
+    g_free[g_nfree++] = slot;
+    --out->inflight;
+
+    /* an output that is never idle still gets synced and written back */
+    end = output_uring_completed(out);
+    if (end > out->end)
+      output_written(out, end);
+    if (!out->inflight && out->closing)
+      output_release(out);
+  }
+}
+
+/*
+ * Switch to the io_uring backend with slots registered buffers of
+ * OUTPUT_SLOT_SIZE bytes (one per write in flight).
+ * Returns 0 on success, -1 (with errno set) when io_uring is not
+ * available; the write() backend remains in use then.
+ */
+int output_uring_start(unsigned slots)
+{
+  struct iovec *iov;
+  unsigned entries = 1;
+  unsigned i;
+  int error;
+
+  if (g_uring || g_pipeline)
+    return g_uring ? 0 : -1;
+
+  if (slots < 1)
+    slots = 1;
+  while (entries < slots)
+    entries <<= 1;
+
+  if (uring_init(&g_ring, entries) < 0)
+    return -1;
+
+  g_buffers = NULL;
+  g_slots = calloc(slots, sizeof(OutputSlot));
+  g_free = calloc(slots, sizeof(unsigned));
+  iov = calloc(slots, sizeof(struct iovec));
+  if (!g_slots || !g_free || !iov ||
+      posix_memalign((void **)&g_buffers, 4096, (size_t)slots * OUTPUT_SLOT_SIZE))
+  {
+    error = ENOMEM;
+    goto fail;
+  }
+
+  for (i = 0; i < slots; ++i)
+  {
+    iov[i].iov_base = g_buffers + (size_t)i * OUTPUT_SLOT_SIZE;
+    iov[i].iov_len = OUTPUT_SLOT_SIZE;
+    g_free[i] = slots - 1 - i;
+  }
+
+  if (uring_register_buffers(&g_ring, iov, slots) < 0)
+  {
+    error = errno;
+    goto fail;
+  }
+
+  free(iov);
+  g_nslots = g_nfree = slots;
+  g_uring = 1;
+  return 0;
+
+fail:
+  free(iov);
+  free(g_buffers);
+  free(g_slots);
+  free(g_free);
+  g_buffers = NULL;
+  g_slots = NULL;
+  g_free = NULL;
+  uring_exit(&g_ring);
+  errno = error;
+  return -1;
+}
+
+/* wait for all writes in flight, then release the ring */
+void output_uring_stop(void)
+{
+  OutputSlot *s;
+  unsigned i;
+
+  if (!g_uring)
+    return;
+
+  while (g_nfree < g_nslots)
+  {
+    /* EAGAIN and EBUSY pass as completions are reaped, anything else
+       means none will arrive */
+    if (uring_submit(&g_ring, 1) < 0 && EAGAIN != errno && EBUSY != errno)
+      break;
+    output_uring_reap();
+  }
+
+  if (g_nfree < g_nslots)
+  {
+    /* closing the ring ends the writes still in flight, they failed */
+    g_syscalls += g_ring.enters;
+    uring_exit(&g_ring);
+    for (i = 0; i < g_nslots; ++i)
+    {
+      s = &g_slots[i];
+      if (!s->out)
+        continue;
+      if (!atomic_load(&s->out->error))
+        atomic_store(&s->out->error, EIO);
+      if (0 == --s->out->inflight && s->out->closing)
+        output_release(s->out);
+    }
+  }
+
+  g_syscalls += g_ring.enters;
+  uring_exit(&g_ring);
+  free(g_buffers);
+  free(g_slots);
+  free(g_free);
+  g_buffers = NULL;
+  g_slots = NULL;
+  g_free = NULL;
+  g_uring = 0;
+}
+
+/*
+ * Submit the writes queued by output_writev() since the last call, for
+ * all outputs at once, and handle the completions that arrived. Called
+ * once per pass of the recording loop; a no-op for the other backends.
+ */
+void output_flush(void)
+{
+  if (!g_uring)
+    return;
+
+  /* what the kernel doesn't take now (EAGAIN, EBUSY) goes with the next pass */
+  (void)uring_submit(&g_ring, 0);
+  output_uring_reap();
+}
+
+/* Returns the number of system calls issued to write the data */
+unsigned long output_syscalls(void)
+{
+  return g_syscalls + (g_uring ? g_ring.enters : 0);
+}
+
+/*
+ * Start the committer with a durability policy of at most msecs of
+ * written data not yet on disk. Outputs opened after the call are
+ * synced. Returns 0 on success, -1 (with errno set) on error.
+ */
+int output_sync_start(int msecs)
+{
+  if (g_sync)
+    return 0;
+
+  if (msecs < 2)
+    msecs = 2;
+
+  g_sync = msecs;
+  g_sync_stop = 0;
+  memset(&g_sync_stats, 0, sizeof(g_sync_stats));
+
+  errno = pthread_create(&g_committer, NULL, output_committer, NULL);
+  if (errno)
+  {
+    g_sync = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Sync everything written and stop the committer. Call after the
+ * pipeline and io_uring were stopped, so all data was written and all
+ * outputs were released.
+ */
+void output_sync_stop(void)
+{
+  if (!g_sync)
+    return;
+
+  pthread_mutex_lock(&g_sync_lock);
+  g_sync_stop = 1;
+  pthread_cond_signal(&g_sync_wake);
+  pthread_mutex_unlock(&g_sync_lock);
+  pthread_join(g_committer, NULL);
+
+  g_sync = 0;
+}
+
+/*
+ * Returns 1 and fills stats when there is a durability policy, 0
+ * otherwise.
+ */
+int output_sync_stats(OutputSyncStats *stats)
+{
+  if (!g_sync)
+    return 0;
+
+  pthread_mutex_lock(&g_sync_stats_lock);
+  *stats = g_sync_stats;
+  pthread_mutex_unlock(&g_sync_stats_lock);
+  return 1;
+}
+
+/*
+ * Write back and drop from the page cache every window bytes of each
+ * output opened after the call, 0 to leave it to the kernel.
+ */
+void output_setwriteback(size_t window)
+{
+  g_writeback = window;
+}
+
+/*
+ * Reserve disk space for the next len bytes of an output file without
+ * changing its size. What was not written is given back when the output
+ * is closed. In pipeline mode the writer thread does it, in order with
+ * the writes. Best effort: returns 0 on success, -1 (with errno set)
+ * when not supported or on failure.
+ */
+int output_preallocate(OUTPUT *out, off_t len)
+{
+  struct iovec iov;
+
+  if (!g_pipeline)
+    return output_reserve(out, len);
+
+  iov.iov_base = &len;
+  iov.iov_len = sizeof(len);
+  if (!output_push(OP_PREALLOCATE, out, &iov, 1))
+  {
+    errno = EAGAIN;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Take ownership of an opened (and locked) output file descriptor.
+ */
+OUTPUT *output_fdopen(int fd)
+{
+  OUTPUT *out = malloc(sizeof(OUTPUT));
+  struct stat st;
+  int flags;
+
+  if (!out)
+    return NULL;
+
+  out->fd = fd;
+  atomic_init(&out->error, 0);
+  out->offset = 0;
+  out->inflight = 0;
+  out->closing = 0;
+  out->preallocated = 0;
+  out->reserved = 0;
+  out->end = out->started = out->dropped = 0;
+  atomic_init(&out->dirty_since, 0);
+  out->listed = g_sync ? 1 : 0;
+  out->released = 0;
+  out->prev = NULL;
+  out->next = NULL;
+
+  if (g_writeback)
+  {
+    /* pages of an earlier recording are not ours to drop */
+    if (fstat(fd, &st) < 0)
+    {
+      free(out);
+      return NULL;
+    }
+    out->end = out->started = out->dropped = st.st_size;
+    out->reserved = st.st_size;
+  }
+
+  if (g_uring)
+  {
+    /*
+     * Writes in flight may complete in any order, so they go to explicit
+     * offsets. With O_APPEND Linux would ignore those and append in
+     * completion order; the lock keeps other writers out instead.
+     */
+    flags = fcntl(fd, F_GETFL);
+    if (fstat(fd, &st) < 0 || flags < 0 ||
+        fcntl(fd, F_SETFL, flags & ~O_APPEND) < 0)
+    {
+      free(out);
+      return NULL;
+    }
+    out->offset = st.st_size;
+  }
+
+  if (g_sync)
+  {
+    pthread_mutex_lock(&g_sync_lock);
+    out->next = g_outputs;
+    if (g_outputs)
+      g_outputs->prev = out;
+    g_outputs = out;
+    pthread_mutex_unlock(&g_sync_lock);
+  }
+
+  return out;
+}
+
+/* io_uring backend of output_writev() */
+static ssize_t output_uring_writev(OUTPUT *out, const struct iovec *iov, int iovcnt)
+{
+  size_t len = 0;
+  size_t copied = 0;
+  size_t from = 0; /* offset within the current iovec */
+  size_t n;
+  unsigned slot;
+  OutputSlot *s;
+  int i = 0;
+
+  if (atomic_load(&out->error))
+  {
+    errno = atomic_load(&out->error);
+    return -1;
+  }
+
+  for (i = 0; i < iovcnt; ++i)
+    len += iov[i].iov_len;
+
+  /* all or nothing */
+  if ((len + OUTPUT_SLOT_SIZE - 1) / OUTPUT_SLOT_SIZE > g_nfree)
+  {
+    output_uring_reap();
+    if ((len + OUTPUT_SLOT_SIZE - 1) / OUTPUT_SLOT_SIZE > g_nfree)
+      return 0;
+  }
+
+  for (i = 0; copied < len;)
+  {
+    slot = g_free[--g_nfree];
+    s = &g_slots[slot];
+    s->out = out;
+    s->offset = out->offset + copied;
+    s->len = 0;
+    s->done = 0;
+
+    while (s->len < OUTPUT_SLOT_SIZE && i < iovcnt)
+    {
+      n = iov[i].iov_len - from;
+      if (n > OUTPUT_SLOT_SIZE - s->len)
+        n = OUTPUT_SLOT_SIZE - s->len;
+
+      memcpy(g_buffers + (size_t)slot * OUTPUT_SLOT_SIZE + s->len,
+             (const char *)iov[i].iov_base + from, n);
+      s->len += n;
+      from += n;
+      if (from == iov[i].iov_len)
+      {
+        ++i;
+        from = 0;
+      }
+    }
+
+    copied += s->len;
+    out->inflight++;
+    output_uring_prep(slot);
+  }
+  out->offset += len;
+
+  return len;
+}
+
+/*
+ * Write the bytes described by iov (at most two iovecs).
+ * In pipeline mode the data is copied to the queue of the writer thread,
+ * with io_uring to registered buffers, and 0 is returned when there is
+ * no room (try again later). An error of an earlier queued write is
+ * reported by the next call.
+ * Returns the number of bytes taken, -1 (with errno set) on error.
+ */
+ssize_t output_writev(OUTPUT *out, const struct iovec *iov, int iovcnt)
+{
+  ssize_t len = 0;
+  int i;
+
+  if (g_uring)
+    return output_uring_writev(out, iov, iovcnt);
+
+  if (!g_pipeline)
+  {
+    len = output_write_all(out->fd, iov, iovcnt);
+    if (len > 0)
+      output_written(out, out->end + len);
+    return len;
+  }
+
+  if (atomic_load(&out->error))
+  {
+    errno = atomic_load(&out->error);
+    return -1;
+  }
+
+  for (i = 0; i < iovcnt; ++i)
+    len += iov[i].iov_len;
+
+  if (!output_push(OP_WRITE, out, iov, iovcnt))
+    return 0;
+
+  return len;
+}
+
+/*
+ * Unlock and close the output file. In pipeline mode this happens in
+ * the writer thread once all queued data has been written.
+ */
+int output_close(OUTPUT *out)
+{
+  if (!out)
+    return 0;
+
+  if (g_pipeline)
+    output_push_wait(OP_CLOSE, out);
+  else if (g_uring && out->inflight)
+    out->closing = 1; /* released by output_uring_reap() */
+  else
+    output_release(out);
+
+  return 0;
+}
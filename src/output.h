@@ -0,0 +1,65 @@
+/*
+ * Include file for output.c
+ */
+
+#ifndef _OUTPUT_H_
+#define _OUTPUT_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* smallest capacity of the queue to the writer thread */
+#define OUTPUT_MIN_PIPELINE (256 * 1024)
+
+/* size of each registered buffer of the io_uring backend */
+#define OUTPUT_SLOT_SIZE (64 * 1024)
+
+/* writeback windows of disk space reserved ahead of the writes */
+#define OUTPUT_RESERVE_WINDOWS (8)
+
+/* forward declaration */
+typedef struct output OUTPUT;
+
+/* writer thread queue statistics */
+typedef struct
+{
+  size_t capacity;    /* (bytes) size of the queue */
+  size_t depth;       /* (bytes) queued right now */
+  size_t highwater;   /* (bytes) most ever queued */
+  unsigned long full; /* writes refused because the queue was full */
+} OutputPipelineStats;
+
+/* committer statistics, times in msecs */
+typedef struct
+{
+  unsigned long rounds;        /* rounds of the committer */
+  unsigned long commits;       /* fdatasync() calls of outputs written to */
+  long long latency_total;     /* time spent in those */
+  long long latency_max;       /* longest of those */
+  long long exposure_max;      /* longest time data written was not synced */
+  unsigned long overdue;       /* commits that took longer than the policy */
+} OutputSyncStats;
+
+/* API prototypes */
+int output_pipeline_start(size_t capacity);
+void output_pipeline_stop(void);
+int output_pipeline_stats(OutputPipelineStats *stats);
+
+int output_uring_start(unsigned slots);
+void output_uring_stop(void);
+
+int output_sync_start(int msecs);
+void output_sync_stop(void);
+int output_sync_stats(OutputSyncStats *stats);
+
+void output_setwriteback(size_t window);
+void output_flush(void);
+unsigned long output_syscalls(void);
+
+OUTPUT *output_fdopen(int fd);
+int output_preallocate(OUTPUT *out, off_t len);
+ssize_t output_writev(OUTPUT *out, const struct iovec *iov, int iovcnt);
+int output_close(OUTPUT *out);
+
+#endif /* _OUTPUT_H_ */
@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ringbuf.h"
+
+/*
+ * Allocate the storage for a ring buffer of at least capacity bytes.
+ * The capacity is rounded up to the next power of two.
+ * Returns 0 on success, -1 (with errno set) on failure.
+ */
+int ringbuf_init(RingBuffer *rb, size_t capacity)
+{
+  size_t size = 1;
+
+  if (!rb || !capacity)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  while (size < capacity)
+    size <<= 1;
+
+  rb->data = malloc(size);
+  if (!rb->data)
+    return -1;
+
+  rb->size = size;
+  rb->mask = size - 1;
+  rb->rpos = 0;
+  rb->wpos = 0;
+
+  return 0;
+}
+
+void ringbuf_free(RingBuffer *rb)
+{
+  if (!rb)
+    return;
+
+  free(rb->data);
+  memset(rb, 0, sizeof(*rb));
+}
+
+/* discard all buffered data, keep the storage */
+void ringbuf_reset(RingBuffer *rb)
+{
+  rb->rpos = 0;
+  rb->wpos = 0;
+}
+
+/*
+ * Append up to len bytes from src. Never overwrites unread data.
+ * Returns the number of bytes actually stored.
+ */
+size_t ringbuf_write(RingBuffer *rb, const void *src, size_t len)
+{
+  size_t offset = rb->wpos & rb->mask;
+  size_t first;
+
+  if (len > ringbuf_space(rb))
+    len = ringbuf_space(rb);
+
+  first = rb->size - offset;
+  if (first > len)
+    first = len;
+
+  memcpy(rb->data + offset, src, first);
+  memcpy(rb->data, (const char *)src + first, len - first);
+  rb->wpos += len;
+
+  return len;
+}
+
+/*
+ * Copy up to len bytes to dst and remove them from the buffer.
+ * Returns the number of bytes copied.
+ */
+size_t ringbuf_read(RingBuffer *rb, void *dst, size_t len)
+{
+  struct iovec iov[2];
+  int n = ringbuf_peek(rb, iov, len);
+  size_t total = 0;
+  int i;
+
+  for (i = 0; i < n; ++i)
+  {
+    memcpy((char *)dst + total, iov[i].iov_base, iov[i].iov_len);
+    total += iov[i].iov_len;
+  }
+  rb->rpos += total;
+
+  return total;
+}
+
+/*
+ * Describe up to len readable bytes without copying them. The data may
+ * wrap around the end of the storage, hence up to two iovecs are filled.
+ * Returns the number of iovecs used (0 when the buffer is empty).
+ */
+int ringbuf_peek(const RingBuffer *rb, struct iovec iov[2], size_t len)
+{
+  size_t offset = rb->rpos & rb->mask;
+  size_t first;
+  int n = 0;
+
+  if (len > ringbuf_used(rb))
+    len = ringbuf_used(rb);
+  if (!len)
+    return 0;
+
+  first = rb->size - offset;
+  if (first > len)
+    first = len;
+
+  iov[n].iov_base = rb->data + offset;
+  iov[n].iov_len = first;
+  ++n;
+  if (len > first)
+  {
+    iov[n].iov_base = rb->data;
+    iov[n].iov_len = len - first;
+    ++n;
+  }
+
+  return n;
+}
+
+/* remove len bytes from the front of the buffer */
+void ringbuf_consume(RingBuffer *rb, size_t len)
+{
+  if (len > ringbuf_used(rb))
+    len = ringbuf_used(rb);
+  rb->rpos += len;
+}
+
+/*
+ * Expose the contiguous free space at the write position, so a producer
+ * can fill it in place (e.g. with fread()). Follow up with ringbuf_commit().
+ * Returns the number of bytes available at *ptr.
+ */
+size_t ringbuf_reserve(RingBuffer *rb, char **ptr)
+{
+  size_t offset = rb->wpos & rb->mask;
+  size_t len = rb->size - offset;
+
+  if (len > ringbuf_space(rb))
+    len = ringbuf_space(rb);
+  *ptr = rb->data + offset;
+
+  return len;
+}
+
+/* mark len bytes, filled in place after ringbuf_reserve(), as written */
+void ringbuf_commit(RingBuffer *rb, size_t len)
+{
+  if (len > ringbuf_space(rb))
+    len = ringbuf_space(rb);
+  rb->wpos += len;
+}
@@ -0,0 +1,47 @@
+/*
+ * Include file for ringbuf.c
+ *
+ * Fixed capacity byte ring buffer. The read and write positions are
+ * free running counters, the capacity is always a power of two so a
+ * position is turned into an offset with a simple mask.
+ */
+
+#ifndef _RINGBUF_H_
+#define _RINGBUF_H_
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+typedef struct
+{
+  char *data;  /* storage, allocated once by ringbuf_init() */
+  size_t size; /* capacity in bytes (power of two) */
+  size_t mask; /* size - 1 */
+  size_t rpos; /* total number of bytes consumed */
+  size_t wpos; /* total number of bytes produced */
+} RingBuffer;
+
+/* API prototypes */
+int ringbuf_init(RingBuffer *rb, size_t capacity);
+void ringbuf_free(RingBuffer *rb);
+void ringbuf_reset(RingBuffer *rb);
+size_t ringbuf_write(RingBuffer *rb, const void *src, size_t len);
+size_t ringbuf_read(RingBuffer *rb, void *dst, size_t len);
+int ringbuf_peek(const RingBuffer *rb, struct iovec iov[2], size_t len);
+void ringbuf_consume(RingBuffer *rb, size_t len);
+size_t ringbuf_reserve(RingBuffer *rb, char **ptr);
+void ringbuf_commit(RingBuffer *rb, size_t len);
+
+/* number of bytes available for reading */
+static inline size_t ringbuf_used(const RingBuffer *rb)
+{
+  return rb->wpos - rb->rpos;
+}
+
+/* number of bytes that can be written without overwriting unread data */
+static inline size_t ringbuf_space(const RingBuffer *rb)
+{
+  return rb->size - (rb->wpos - rb->rpos);
+}
+
+#endif /* _RINGBUF_H_ */
@@ -0,0 +1,252 @@
+/*
+ * Schedule of recordings, see schedule.h.
+ *
+ * A time field becomes a bit set of the values it allows. The next start
+ * is found by skipping whole months, days and hours that don't match
+ * before looking at the minutes, so it costs a few hundred steps at most
+ * even for a start a year away.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "schedule.h"
+
+/* look at most this far ahead for the next start (days) */
+#define HORIZON (5 * 366)
+
+/*
+ * Parse a time field allowing values from low to high into a bit set.
+ * Returns 0 on success, -1 if the field is invalid.
+ */
+static int parse_field(const char *text, int low, int high, unsigned long long *bits)
+{
+  char *end;
+  long from, to, step;
+
+  *bits = 0;
+  for (;;)
+  {
+    if ('*' == *text)
+    {
+      from = low;
+      to = high;
+      end = (char *)text + 1;
+    }
+    else
+    {
+      from = strtol(text, &end, 10);
+      if (end == text)
+        return -1;
+      to = from;
+      if ('-' == *end)
+      {
+        text = end + 1;
+        to = strtol(text, &end, 10);
+        if (end == text)
+          return -1;
+      }
+    }
+
+    step = 1;
+    if ('/' == *end)
+    {
+      text = end + 1;
+      step = strtol(text, &end, 10);
+      if (end == text || step <= 0)
+        return -1;
+    }
+
+    if (from < low || to > high || from > to)
+      return -1;
+    for (; from <= to; from += step)
+      *bits |= 1ULL << from;
+
+    if (',' != *end)
+      break;
+    text = end + 1;
+  }
+
+  return '\0' == *end ? 0 : -1;
+}
+
+/* boolean the day of tm is one the entry records on */
+static int day_matches(const ScheduleEntry *entry, const struct tm *tm)
+{
+  int day = (entry->days >> tm->tm_mday) & 1;
+  int weekday = (entry->weekdays >> tm->tm_wday) & 1;
+
+  if (entry->any_day)
+    return weekday;
+  if (entry->any_weekday)
+    return day;
+  return day || weekday;
+}
+
+/*
+ * The first start of the entry after the time after, 0 if there is none
+ * within a few years.
+ */
+time_t schedule_next(const ScheduleEntry *entry, time_t after)
+{
+  struct tm tm;
+  time_t t, previous;
+  int days = 0;
+
+  /* the next whole minute */
+  t = after - after % 60 + 60;
+  localtime_r(&t, &tm);
+
+  while (days < HORIZON)
+  {
+    if (!((entry->months >> (tm.tm_mon + 1)) & 1))
+    {
+      /* first day of the next month */
+      tm.tm_mon++;
+      tm.tm_mday = 1;
+      tm.tm_hour = 0;
+      tm.tm_min = 0;
+      days += 28;
+    }
+    else if (!day_matches(entry, &tm))
+    {
+      tm.tm_mday++;
+      tm.tm_hour = 0;
+      tm.tm_min = 0;
+      days++;
+    }
+    else if (!((entry->hours >> tm.tm_hour) & 1))
+    {
+      tm.tm_hour++;
+      tm.tm_min = 0;
+    }
+    else if (!((entry->minutes >> tm.tm_min) & 1))
+    {
+      tm.tm_min++;
+    }
+    else
+    {
+      return t;
+    }
+
+    /* normalise, across month ends and daylight saving changes; in the
+       hour repeated at the end of daylight saving time, don't go back */
+    tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    previous = t;
+    t = mktime(&tm);
+    if (t <= previous)
+      t = previous + 60;
+    localtime_r(&t, &tm);
+  }
+
+  return 0;
+}
+
+/*
+ * Read the schedule from path, replacing nothing on failure.
+ * Returns the number of recordings, -1 (with the line reported on
+ * stderr) on error.
+ */
+int schedule_load(Schedule *schedule, const char *path)
+{
+  Schedule loaded = {NULL, 0};
+  ScheduleEntry *entry;
+  unsigned long long bits[5];
+  static const int low[5] = {0, 0, 1, 1, 0};
+  static const int high[5] = {59, 23, 31, 12, 7};
+  char line[4096];
+  char *field[8];
+  char *end;
+  int nfields;
+  int lineno = 0;
+  int i;
+  FILE *file;
+
+  file = fopen(path, "r");
+  if (!file)
+  {
+    fprintf(stderr, "Error: couldn't open schedule '%s'\n%s\n", path, strerror(errno));
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), file))
+  {
+    ++lineno;
+
+    for (nfields = 0; nfields < 8; ++nfields)
+    {
+      field[nfields] = strtok(nfields ? NULL : line, " \t\r\n");
+      if (!field[nfields])
+        break;
+    }
+    if (!nfields || '#' == field[0][0])
+      continue;
+
+    for (i = 0; i < 5 && nfields == 8; ++i)
+    {
+      if (parse_field(field[i], low[i], high[i], &bits[i]) < 0)
+        break;
+    }
+    if (nfields < 8 || i < 5 || strtok(NULL, " \t\r\n") ||
+        strtol(field[5], &end, 10) <= 0 || *end)
+    {
+      fprintf(stderr, "Error: %s:%d: expected MINUTE HOUR DAY MONTH WEEKDAY DURATION URL OUTPUT\n",
+              path, lineno);
+      goto error;
+    }
+
+    entry = realloc(loaded.entries, (loaded.count + 1) * sizeof(ScheduleEntry));
+    if (!entry)
+    {
+      fprintf(stderr, "Error: out of memory reading schedule '%s'\n", path);
+      goto error;
+    }
+    loaded.entries = entry;
+    entry += loaded.count++;
+
+    memset(entry, 0, sizeof(*entry));
+    entry->minutes = bits[0];
+    entry->hours = bits[1];
+    entry->days = bits[2];
+    entry->months = bits[3];
+    /* 7 is Sunday as well */
+    entry->weekdays = (bits[4] | bits[4] >> 7) & 0x7f;
+    entry->any_day = '*' == field[2][0];
+    entry->any_weekday = '*' == field[4][0];
+    entry->duration = atoi(field[5]);
+    entry->url = strdup(field[6]);
+    entry->output = strdup(field[7]);
+    if (!entry->url || !entry->output)
+    {
+      fprintf(stderr, "Error: out of memory reading schedule '%s'\n", path);
+      goto error;
+    }
+  }
+
+  fclose(file);
+  schedule_free(schedule);
+  *schedule = loaded;
+  return loaded.count;
+
+error:
+  fclose(file);
+  schedule_free(&loaded);
+  return -1;
+}
+
+void schedule_free(Schedule *schedule)
+{
+  int i;
+
+  for (i = 0; i < schedule->count; ++i)
+  {
+    free(schedule->entries[i].url);
+    free(schedule->entries[i].output);
+  }
+  free(schedule->entries);
+  schedule->entries = NULL;
+  schedule->count = 0;
+}
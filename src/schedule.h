@@ -0,0 +1,48 @@
+/*
+ * Include file for schedule.c
+ *
+ * Schedule of the recordings of the resident mode (--schedule), one per
+ * line in the manner of crontab(5):
+ *
+ *   MINUTE HOUR DAY MONTH WEEKDAY DURATION URL OUTPUT
+ *
+ * The time fields take '*', numbers, ranges (1-5), lists (1,3,5) and
+ * steps ('*' or a range followed by /N, e.g. 8-18/2); as in cron a
+ * recording is due on a day if either the DAY or the WEEKDAY field
+ * matches when both are restricted.
+ * DURATION is in seconds, OUTPUT a strftime() pattern expanded with the
+ * start time. Empty lines and lines starting with '#' are ignored.
+ */
+
+#ifndef _SCHEDULE_H_
+#define _SCHEDULE_H_
+
+#include <time.h>
+
+typedef struct
+{
+  unsigned long long minutes; /* bit per minute, 0-59 */
+  unsigned long hours;        /* 0-23 */
+  unsigned long days;         /* 1-31 */
+  unsigned long months;       /* 1-12 */
+  unsigned long weekdays;     /* 0-6, Sunday is 0 */
+  int any_day;                /* boolean DAY was '*' */
+  int any_weekday;            /* boolean WEEKDAY was '*' */
+  int duration;               /* (sec) */
+  char *url;
+  char *output;
+  time_t next;                /* next start, 0 if there is none */
+} ScheduleEntry;
+
+typedef struct
+{
+  ScheduleEntry *entries;
+  int count;
+} Schedule;
+
+/* API prototypes */
+int schedule_load(Schedule *schedule, const char *path);
+time_t schedule_next(const ScheduleEntry *entry, time_t after);
+void schedule_free(Schedule *schedule);
+
+#endif /* _SCHEDULE_H_ */
@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "seekindex.h"
+
+/* records written with one write() */
+#define RECORDS_PER_WRITE (16)
+
+static void put32(unsigned char *p, uint32_t v)
+{
+  int i;
+
+  for (i = 0; i < 4; ++i, v >>= 8)
+    p[i] = v & 0xFF;
+}
+
+static void put64(unsigned char *p, uint64_t v)
+{
+  int i;
+
+  for (i = 0; i < 8; ++i, v >>= 8)
+    p[i] = v & 0xFF;
+}
+
+static uint64_t get64(const unsigned char *p)
+{
+  uint64_t v = 0;
+  int i;
+
+  for (i = 7; i >= 0; --i)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+static int write_all(int fd, const unsigned char *p, size_t len)
+{
+  ssize_t n;
+
+  while (len)
+  {
+    n = write(fd, p, len);
+    if (n < 0)
+    {
+      if (EINTR == errno)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * Open (or create) the index of an output file, adding a record every
+ * interval frames. An existing index is appended to: a partial record
+ * left by a crash is cut off and the first new record is flagged as a
+ * gap, its audio time estimated from the last record and the bitrate.
+ * Returns 0 on success, -1 (with errno set) on failure.
+ */
+int seekindex_open(SeekIndex *index, const char *path, int interval)
+{
+  unsigned char buf[SEEKINDEX_RECORD_SIZE];
+  off_t size;
+
+  memset(index, 0, sizeof(*index));
+  index->fd = -1;
+
+  if (interval <= 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  index->interval = interval;
+
+  index->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 00666);
+  if (index->fd < 0)
+    return -1;
+
+  size = lseek(index->fd, 0, SEEK_END);
+  if (size < 0)
+    goto fail;
+
+  if (size < SEEKINDEX_HEADER_SIZE)
+  {
+    /* new index (or one cut short before its first record) */
+    if (size && ftruncate(index->fd, 0) < 0)
+      goto fail;
+    memcpy(buf, SEEKINDEX_MAGIC, 8);
+    put32(buf + 8, SEEKINDEX_RECORD_SIZE);
+    put32(buf + 12, 0);
+    if (write_all(index->fd, buf, SEEKINDEX_HEADER_SIZE) < 0)
+      goto fail;
+    return 0;
+  }
+
+  if (pread(index->fd, buf, SEEKINDEX_HEADER_SIZE, 0) != SEEKINDEX_HEADER_SIZE)
+    goto fail;
+  if (memcmp(buf, SEEKINDEX_MAGIC, 8) || buf[8] != SEEKINDEX_RECORD_SIZE ||
+      buf[9] || buf[10] || buf[11])
+  {
+    errno = EINVAL;
+    goto fail;
+  }
+
+  size -= (size - SEEKINDEX_HEADER_SIZE) % SEEKINDEX_RECORD_SIZE;
+  if (ftruncate(index->fd, size) < 0)
+    goto fail;
+
+  /* the output file may have grown after the last record */
+  index->gap = 1;
+  if (size > SEEKINDEX_HEADER_SIZE)
+  {
+    if (pread(index->fd, buf, SEEKINDEX_RECORD_SIZE, size - SEEKINDEX_RECORD_SIZE) != SEEKINDEX_RECORD_SIZE)
+      goto fail;
+    index->resume = 1;
+    index->resume_offset = get64(buf);
+    index->base_ms = get64(buf + 8);
+  }
+
+  return 0;
+
+fail:
+  close(index->fd);
+  index->fd = -1;
+  return -1;
+}
+
+/*
+ * The stream was interrupted, flag the next record and make it the
+ * next frame.
+ */
+void seekindex_gap(SeekIndex *index)
+{
+  index->gap = 1;
+  index->countdown = 0;
+}
+
+/*
+ * Account for a run of whole frames (from mp3sync_scan()) written at
+ * offset in the output file, adding the records that fall in it.
+ * Returns 0 on success, -1 (with errno set) on a write error.
+ */
+int seekindex_frames(SeekIndex *index, uint64_t offset, const struct iovec *in, int incnt)
+{
+  unsigned char buf[RECORDS_PER_WRITE * SEEKINDEX_RECORD_SIZE];
+  unsigned char *record;
+  size_t total = 0, pos = 0;
+  int nrecords = 0;
+  Mp3Header header;
+  struct timeval tv;
+  int i;
+
+  if (index->fd < 0)
+    return 0;
+
+  for (i = 0; i < incnt; ++i)
+    total += in[i].iov_len;
+
+  gettimeofday(&tv, NULL);
+
+  while (pos < total && mp3_frame_at(in, incnt, pos, &header))
+  {
+    if (index->resume)
+    {
+      /* audio after the last record of an earlier run is not indexed */
+      if (offset + pos > index->resume_offset)
+        index->base_ms += (offset + pos - index->resume_offset) * 8000 / header.bitrate;
+      index->resume = 0;
+    }
+
+    if (header.samplerate != index->samplerate)
+    {
+      /* keep counting samples at one rate, no rounding drift */
+      if (index->samplerate)
+        index->base_ms += index->samples * 1000 / index->samplerate;
+      index->samples = 0;
+      index->samplerate = header.samplerate;
+    }
+
+    if (index->countdown <= 0 || index->gap)
+    {
+      record = buf + nrecords * SEEKINDEX_RECORD_SIZE;
+      put64(record, offset + pos);
+      put64(record + 8, index->base_ms + index->samples * 1000 / index->samplerate);
+      put64(record + 16, (uint64_t)((int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000));
+      put32(record + 24, index->gap ? SEEKINDEX_GAP : 0);
+      put32(record + 28, 0);
+      index->countdown = index->interval;
+      index->gap = 0;
+      index->records++;
+
+      if (++nrecords == RECORDS_PER_WRITE)
+      {
+        if (write_all(index->fd, buf, sizeof(buf)) < 0)
+          return -1;
+        nrecords = 0;
+      }
+    }
+
+    index->samples += header.samples;
+    index->countdown--;
+    pos += header.length;
+  }
+
+  if (nrecords && write_all(index->fd, buf, nrecords * SEEKINDEX_RECORD_SIZE) < 0)
+    return -1;
+
+  return 0;
+}
+
+void seekindex_close(SeekIndex *index)
+{
+  if (index->fd >= 0)
+    close(index->fd);
+  index->fd = -1;
+}
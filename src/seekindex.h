@@ -0,0 +1,61 @@
+/*
+ * Include file for seekindex.c
+ *
+ * Seek index of a recording, built while it is written. The index file
+ * is a 16 byte header followed by fixed-width records in increasing
+ * output offset (and audio time) order, so it can be mmap()ed and
+ * binary-searched. All fields are little-endian.
+ *
+ *   header:  char magic[8] "SGINDEX1"
+ *            uint32 record_size (32)
+ *            uint32 reserved
+ *
+ *   record:  uint64 offset     byte offset of a frame in the output file
+ *            uint64 audio_ms   audio time at the start of that frame
+ *            int64  wall_ms    wall-clock time it was written (unix, msec)
+ *            uint32 flags      SEEKINDEX_GAP: first frame after a gap
+ *            uint32 reserved
+ */
+
+#ifndef _SEEKINDEX_H_
+#define _SEEKINDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "mp3frame.h"
+
+#define SEEKINDEX_MAGIC "SGINDEX1"
+#define SEEKINDEX_HEADER_SIZE (16)
+#define SEEKINDEX_RECORD_SIZE (32)
+
+/* record flags */
+#define SEEKINDEX_GAP (1)
+
+typedef struct
+{
+  int fd;              /* index file, -1 when not open */
+  int interval;        /* frames between records */
+  int countdown;       /* frames until the next record */
+  int gap;             /* boolean the next record is flagged as a gap */
+
+  /* audio time: base plus the samples since, at one sample rate */
+  uint64_t base_ms;
+  uint64_t samples;
+  int samplerate;
+
+  /* boolean estimate the audio time from the last record of an earlier run */
+  int resume;
+  uint64_t resume_offset;
+
+  unsigned long records;
+} SeekIndex;
+
+/* API prototypes */
+int seekindex_open(SeekIndex *index, const char *path, int interval);
+void seekindex_gap(SeekIndex *index);
+int seekindex_frames(SeekIndex *index, uint64_t offset, const struct iovec *in, int incnt);
+void seekindex_close(SeekIndex *index);
+
+#endif /* _SEEKINDEX_H_ */
@@ -0,0 +1,167 @@
+/*
+ * Output segments and their playlist, see segment.h.
+ *
+ * Segment names come from a strftime() pattern applied to the start of
+ * the segment in local time. The playlist is an HLS media playlist of
+ * the last PLAYLIST_LENGTH segments, rewritten whole after every segment.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "segment.h"
+
+/*
+ * Start of the segment now falls in. Segments are aligned to multiples
+ * of their length in local time, so 3600 starts on the hour and 60 on
+ * the minute.
+ */
+time_t segment_start(time_t now, int seconds)
+{
+  struct tm tm;
+  long local;
+
+  localtime_r(&now, &tm);
+  local = (long)now + tm.tm_gmtoff;
+
+  return now - local % seconds;
+}
+
+/*
+ * Name of the segment starting at start: the output file name is a
+ * strftime() pattern, e.g. "radio-%Y%m%d-%H%M%S.mp3".
+ * Returns 0 on success, -1 if the name does not fit.
+ */
+int segment_name(char *name, size_t size, const char *pattern, time_t start)
+{
+  struct tm tm;
+
+  localtime_r(&start, &tm);
+  if (0 == strftime(name, size, pattern, &tm))
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * The playlist of the segments of pattern is named after the part of
+ * its file name in front of the first conversion, e.g. "radio.m3u8" for
+ * "radio-%Y%m%d-%H%M%S.mp3" (or "playlist.m3u8" when there is none).
+ * Returns 0 on success, -1 (with errno set) on failure.
+ */
+int playlist_init(Playlist *playlist, const char *pattern, int seconds)
+{
+  const char *base = strrchr(pattern, '/');
+  const char *conv = strchr(pattern, '%');
+  size_t dir, len;
+
+  memset(playlist, 0, sizeof(*playlist));
+  playlist->target = seconds;
+
+  base = base ? base + 1 : pattern;
+  if (!conv || conv < base)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  dir = base - pattern;
+
+  /* the prefix without separators at its end */
+  len = conv - base;
+  while (len && strchr("-_. ", base[len - 1]))
+    len--;
+
+  playlist->path = malloc(dir + (len ? len : strlen("playlist")) + sizeof(".m3u8"));
+  if (!playlist->path)
+    return -1;
+
+  memcpy(playlist->path, pattern, dir);
+  if (len)
+    memcpy(playlist->path + dir, base, len);
+  else
+    memcpy(playlist->path + dir, "playlist", len = strlen("playlist"));
+  strcpy(playlist->path + dir + len, ".m3u8");
+
+  return 0;
+}
+
+/*
+ * Add a finished segment and rewrite the playlist. The new playlist is
+ * written next to the old one and renamed over it, so readers always
+ * see a complete playlist.
+ * Returns 0 on success, -1 (with errno set) on failure.
+ */
+int playlist_add(Playlist *playlist, const char *name, double duration)
+{
+  unsigned long first, n;
+  const char *base;
+  char *tmp;
+  FILE *file;
+  int ret = 0;
+
+  if (!playlist->path)
+    return 0;
+
+  n = playlist->sequence++ % PLAYLIST_LENGTH;
+  free(playlist->names[n]);
+  base = strrchr(name, '/');
+  playlist->names[n] = strdup(base ? base + 1 : name);
+  playlist->durations[n] = duration;
+  if (!playlist->names[n])
+    return -1;
+
+  /* segments are cut by the clock but measured in audio, a burst after a
+     (re)connect makes one longer; no EXTINF may exceed the target, which
+     may not shrink either */
+  if (duration > playlist->target)
+    playlist->target = (int)duration + ((int)duration < duration);
+
+  tmp = malloc(strlen(playlist->path) + sizeof(".tmp"));
+  if (!tmp)
+    return -1;
+  sprintf(tmp, "%s.tmp", playlist->path);
+
+  file = fopen(tmp, "w");
+  if (!file)
+  {
+    free(tmp);
+    return -1;
+  }
+
+  first = playlist->sequence > PLAYLIST_LENGTH ? playlist->sequence - PLAYLIST_LENGTH : 0;
+  fprintf(file, "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%d\n#EXT-X-MEDIA-SEQUENCE:%lu\n",
+          playlist->target, first);
+  for (n = first; n < playlist->sequence; ++n)
+  {
+    fprintf(file, "#EXTINF:%.3f,\n%s\n",
+            playlist->durations[n % PLAYLIST_LENGTH], playlist->names[n % PLAYLIST_LENGTH]);
+  }
+
+  if (fclose(file) != 0 || rename(tmp, playlist->path) < 0)
+  {
+    unlink(tmp);
+    ret = -1;
+  }
+  free(tmp);
+
+  return ret;
+}
+
+void playlist_free(Playlist *playlist)
+{
+  int i;
+
+  for (i = 0; i < PLAYLIST_LENGTH; ++i)
+  {
+    free(playlist->names[i]);
+    playlist->names[i] = NULL;
+  }
+  free(playlist->path);
+  playlist->path = NULL;
+}
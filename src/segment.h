@@ -0,0 +1,34 @@
+/*
+ * Include file for segment.c
+ *
+ * Names of time-based output segments and the rolling playlist of the
+ * last segments written.
+ */
+
+#ifndef _SEGMENT_H_
+#define _SEGMENT_H_
+
+#include <stddef.h>
+#include <time.h>
+
+/* segments listed in the playlist */
+#define PLAYLIST_LENGTH (10)
+
+typedef struct
+{
+  char *path;                  /* the playlist, NULL when not in use */
+  int target;                  /* (sec) longest segment so far rounded up, at least the segment length */
+  char *names[PLAYLIST_LENGTH];
+  double durations[PLAYLIST_LENGTH];
+  unsigned long sequence;      /* segments added, including the ones dropped */
+} Playlist;
+
+/* API prototypes */
+time_t segment_start(time_t now, int seconds);
+int segment_name(char *name, size_t size, const char *pattern, time_t start);
+
+int playlist_init(Playlist *playlist, const char *pattern, int seconds);
+int playlist_add(Playlist *playlist, const char *name, double duration);
+void playlist_free(Playlist *playlist);
+
+#endif /* _SEGMENT_H_ */
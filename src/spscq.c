@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "spscq.h"
+
+/*
+ * Allocate the storage for a queue of at least capacity bytes.
+ * Returns 0 on success, -1 (with errno set) on failure.
+ */
+int spscq_init(SpscQueue *q, size_t capacity)
+{
+  size_t size = 1;
+
+  if (!q || !capacity)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  while (size < capacity)
+    size <<= 1;
+
+  q->data = malloc(size);
+  if (!q->data)
+    return -1;
+
+  q->size = size;
+  q->mask = size - 1;
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  atomic_init(&q->highwater, 0);
+  atomic_init(&q->full, 0);
+
+  return 0;
+}
+
+void spscq_free(SpscQueue *q)
+{
+  if (!q)
+    return;
+
+  free(q->data);
+  q->data = NULL;
+  q->size = 0;
+}
+
+/*
+ * Producer: append the bytes of all iovecs as one record. All or
+ * nothing, the record is published to the consumer at once.
+ * Returns 1 when queued, 0 when there is not enough space.
+ */
+int spscq_push(SpscQueue *q, const struct iovec *iov, int iovcnt)
+{
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  size_t len = 0;
+  size_t offset;
+  size_t first;
+  int i;
+
+  for (i = 0; i < iovcnt; ++i)
+    len += iov[i].iov_len;
+
+  if (len > q->size - (head - tail))
+  {
+    atomic_fetch_add_explicit(&q->full, 1, memory_order_relaxed);
+    return 0;
+  }
+
+  for (i = 0; i < iovcnt; ++i)
+  {
+    offset = (head & q->mask);
+    first = q->size - offset;
+    if (first > iov[i].iov_len)
+      first = iov[i].iov_len;
+
+    memcpy(q->data + offset, iov[i].iov_base, first);
+    memcpy(q->data, (const char *)iov[i].iov_base + first, iov[i].iov_len - first);
+    head += iov[i].iov_len;
+  }
+
+  /* make the data visible before the new head */
+  atomic_store_explicit(&q->head, head, memory_order_release);
+
+  if (head - tail > atomic_load_explicit(&q->highwater, memory_order_relaxed))
+    atomic_store_explicit(&q->highwater, head - tail, memory_order_relaxed);
+
+  return 1;
+}
+
+/*
+ * Consumer: describe len queued bytes, starting offset bytes past the
+ * front of the queue, without copying. Returns the number of iovecs
+ * used, 0 if fewer than offset + len bytes are queued.
+ */
+int spscq_peek(SpscQueue *q, struct iovec iov[2], size_t offset, size_t len)
+{
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+  size_t pos;
+  size_t first;
+  int n = 0;
+
+  if (!len || head - tail < offset + len)
+    return 0;
+
+  pos = (tail + offset) & q->mask;
+  first = q->size - pos;
+  if (first > len)
+    first = len;
+
+  iov[n].iov_base = q->data + pos;
+  iov[n].iov_len = first;
+  ++n;
+  if (len > first)
+  {
+    iov[n].iov_base = q->data;
+    iov[n].iov_len = len - first;
+    ++n;
+  }
+
+  return n;
+}
+
+/* Consumer: release len bytes at the front of the queue to the producer */
+void spscq_consume(SpscQueue *q, size_t len)
+{
+  atomic_fetch_add_explicit(&q->tail, len, memory_order_release);
+}
+
+size_t spscq_used(SpscQueue *q)
+{
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+  return head - tail;
+}
@@ -0,0 +1,43 @@
+/*
+ * Include file for spscq.c
+ *
+ * Lock-free single-producer/single-consumer byte queue. One thread
+ * pushes records, another thread peeks and consumes them. Like the
+ * RingBuffer the positions are free running counters and the capacity
+ * is a power of two.
+ */
+
+#ifndef _SPSCQ_H_
+#define _SPSCQ_H_
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "atomics.h"
+
+typedef struct
+{
+  char *data;               /* storage, allocated once by spscq_init() */
+  size_t size;              /* capacity in bytes (power of two) */
+  size_t mask;              /* size - 1 */
+  atomic_size_t head;       /* total bytes pushed, advanced by the producer */
+  atomic_size_t tail;       /* total bytes consumed, advanced by the consumer */
+  atomic_size_t highwater;  /* largest number of bytes ever queued */
+  atomic_ulong full;        /* number of pushes refused for lack of space */
+} SpscQueue;
+
+/* API prototypes */
+int spscq_init(SpscQueue *q, size_t capacity);
+void spscq_free(SpscQueue *q);
+
+/* producer side */
+int spscq_push(SpscQueue *q, const struct iovec *iov, int iovcnt);
+
+/* consumer side */
+int spscq_peek(SpscQueue *q, struct iovec iov[2], size_t offset, size_t len);
+void spscq_consume(SpscQueue *q, size_t len);
+
+/* either side, a snapshot */
+size_t spscq_used(SpscQueue *q);
+
+#endif /* _SPSCQ_H_ */
@@ -0,0 +1,112 @@
+/*
+ * Timer wheel, see timer.h.
+ *
+ * A timer is kept in the slot of the msec it expires in, modulo the
+ * number of slots, so setting and cancelling it costs O(1). Timers more
+ * than a turn of the wheel away share the slot with the nearer ones and
+ * are skipped until their turn comes. A timer set to a time already
+ * passed goes into the next slot to be looked at.
+ */
+
+#include <stddef.h>
+
+#include "timer.h"
+
+#define MASK (TIMER_SLOTS - 1)
+
+static Timer *g_slots[TIMER_SLOTS];
+static long long g_current = 0; /* (msec) last one looked at by timer_expire() */
+
+static void link_slot(Timer *t, Timer **slot)
+{
+  t->next = *slot;
+  if (t->next)
+    t->next->pprev = &t->next;
+  t->pprev = slot;
+  *slot = t;
+}
+
+void timer_init(Timer *t, void *data, int id)
+{
+  t->expires = 0;
+  t->next = NULL;
+  t->pprev = NULL;
+  t->data = data;
+  t->id = id;
+}
+
+/* (re)arm a timer to expire at the given time */
+void timer_set(Timer *t, long long expires)
+{
+  timer_cancel(t);
+  t->expires = expires;
+  if (expires <= g_current)
+    link_slot(t, &g_slots[(g_current + 1) & MASK]);
+  else
+    link_slot(t, &g_slots[expires & MASK]);
+}
+
+void timer_cancel(Timer *t)
+{
+  if (!t->pprev)
+    return;
+
+  *t->pprev = t->next;
+  if (t->next)
+    t->next->pprev = t->pprev;
+  t->next = NULL;
+  t->pprev = NULL;
+}
+
+/*
+ * Take the next timer that is due at now off the wheel, NULL when there
+ * is none left. Call until it returns NULL; a timer set again while
+ * handling one is looked at in the same pass if it is due.
+ */
+Timer *timer_expire(long long now)
+{
+  Timer *t;
+
+  /* a turn of the wheel looks at every slot */
+  if (now - g_current > TIMER_SLOTS)
+    g_current = now - TIMER_SLOTS;
+
+  while (g_current < now)
+  {
+    for (t = g_slots[(g_current + 1) & MASK]; t; t = t->next)
+    {
+      if (t->expires <= now)
+      {
+        timer_cancel(t);
+        return t;
+      }
+    }
+    g_current++;
+  }
+
+  return NULL;
+}
+
+/*
+ * Msecs from now until the next timer is due, at most limit (and at
+ * most a turn of the wheel). 0 if one is due already.
+ */
+long timer_next(long long now, long limit)
+{
+  long long tick;
+  Timer *t;
+
+  for (tick = g_current + 1; tick <= now + limit && tick <= g_current + TIMER_SLOTS; ++tick)
+  {
+    for (t = g_slots[tick & MASK]; t; t = t->next)
+    {
+      if (t->expires <= tick)
+        return tick > now ? (long)(tick - now) : 0;
+    }
+  }
+
+  /* nothing within the turn of the wheel looked at */
+  if (now + limit > g_current + TIMER_SLOTS)
+    return g_current + TIMER_SLOTS > now ? (long)(g_current + TIMER_SLOTS - now) : 0;
+  return limit;
+}
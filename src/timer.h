@@ -0,0 +1,38 @@
+/*
+ * Include file for timer.c
+ *
+ * Hashed timer wheel with a resolution of one millisecond, run by the
+ * main loop: timer_expire() hands out the timers that are due and
+ * timer_next() tells how long the loop may wait for the next one. Times
+ * are msecs on the monotonic clock (url_clock()).
+ */
+
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+/* slots of the wheel, one per msec (power of two) */
+#define TIMER_SLOTS (1024)
+
+typedef struct timer
+{
+  long long expires;     /* (msec) when it is due */
+  struct timer *next;    /* in its slot */
+  struct timer **pprev;  /* link pointing to it, NULL when not armed */
+  void *data;            /* for the owner: what it belongs to */
+  int id;                /* and which of its timers it is */
+} Timer;
+
+/* API prototypes */
+void timer_init(Timer *t, void *data, int id);
+void timer_set(Timer *t, long long expires);
+void timer_cancel(Timer *t);
+Timer *timer_expire(long long now);
+long timer_next(long long now, long limit);
+
+/* boolean the timer is set and not yet expired */
+static inline int timer_armed(const Timer *t)
+{
+  return t->pprev != 0;
+}
+
+#endif /* _TIMER_H_ */
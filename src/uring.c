@@ -0,0 +1,211 @@
+#include "config.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+
+/*
+ * Set up a ring with room for entries submissions.
+ * Returns 0 on success, -1 (with errno set) when io_uring is not
+ * supported by the kernel or not permitted.
+ */
+int uring_init(Uring *ring, unsigned entries)
+{
+  struct io_uring_params p;
+  char *sq;
+  char *cq;
+
+  memset(ring, 0, sizeof(*ring));
+  memset(&p, 0, sizeof(p));
+
+  ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (ring->fd < 0)
+  {
+    ring->fd = -1;
+    return -1;
+  }
+
+  ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+  if (MAP_FAILED == ring->sq_ring || MAP_FAILED == ring->cq_ring ||
+      MAP_FAILED == ring->sqes)
+  {
+    int error = errno;
+
+    if (MAP_FAILED == ring->sq_ring)
+      ring->sq_ring = NULL;
+    if (MAP_FAILED == ring->cq_ring)
+      ring->cq_ring = NULL;
+    if (MAP_FAILED == (void *)ring->sqes)
+      ring->sqes = NULL;
+    uring_exit(ring);
+    errno = error;
+    return -1;
+  }
+
+  sq = ring->sq_ring;
+  ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+  ring->sq_entries = p.sq_entries;
+
+  cq = ring->cq_ring;
+  ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  return 0;
+}
+
+void uring_exit(Uring *ring)
+{
+  if (ring->sqes)
+    munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring)
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  if (ring->sq_ring)
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  if (ring->fd >= 0)
+    close(ring->fd);
+
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+}
+
+/* pin n buffers for use with IORING_OP_WRITE_FIXED (buf_index 0..n-1) */
+int uring_register_buffers(Uring *ring, const struct iovec *iov, unsigned n)
+{
+  return syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, n) < 0 ? -1 : 0;
+}
+
+/*
+ * Get the next free submission queue entry, zeroed. It is queued by the
+ * next uring_submit(). Returns NULL when the submission queue is full.
+ */
+struct io_uring_sqe *uring_get_sqe(Uring *ring)
+{
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  unsigned tail = *ring->sq_tail + ring->sq_pending;
+  struct io_uring_sqe *sqe;
+
+  if (tail - head >= ring->sq_entries)
+    return NULL;
+
+  sqe = &ring->sqes[tail & *ring->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+  ring->sq_pending++;
+
+  return sqe;
+}
+
+/*
+ * Hand all prepared entries to the kernel in one system call, and wait
+ * for at least wait_nr completions. Entries the kernel didn't take (a
+ * short count, or -1 with EAGAIN or EBUSY) stay in the ring and are
+ * handed over again by the next call.
+ * Returns the number of entries submitted, -1 on error.
+ */
+int uring_submit(Uring *ring, unsigned wait_nr)
+{
+  unsigned submit;
+  int ret;
+
+  /* publish the new entries before the new tail */
+  if (ring->sq_pending)
+  {
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->sq_pending, __ATOMIC_RELEASE);
+    ring->sq_pending = 0;
+  }
+
+  /* all the kernel hasn't consumed yet */
+  submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if (!submit && !wait_nr)
+    return 0;
+
+  do
+  {
+    ring->enters++;
+    ret = syscall(__NR_io_uring_enter, ring->fd, submit, wait_nr,
+                  wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while (ret < 0 && EINTR == errno);
+
+  return ret;
+}
+
+/* Returns the oldest unseen completion, NULL if there is none */
+struct io_uring_cqe *uring_peek_cqe(Uring *ring)
+{
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+  if (head == tail)
+    return NULL;
+
+  return &ring->cqes[head & *ring->cq_mask];
+}
+
+/* release the completion returned by uring_peek_cqe() */
+void uring_cqe_seen(Uring *ring)
+{
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#else /* no io_uring */
+
+int uring_init(Uring *ring, unsigned entries)
+{
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+  errno = ENOSYS;
+  return -1;
+}
+
+void uring_exit(Uring *ring)
+{
+}
+
+int uring_register_buffers(Uring *ring, const struct iovec *iov, unsigned n)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(Uring *ring)
+{
+  return NULL;
+}
+
+int uring_submit(Uring *ring, unsigned wait_nr)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+struct io_uring_cqe *uring_peek_cqe(Uring *ring)
+{
+  return NULL;
+}
+
+void uring_cqe_seen(Uring *ring)
+{
+}
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Include file for uring.c
+ *
+ * Minimal io_uring wrapper on top of the raw system calls, so no
+ * liburing is needed. Covers what the output backend uses: one ring,
+ * registered buffers, batched submission and reaping completions.
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include "config.h"
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#else
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+typedef struct
+{
+  int fd; /* ring file descriptor, -1 when not set up */
+
+  /* submission queue */
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned sq_entries;
+  unsigned sq_pending; /* prepared, not yet submitted */
+
+  /* completion queue */
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  /* mappings */
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+
+  unsigned long enters; /* number of io_uring_enter() calls */
+} Uring;
+
+/* API prototypes */
+int uring_init(Uring *ring, unsigned entries);
+void uring_exit(Uring *ring);
+int uring_register_buffers(Uring *ring, const struct iovec *iov, unsigned n);
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+int uring_submit(Uring *ring, unsigned wait_nr);
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+void uring_cqe_seen(Uring *ring);
+
+#endif /* _URING_H_ */
@@ -43,15 +43,40 @@
  * This example requires libcurl 7.9.7 or later.
  */
 
+#include "config.h"
+
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/time.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
 #include <errno.h>
+#include <time.h>
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+#define USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
 
 #include <curl/curl.h>
 
+#include "ringbuf.h"
+#include "url_fopen.h"
+
 #define SELECT_TIMEOUT (10) /* seconds */
+#define MAX_EVENTS (64)     /* socket events handled per epoll_wait() */
+
+/* never accept a capacity below a few maximum sized curl writes */
+#define MIN_BUFFERSIZE (4 * CURL_MAX_WRITE_SIZE)
+
+/* metadata blocks kept until read by url_fmeta(), older ones are dropped */
+#define ICY_QUEUE (4)
+
+/* closed easy handles kept for reuse by the next url_fopen() */
+#define EASY_POOL (8)
 
 enum fcurl_type_e
 {
@@ -60,6 +85,24 @@ enum fcurl_type_e
     CFTYPE_CURL = 2
 };
 
+/* ICY metadata interleaved with the audio, see url_seticy() */
+struct icy_data
+{
+    size_t metaint;   /* audio bytes between metadata blocks */
+    size_t audio;     /* audio bytes left before the next block */
+    int length;       /* length of the block being read, -1 before its length byte */
+    int have;         /* bytes of it read so far */
+    char block[URL_ICY_MAX + 1];
+
+    /* blocks read, with the audio offset they were found at */
+    struct
+    {
+        unsigned long long offset;
+        char text[URL_ICY_MAX + 1];
+    } queue[ICY_QUEUE];
+    unsigned int head, tail;
+};
+
 struct fcurl_data
 {
     enum fcurl_type_e type; /* type of handle */
@@ -69,14 +112,16 @@ struct fcurl_data
         FILE *file;
     } handle; /* handle */
 
-    char *buffer;      /* buffer to store cached data*/
-    int buffer_len;    /* currently allocated buffers length */
-    int buffer_pos;    /* end of data in buffer*/
+    RingBuffer buffer; /* fixed capacity buffer to store cached data */
+    int paused;        /* transfer paused because the buffer was full */
+    int nonblocking;   /* never wait for data, see url_fwait() */
     int still_running; /* Is background url fetch still in progress */
+    CURLcode result;   /* outcome of the transfer once it has ended */
+    URL_STAT stat;     /* receive statistics, see url_fstat() */
+    struct icy_data *icy; /* NULL unless the server sends ICY metadata */
+    struct curl_slist *headers; /* extra request headers */
 };
 
-typedef struct fcurl_data URL_FILE;
-
 #if 0
 /* exported functions */
 URL_FILE *url_fopen(char *url,const char *operation);
@@ -90,6 +135,117 @@ void url_rewind(URL_FILE *file);
 /* we use a global one for convenience */
 CURLM *multi_handle;
 
+/* number of transfers still in progress on the multi handle */
+static int running_handles;
+
+/* DNS cache, connection pool and TLS session ids of all handles, so a
+ * reconnect skips the lookup and resumes the TLS session */
+static CURLSH *share_handle = NULL;
+
+/* easy handles of closed transfers, reset and ready to be used again */
+static CURL *easy_pool[EASY_POOL];
+static int easy_pooled = 0;
+
+#ifdef USE_EPOLL
+/* socket event engine: epoll set of curl's sockets plus a timerfd for
+ * curl's timeout, -1 when not available and select() is used instead */
+static int epoll_fd = -1;
+static int timer_fd = -1;
+#endif
+
+/* capacity of the buffer of handles opened by url_fopen() */
+static size_t buffer_size = URL_DEFAULT_BUFFERSIZE;
+
+/* request ICY metadata on handles opened by url_fopen() */
+static int icy_metadata = 0;
+
+/*
+ * Split the audio and the metadata blocks of an ICY stream while copying
+ * it into the buffer: the audio goes to the buffer, the blocks to the
+ * queue of url_fmeta(). The caller checked there is room for size bytes.
+ */
+static void
+icy_write(URL_FILE *url, const char *buffer, size_t size)
+{
+    struct icy_data *icy = url->icy;
+    size_t n;
+
+    while (size)
+    {
+        if (icy->audio)
+        {
+            n = (size < icy->audio ? size : icy->audio);
+            ringbuf_write(&url->buffer, buffer, n);
+            url->stat.received += n;
+            icy->audio -= n;
+        }
+        else if (icy->length < 0)
+        {
+            /* length byte, in units of 16 bytes */
+            icy->length = (unsigned char)*buffer * 16;
+            icy->have = 0;
+            n = 1;
+        }
+        else
+        {
+            n = icy->length - icy->have;
+            if (n > size)
+                n = size;
+            memcpy(icy->block + icy->have, buffer, n);
+            icy->have += n;
+        }
+        buffer += n;
+        size -= n;
+
+        if (!icy->audio && icy->length >= 0 && icy->have == icy->length)
+        {
+            /* block complete, an empty one means nothing changed */
+            if (icy->length)
+            {
+                if (icy->head - icy->tail == ICY_QUEUE)
+                    icy->tail++;
+                icy->queue[icy->head % ICY_QUEUE].offset = url->stat.received;
+                memcpy(icy->queue[icy->head % ICY_QUEUE].text, icy->block, icy->length);
+                icy->queue[icy->head % ICY_QUEUE].text[icy->length] = '\0';
+                icy->head++;
+            }
+            icy->audio = icy->metaint;
+            icy->length = -1;
+        }
+    }
+}
+
+/* curl calls this routine with each response header line */
+static size_t
+header_callback(char *buffer,
+                size_t size,
+                size_t nitems,
+                void *userp)
+{
+    URL_FILE *url = (URL_FILE *)userp;
+    size_t len = size * nitems;
+    long metaint;
+
+    /* a redirect starts a new response, only the last one counts */
+    if (len > 5 && 0 == strncmp(buffer, "HTTP/", 5))
+    {
+        free(url->icy);
+        url->icy = NULL;
+    }
+    else if (len > 12 && 0 == strncasecmp(buffer, "icy-metaint:", 12))
+    {
+        metaint = strtol(buffer + 12, NULL, 10);
+        if (metaint > 0 && !url->icy && (url->icy = calloc(1, sizeof(struct icy_data))))
+        {
+            url->icy->metaint = metaint;
+            url->icy->audio = metaint;
+            url->icy->length = -1;
+        }
+    }
+
+    return len;
+}
+
 /* curl calls this routine to get more data */
 static size_t
 write_callback(char *buffer,
@@ -97,138 +253,283 @@ write_callback(char *buffer,
                size_t nitems,
                void *userp)
 {
-    char *newbuff;
-    int rembuff;
-
     URL_FILE *url = (URL_FILE *)userp;
     size *= nitems;
 
-    rembuff = url->buffer_len - url->buffer_pos; // remaining space in buffer
+    if (size > url->buffer.size)
+    {
+        /* can never fit, not even in an empty buffer */
+        fprintf(stderr, "callback buffer too small for %lu bytes\n",
+                (unsigned long)size);
+        return 0;
+    }
+
+    if (size > ringbuf_space(&url->buffer))
+    {
+        /* not enuf space in buffer, have curl hold on to the data until
+         * url_fconsume(), url_fread() or url_fgets() made room for it and
+         * resume_transfer() unpaused the transfer */
+        url->paused = 1;
+        return CURL_WRITEFUNC_PAUSE;
+    }
 
-    if (size > rembuff)
+    if (url->icy)
     {
-        // not enuf space in buffer
-        newbuff = realloc(url->buffer, url->buffer_len + (size - rembuff));
-        if (newbuff == NULL)
+        /* strip the metadata while copying, no second pass */
+        icy_write(url, buffer, size);
+    }
+    else
+    {
+        ringbuf_write(&url->buffer, buffer, size);
+        url->stat.received += size;
+    }
+    url->stat.last_receive = url_clock();
+    if (url->stat.ttfb < 0)
+        url->stat.ttfb = url->stat.last_receive - url->stat.opened;
+
+    /*fprintf(stderr, "callback %d size bytes\n", size);*/
+
+    return size;
+}
+
+/* flag the handles whose transfer has ended */
+static void
+check_done(void)
+{
+    CURLMsg *msg;
+    int msgs;
+    char *file;
+
+    /* the running count covers all handles, completion is per handle */
+    while ((msg = curl_multi_info_read(multi_handle, &msgs)))
+    {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+
+        if (curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &file) == CURLE_OK && file)
         {
-            fprintf(stderr, "callback buffer grow failed\n");
-            size = rembuff;
+            ((URL_FILE *)file)->still_running = 0;
+            ((URL_FILE *)file)->result = msg->data.result;
         }
-        else
-        {
-            /* realloc suceeded increase buffer size*/
-            url->buffer_len += size - rembuff;
-            url->buffer = newbuff;
+    }
+}
 
-            /*printf("Callback buffer grown to %d bytes\n",url->buffer_len);*/
-        }
+#ifdef USE_EPOLL
+/* curl tells which events to watch on one of its sockets */
+static int
+socket_callback(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp)
+{
+    struct epoll_event ev;
+
+    if (what == CURL_POLL_REMOVE)
+    {
+        (void)epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s, NULL);
+        return 0;
     }
 
-    memcpy(&url->buffer[url->buffer_pos], buffer, size);
-    url->buffer_pos += size;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = ((what & CURL_POLL_IN) ? EPOLLIN : 0) |
+                ((what & CURL_POLL_OUT) ? EPOLLOUT : 0);
+    ev.data.fd = s;
 
-    /*fprintf(stderr, "callback %d size bytes\n", size);*/
+    /* socketp marks sockets already in the epoll set */
+    if (socketp)
+        return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, s, &ev) ? -1 : 0;
 
-    return size;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s, &ev) &&
+        (errno != EEXIST || epoll_ctl(epoll_fd, EPOLL_CTL_MOD, s, &ev)))
+        return -1;
+
+    curl_multi_assign(multi_handle, s, &epoll_fd);
+    return 0;
 }
 
-/* use to attempt to fill the read buffer up to requested number of bytes */
+/* curl tells when it next wants to handle its timeouts, -1 is never */
 static int
-fill_buffer(URL_FILE *file, int want, int waittime)
+timer_callback(CURLM *multi, long timeout_ms, void *userp)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if (timeout_ms > 0)
+    {
+        its.it_value.tv_sec = timeout_ms / 1000;
+        its.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+    }
+    else if (timeout_ms == 0)
+    {
+        /* as soon as possible, curl must not be called back from here */
+        its.it_value.tv_nsec = 1;
+    }
+
+    return timerfd_settime(timer_fd, 0, &its, NULL) ? -1 : 0;
+}
+
+/* set up the event engine, on failure select() remains in use */
+static void
+engine_init(void)
+{
+    struct epoll_event ev;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = timer_fd;
+
+    if (epoll_fd < 0 || timer_fd < 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev))
+    {
+        if (epoll_fd >= 0)
+            close(epoll_fd);
+        if (timer_fd >= 0)
+            close(timer_fd);
+        epoll_fd = timer_fd = -1;
+        return;
+    }
+
+    curl_multi_setopt(multi_handle, CURLMOPT_SOCKETFUNCTION, socket_callback);
+    curl_multi_setopt(multi_handle, CURLMOPT_TIMERFUNCTION, timer_callback);
+}
+#else
+static void
+engine_init(void)
+{
+}
+#endif
+
+/* run the transfers that are due and flag the handles that ended */
+static void
+multi_perform(void)
+{
+#ifdef USE_EPOLL
+    if (epoll_fd >= 0)
+    {
+        curl_multi_socket_action(multi_handle, CURL_SOCKET_TIMEOUT, 0, &running_handles);
+        check_done();
+        return;
+    }
+#endif
+
+    while (curl_multi_perform(multi_handle, &running_handles) ==
+           CURLM_CALL_MULTI_PERFORM)
+        ;
+
+    check_done();
+}
+
+#ifdef USE_EPOLL
+/* wait for socket readiness or curl's timer deadline, whichever is first */
+static void
+multi_wait_epoll(long timeout_ms)
+{
+    struct epoll_event events[MAX_EVENTS];
+    uint64_t expirations;
+    int flags;
+    int n;
+    int i;
+
+    n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+
+    for (i = 0; i < n; i++)
+    {
+        if (events[i].data.fd == timer_fd)
+        {
+            if (read(timer_fd, &expirations, sizeof(expirations)) > 0)
+                curl_multi_socket_action(multi_handle, CURL_SOCKET_TIMEOUT, 0,
+                                         &running_handles);
+            continue;
+        }
+
+        flags = ((events[i].events & EPOLLIN) ? CURL_CSELECT_IN : 0) |
+                ((events[i].events & EPOLLOUT) ? CURL_CSELECT_OUT : 0) |
+                ((events[i].events & (EPOLLERR | EPOLLHUP)) ? CURL_CSELECT_ERR : 0);
+        curl_multi_socket_action(multi_handle, events[i].data.fd, flags,
+                                 &running_handles);
+    }
+
+    check_done();
+}
+#endif
+
+/* wait at most timeout_ms for activity on any transfer, then run them */
+static void
+multi_wait(long timeout_ms)
 {
     fd_set fdread;
     fd_set fdwrite;
     fd_set fdexcep;
-    int maxfd;
+    int maxfd = -1;
+    long curl_timeout = -1;
     struct timeval timeout;
-    int rc;
-
-    /* only attempt to fill buffer if transactions still running and buffer
-     * doesnt exceed required size already
-     */
-    if ((!file->still_running) || (file->buffer_pos > want))
-        return 0;
 
-    /* attempt to fill buffer */
-    do
+#ifdef USE_EPOLL
+    if (epoll_fd >= 0)
     {
-        FD_ZERO(&fdread);
-        FD_ZERO(&fdwrite);
-        FD_ZERO(&fdexcep);
+        multi_wait_epoll(timeout_ms);
+        return;
+    }
+#endif
 
-        /* set a suitable timeout to fail on */
-        timeout.tv_sec = SELECT_TIMEOUT;
-        timeout.tv_usec = 0;
+    /* don't sleep past the next timeout curl has to handle */
+    curl_multi_timeout(multi_handle, &curl_timeout);
+    if (curl_timeout >= 0 && curl_timeout < timeout_ms)
+        timeout_ms = curl_timeout;
 
-        /* get file descriptors from the transfers */
-        curl_multi_fdset(multi_handle, &fdread, &fdwrite, &fdexcep, &maxfd);
+    FD_ZERO(&fdread);
+    FD_ZERO(&fdwrite);
+    FD_ZERO(&fdexcep);
 
-        /* According to libcurl docs, maxfd can be -1 when using internal timers.
-         * In this case, we should sleep briefly and call curl_multi_perform. */
-        if (maxfd == -1)
-        {
-            /* No file descriptors, curl is using internal timers.
-             * Sleep for 100ms and let curl process. */
-            struct timeval wait = {0, 100000}; /* 100ms */
-            select(0, NULL, NULL, NULL, &wait);
-            while (curl_multi_perform(multi_handle, &file->still_running) ==
-                   CURLM_CALL_MULTI_PERFORM)
-                ;
-        }
-        else
-        {
-            rc = select(maxfd + 1, &fdread, &fdwrite, &fdexcep, &timeout);
+    /* get file descriptors from the transfers */
+    curl_multi_fdset(multi_handle, &fdread, &fdwrite, &fdexcep, &maxfd);
 
-            switch (rc)
-            {
-            case -1:
-                /* select error */
-                break;
+    /* According to libcurl docs, maxfd can be -1 when using internal timers.
+     * In this case, we should sleep briefly and call curl_multi_perform. */
+    if (maxfd == -1 && timeout_ms > 100)
+        timeout_ms = 100;
 
-            case 0:
-                break;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
 
-            default:
-                /* timeout or readable/writable sockets */
-                /* note we *could* be more efficient and not wait for
-                 * CURLM_CALL_MULTI_PERFORM to clear here and check it on re-entry
-                 * but that gets messy */
-                while (curl_multi_perform(multi_handle, &file->still_running) ==
-                       CURLM_CALL_MULTI_PERFORM)
-                    ;
+    /* on timeout or select error we still let curl handle its timers */
+    (void)select(maxfd + 1, &fdread, &fdwrite, &fdexcep, &timeout);
 
-                break;
-            }
-        }
-    } while (file->still_running && (file->buffer_pos < want));
-    return 1;
+    multi_perform();
 }
 
-/* use to remove want bytes from the front of a files buffer */
+/* use to attempt to fill the read buffer up to requested number of bytes */
 static int
-use_buffer(URL_FILE *file, int want)
+fill_buffer(URL_FILE *file, size_t want, int waittime)
 {
-    /* sort out buffer */
-    if ((file->buffer_pos - want) <= 0)
-    {
-        /* ditch buffer - write will recreate */
-        if (file->buffer)
-            free(file->buffer);
+    /* only attempt to fill buffer if transactions still running and buffer
+     * doesnt exceed required size already
+     */
+    if (want > file->buffer.size)
+        want = file->buffer.size;
 
-        file->buffer = NULL;
-        file->buffer_pos = 0;
-        file->buffer_len = 0;
-    }
-    else
+    if ((!file->still_running) || file->nonblocking ||
+        (ringbuf_used(&file->buffer) >= want))
+        return 0;
+
+    /* attempt to fill buffer */
+    do
     {
-        /* move rest down make it available for later */
-        memmove(file->buffer,
-                &file->buffer[want],
-                (file->buffer_pos - want));
+        multi_wait(SELECT_TIMEOUT * 1000);
+    } while (file->still_running && !file->paused &&
+             (ringbuf_used(&file->buffer) < want));
+    return 1;
+}
 
-        file->buffer_pos -= want;
+/* resume a paused transfer once the pending write surely fits */
+static void
+resume_transfer(URL_FILE *file)
+{
+    if (file->paused && ringbuf_space(&file->buffer) >= CURL_MAX_WRITE_SIZE)
+    {
+        file->paused = 0;
+        curl_easy_pause(file->handle.curl, CURLPAUSE_CONT);
     }
-    return 0;
 }
 
 static int setoption(CURL *curl, CURLoption option, int value)
@@ -264,6 +565,18 @@ int url_setprogress(URL_FILE *file, int value)
     return setoption(file->handle.curl, CURLOPT_NOPROGRESS, value ? 0 : 1);
 }
 
+int url_setnonblocking(URL_FILE *file, int value)
+{
+    if (!file)
+    {
+        errno = EBADF;
+        return EOF;
+    }
+
+    file->nonblocking = value ? 1 : 0;
+    return 0;
+}
+
 int url_setuseragent(URL_FILE *file, char *value)
 {
     if (!file || file->type != CFTYPE_CURL)
@@ -275,6 +588,75 @@ int url_setuseragent(URL_FILE *file, char *value)
     return curl_easy_setopt(file, CURLOPT_USERAGENT, value);
 }
 
+/*
+ * Request ICY metadata (Icy-MetaData: 1) on the handles opened from now
+ * on. When the server interleaves it (icy-metaint), it is removed from
+ * the audio and read with url_fmeta().
+ */
+int url_seticy(int enable)
+{
+    int previous = icy_metadata;
+
+    icy_metadata = enable;
+
+    return previous;
+}
+
+size_t url_setbuffersize(size_t size)
+{
+    size_t previous = buffer_size;
+
+    buffer_size = (size < MIN_BUFFERSIZE ? MIN_BUFFERSIZE : size);
+
+    return previous;
+}
+
+/* the share handle, created on first use; NULL if curl has none */
+static CURLSH *
+share_get(void)
+{
+    if (share_handle)
+        return share_handle;
+
+    share_handle = curl_share_init();
+    if (!share_handle)
+        return NULL;
+
+    /* all handles live in the thread of the multi handle, no locking */
+    curl_share_setopt(share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    curl_share_setopt(share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+
+    return share_handle;
+}
+
+/* an easy handle from the pool, or a new one */
+static CURL *
+easy_get(void)
+{
+    if (easy_pooled)
+        return easy_pool[--easy_pooled];
+
+    return curl_easy_init();
+}
+
+/* done with an easy handle, keep it for the next transfer if there's room */
+static void
+easy_put(CURL *curl)
+{
+    if (easy_pooled == EASY_POOL)
+    {
+        curl_easy_cleanup(curl);
+        return;
+    }
+
+    /* forget the options of the transfer, the caches stay */
+    curl_easy_reset(curl);
+    easy_pool[easy_pooled++] = curl;
+}
+
 URL_FILE *
 url_fopen(char *url, const char *operation, char *useragent)
 {
@@ -290,6 +672,18 @@ url_fopen(char *url, const char *operation, char *useragent)
 
     memset(file, 0, sizeof(URL_FILE));
 
+    /* the only allocation of buffer space for the life of the handle */
+    if (ringbuf_init(&file->buffer, buffer_size) < 0)
+    {
+        free(file);
+        return NULL;
+    }
+
+    /* a stream that never delivers counts as stalled from the open */
+    file->stat.opened = url_clock();
+    file->stat.last_receive = file->stat.opened;
+    file->stat.ttfb = -1;
+
     if ((file->handle.file = fopen(url, operation)))
     {
         file->type = CFTYPE_FILE; /* marked as URL */
@@ -297,11 +691,27 @@ url_fopen(char *url, const char *operation, char *useragent)
     else
     {
         file->type = CFTYPE_CURL; /* marked as URL */
-        file->handle.curl = curl_easy_init();
 
+        file->handle.curl = easy_get();
+        if (!file->handle.curl)
+        {
+            ringbuf_free(&file->buffer);
+            free(file);
+            return NULL;
+        }
+
+        curl_easy_setopt(file->handle.curl, CURLOPT_SHARE, share_get());
         curl_easy_setopt(file->handle.curl, CURLOPT_URL, url);
         curl_easy_setopt(file->handle.curl, CURLOPT_WRITEDATA, file);
         curl_easy_setopt(file->handle.curl, CURLOPT_WRITEFUNCTION, write_callback);
+        curl_easy_setopt(file->handle.curl, CURLOPT_PRIVATE, file);
+        if (icy_metadata)
+        {
+            file->headers = curl_slist_append(NULL, "Icy-MetaData: 1");
+            curl_easy_setopt(file->handle.curl, CURLOPT_HTTPHEADER, file->headers);
+            curl_easy_setopt(file->handle.curl, CURLOPT_HEADERFUNCTION, header_callback);
+            curl_easy_setopt(file->handle.curl, CURLOPT_HEADERDATA, file);
+        }
 
         /* streamget requires the following options */
         curl_easy_setopt(file->handle.curl, CURLOPT_FOLLOWLOCATION, 1); /* redirect automatically */
@@ -319,16 +729,18 @@ url_fopen(char *url, const char *operation, char *useragent)
 #endif
 
         if (!multi_handle)
+        {
             multi_handle = curl_multi_init();
+            engine_init();
+        }
 
         curl_multi_add_handle(multi_handle, file->handle.curl);
 
         /* lets start the fetch */
-        while (curl_multi_perform(multi_handle, &file->still_running) ==
-               CURLM_CALL_MULTI_PERFORM)
-            ;
+        file->still_running = 1;
+        multi_perform();
 
-        if ((file->buffer_pos == 0) && (!file->still_running))
+        if ((ringbuf_used(&file->buffer) == 0) && (!file->still_running))
         {
             /* if still_running is 0 now, we should return NULL */
 
@@ -336,8 +748,11 @@ url_fopen(char *url, const char *operation, char *useragent)
             curl_multi_remove_handle(multi_handle, file->handle.curl);
 
             /* cleanup */
-            curl_easy_cleanup(file->handle.curl);
+            easy_put(file->handle.curl);
+            curl_slist_free_all(file->headers);
+            free(file->icy);
 
+            ringbuf_free(&file->buffer);
             free(file);
 
             file = NULL;
@@ -361,7 +776,7 @@ int url_fclose(URL_FILE *file)
         curl_multi_remove_handle(multi_handle, file->handle.curl);
 
         /* cleanup */
-        curl_easy_cleanup(file->handle.curl);
+        easy_put(file->handle.curl);
         break;
 
     default: /* unknown or supported type - oh dear */
@@ -370,9 +785,10 @@ int url_fclose(URL_FILE *file)
         break;
     }
 
-    if (file->buffer)
-        free(file->buffer); /* free any allocated buffer space */
+    ringbuf_free(&file->buffer); /* free any allocated buffer space */
 
+    curl_slist_free_all(file->headers);
+    free(file->icy);
     free(file);
 
     return ret;
@@ -385,11 +801,11 @@ int url_feof(URL_FILE *file)
     switch (file->type)
     {
     case CFTYPE_FILE:
-        ret = feof(file->handle.file);
+        ret = feof(file->handle.file) && (ringbuf_used(&file->buffer) == 0);
         break;
 
     case CFTYPE_CURL:
-        if ((file->buffer_pos == 0) && (!file->still_running))
+        if ((ringbuf_used(&file->buffer) == 0) && (!file->still_running))
             ret = 1;
         break;
     default: /* unknown or supported type - oh dear */
@@ -400,6 +816,112 @@ int url_feof(URL_FILE *file)
     return ret;
 }
 
+/*
+ * Free what the handles shared, call once all of them are closed.
+ */
+void url_cleanup(void)
+{
+    while (easy_pooled)
+        curl_easy_cleanup(easy_pool[--easy_pooled]);
+
+    if (share_handle)
+        curl_share_cleanup(share_handle);
+    share_handle = NULL;
+}
+
+/*
+ * Milliseconds on the monotonic clock, the time base of url_fstat().
+ */
+long long url_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Receive statistics of a stream: bytes received so far, when the last
+ * of them arrived and how full the buffer is. Local files are never
+ * stalled.
+ */
+int url_fstat(URL_FILE *file, URL_STAT *stat)
+{
+    switch (file->type)
+    {
+    case CFTYPE_FILE:
+        file->stat.last_receive = url_clock();
+        break;
+
+    case CFTYPE_CURL:
+        break;
+
+    default: /* unknown or supported type - oh dear */
+        errno = EBADF;
+        return -1;
+    }
+
+    *stat = file->stat;
+    stat->buffered = ringbuf_used(&file->buffer);
+    stat->capacity = file->buffer.size;
+    return 0;
+}
+
+/*
+ * The url the transfer ended up at after following redirects, NULL for
+ * a local file. Valid until the handle is closed.
+ */
+const char *url_feffective(URL_FILE *file)
+{
+    char *url = NULL;
+
+    if (file->type != CFTYPE_CURL ||
+        curl_easy_getinfo(file->handle.curl, CURLINFO_EFFECTIVE_URL, &url) != CURLE_OK)
+        return NULL;
+
+    return url;
+}
+
+/*
+ * Take the oldest ICY metadata block received, e.g.
+ * "StreamTitle='Artist - Title';". *offset is set to the number of audio
+ * bytes of the stream in front of it.
+ * Returns 1 if a block was copied to text, 0 if there is none.
+ */
+int url_fmeta(URL_FILE *file, unsigned long long *offset, char *text, size_t size)
+{
+    struct icy_data *icy = file->icy;
+
+    if (!icy || icy->head == icy->tail || !size)
+        return 0;
+
+    *offset = icy->queue[icy->tail % ICY_QUEUE].offset;
+    strncpy(text, icy->queue[icy->tail % ICY_QUEUE].text, size - 1);
+    text[size - 1] = '\0';
+    icy->tail++;
+
+    return 1;
+}
+
+/*
+ * True once no more data will arrive, even if some is still buffered.
+ */
+int url_fended(URL_FILE *file)
+{
+    switch (file->type)
+    {
+    case CFTYPE_FILE:
+        return feof(file->handle.file);
+
+    case CFTYPE_CURL:
+        return !file->still_running;
+
+    default: /* unknown or supported type - oh dear */
+        errno = EBADF;
+        return -1;
+    }
+}
+
 size_t
 url_fread(void *ptr, size_t size, size_t nmemb, URL_FILE *file)
 {
@@ -408,6 +930,12 @@ url_fread(void *ptr, size_t size, size_t nmemb, URL_FILE *file)
     switch (file->type)
     {
     case CFTYPE_FILE:
+        if (ringbuf_used(&file->buffer))
+        {
+            /* hand out data left behind by url_fpeek() first */
+            want = ringbuf_read(&file->buffer, ptr, nmemb * size) / size;
+            break;
+        }
         want = fread(ptr, size, nmemb, file->handle.file);
         break;
 
@@ -418,22 +946,18 @@ url_fread(void *ptr, size_t size, size_t nmemb, URL_FILE *file)
 
         /* check if theres data in the buffer - if not fill_buffer()
          * either errored or EOF */
-        if (!file->buffer_pos)
+        if (!ringbuf_used(&file->buffer))
             return 0;
 
-        /* ensure only available data is considered */
-        if (file->buffer_pos < want)
-            want = file->buffer_pos;
-
-        /* xfer data to caller */
-        memcpy(ptr, file->buffer, want);
+        /* xfer data to caller, only available data is considered */
+        want = ringbuf_read(&file->buffer, ptr, want);
 
-        use_buffer(file, want);
+        resume_transfer(file);
 
         want = want / size; /* number of items - nb correct op - checked
                              * with glibc code*/
 
-        /*printf("(fread) return %d bytes %d left\n", want,file->buffer_pos);*/
+        /*printf("(fread) return %d bytes %d left\n", want,ringbuf_used(&file->buffer));*/
         break;
 
     default: /* unknown or supported type - oh dear */
@@ -444,10 +968,73 @@ url_fread(void *ptr, size_t size, size_t nmemb, URL_FILE *file)
     return want;
 }
 
+/*
+ * Zero-copy read: describe up to want buffered bytes in iov[0..1] (data
+ * may wrap around the end of the buffer) without copying them. Blocks
+ * like url_fread() until data is available. The bytes stay in the buffer
+ * until released with url_fconsume(); the iovecs are valid until then.
+ * Returns the number of iovecs filled, 0 on eof or error.
+ */
+int url_fpeek(URL_FILE *file, struct iovec iov[2], size_t want)
+{
+    char *ptr;
+    size_t len;
+    int n = 0;
+
+    switch (file->type)
+    {
+    case CFTYPE_FILE:
+        /* top up the buffer in place, reads come from the buffer as well */
+        if (ringbuf_used(&file->buffer) < want)
+        {
+            len = ringbuf_reserve(&file->buffer, &ptr);
+            ringbuf_commit(&file->buffer, fread(ptr, 1, len, file->handle.file));
+        }
+        n = ringbuf_peek(&file->buffer, iov, want);
+        break;
+
+    case CFTYPE_CURL:
+        fill_buffer(file, want, 1);
+
+        /* no data in the buffer means fill_buffer() either errored or EOF */
+        n = ringbuf_peek(&file->buffer, iov, want);
+        break;
+
+    default: /* unknown or supported type - oh dear */
+        errno = EBADF;
+        break;
+    }
+    return n;
+}
+
+/* release len bytes previously obtained with url_fpeek() */
+void url_fconsume(URL_FILE *file, size_t len)
+{
+    switch (file->type)
+    {
+    case CFTYPE_FILE:
+        ringbuf_consume(&file->buffer, len);
+        break;
+
+    case CFTYPE_CURL:
+        ringbuf_consume(&file->buffer, len);
+        resume_transfer(file);
+        break;
+
+    default: /* unknown or supported type - oh dear */
+        errno = EBADF;
+        break;
+    }
+}
+
 char *
 url_fgets(char *ptr, int size, URL_FILE *file)
 {
-    int want = size - 1; /* always need to leave room for zero termination */
+    size_t want = size - 1; /* always need to leave room for zero termination */
+    struct iovec iov[2];
+    char *newline;
+    size_t scanned;
+    int n;
     int loop;
 
     switch (file->type)
@@ -461,31 +1048,31 @@ url_fgets(char *ptr, int size, URL_FILE *file)
 
         /* check if theres data in the buffer - if not fill either errored or
          * EOF */
-        if (!file->buffer_pos)
+        if (!ringbuf_used(&file->buffer))
             return NULL;
 
-        /* ensure only available data is considered */
-        if (file->buffer_pos < want)
-            want = file->buffer_pos;
-
-        /*buffer contains data */
+        /*buffer contains data, possibly wrapped in two parts */
         /* look for newline or eof */
-        for (loop = 0; loop < want; loop++)
+        n = ringbuf_peek(&file->buffer, iov, want);
+        for (loop = 0, scanned = 0; loop < n; loop++)
         {
-            if (file->buffer[loop] == '\n')
+            newline = memchr(iov[loop].iov_base, '\n', iov[loop].iov_len);
+            if (newline)
             {
-                want = loop + 1; /* include newline */
+                scanned += newline - (char *)iov[loop].iov_base + 1; /* include newline */
                 break;
             }
+            scanned += iov[loop].iov_len;
         }
+        want = scanned;
 
         /* xfer data to caller */
-        memcpy(ptr, file->buffer, want);
+        ringbuf_read(&file->buffer, ptr, want);
         ptr[want] = 0; /* allways null terminate */
 
-        use_buffer(file, want);
+        resume_transfer(file);
 
-        /*printf("(fgets) return %d bytes %d left\n", want,file->buffer_pos);*/
+        /*printf("(fgets) return %d bytes %d left\n", want,ringbuf_used(&file->buffer));*/
         break;
 
     default: /* unknown or supported type - oh dear */
@@ -497,12 +1084,38 @@ url_fgets(char *ptr, int size, URL_FILE *file)
     return ptr; /*success */
 }
 
+/*
+ * Drive all transfers opened by url_fopen(): wait at most timeout_ms
+ * for network activity (or a curl timer), then move whatever arrived
+ * into the handle buffers. Used with handles set to non-blocking mode
+ * to record several streams from a single loop.
+ * Returns the number of transfers still in progress.
+ */
+int url_fwait(long timeout_ms)
+{
+    struct timeval timeout;
+
+    if (!multi_handle || !running_handles)
+    {
+        /* nothing to wait for, just pass the time */
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_usec = (timeout_ms % 1000) * 1000;
+        (void)select(0, NULL, NULL, NULL, &timeout);
+        return 0;
+    }
+
+    multi_wait(timeout_ms);
+
+    return running_handles;
+}
+
 void url_rewind(URL_FILE *file)
 {
     switch (file->type)
     {
     case CFTYPE_FILE:
         rewind(file->handle.file); /* passthrough */
+        ringbuf_reset(&file->buffer);
         break;
 
     case CFTYPE_CURL:
@@ -511,14 +1124,11 @@ void url_rewind(URL_FILE *file)
 
         /* restart */
         curl_multi_add_handle(multi_handle, file->handle.curl);
+        file->still_running = 1;
 
-        /* ditch buffer - write will recreate - resets stream pos*/
-        if (file->buffer)
-            free(file->buffer);
-
-        file->buffer = NULL;
-        file->buffer_pos = 0;
-        file->buffer_len = 0;
+        /* ditch buffered data - resets stream pos*/
+        ringbuf_reset(&file->buffer);
+        file->paused = 0;
 
         break;
 
@@ -5,18 +5,50 @@
 #ifndef URL_FOPEN
 #define URL_FOPEN
 
+#include <stddef.h>
+#include <sys/uio.h>
+
+/* default capacity of the receive buffer of each handle */
+#define URL_DEFAULT_BUFFERSIZE (256 * 1024)
+
+/* longest ICY metadata block (length byte 255, in units of 16 bytes) */
+#define URL_ICY_MAX (255 * 16)
+
 /* forware declaration */
 typedef struct fcurl_data URL_FILE;
 
+/* receive statistics of a stream, see url_fstat() */
+typedef struct
+{
+  unsigned long long received; /* bytes received */
+  long long last_receive;      /* (msec, url_clock()) last data, or the open */
+  long long opened;            /* (msec, url_clock()) of the open */
+  long ttfb;                   /* (msec) from the open to the first data, -1 before */
+  size_t buffered;             /* bytes received but not read yet */
+  size_t capacity;             /* size of the receive buffer */
+} URL_STAT;
+
 /* exported functions */
 URL_FILE *url_fopen(char *url, const char *operation, char *useragent);
 int url_setverbose(URL_FILE *file, int verbose);
 int url_setprogress(URL_FILE *file, int progress);
 int url_setuseragent(URL_FILE *file, char *agent);
+int url_setnonblocking(URL_FILE *file, int nonblocking);
+size_t url_setbuffersize(size_t size);
+int url_seticy(int enable);
 int url_fclose(URL_FILE *file);
 int url_feof(URL_FILE *file);
+int url_fended(URL_FILE *file);
+int url_fstat(URL_FILE *file, URL_STAT *stat);
+const char *url_feffective(URL_FILE *file);
+int url_fmeta(URL_FILE *file, unsigned long long *offset, char *text, size_t size);
+long long url_clock(void);
 size_t url_fread(void *ptr, size_t size, size_t nmemb, URL_FILE *file);
+int url_fpeek(URL_FILE *file, struct iovec iov[2], size_t want);
+void url_fconsume(URL_FILE *file, size_t len);
 char *url_fgets(char *ptr, int size, URL_FILE *file);
 void url_rewind(URL_FILE *file);
+int url_fwait(long timeout_ms);
+void url_cleanup(void);
 
 #endif /* URL_FOPEN */